@@ -78,6 +78,9 @@ void pi_cpi_close(struct pi_device *device)
 
   if (cpi->open_count == 0)
   {
+    // Stop the stream first as it still uses the channel and its buffers
+    pi_cpi_stream_stop(device);
+
     // Deactivate event routing
     soc_eu_fcEventMask_clearEvent(UDMA_EVENT_ID(periph_id));
 
@@ -109,11 +112,497 @@ void pi_cpi_capture_async(struct pi_device *device, void *buffer, int32_t size,
 
 
 
+void pi_cpi_stream_conf_init(struct pi_cpi_stream_conf *conf)
+{
+  conf->buffers = NULL;
+  conf->nb_buffers = 3;
+  conf->frame_size = 0;
+  conf->nb_slices = 1;
+  conf->slice_callback = NULL;
+  conf->slice_arg = NULL;
+}
+
+
+
+static inline void __pi_cpi_frame_push(rt_cpi_frame_t **first, rt_cpi_frame_t **last, rt_cpi_frame_t *frame)
+{
+  if (*first)
+    (*last)->next = frame;
+  else
+    *first = frame;
+
+  frame->next = NULL;
+  *last = frame;
+}
+
+
+
+static inline rt_cpi_frame_t *__pi_cpi_frame_pop(rt_cpi_frame_t **first)
+{
+  rt_cpi_frame_t *frame = *first;
+  if (frame)
+    *first = frame->next;
+  return frame;
+}
+
+
+
+static inline void __pi_cpi_enable(rt_cpi_t *cpi, int enable)
+{
+  udma_cpi_cam_cfg_glob_t reg = { .raw =  udma_cpi_cam_cfg_glob_get(cpi->base) };
+  reg.en = enable;
+  udma_cpi_cam_cfg_glob_set(cpi->base, reg.raw);
+}
+
+
+
+static void __pi_cpi_stream_deliver(rt_cpi_t *cpi, pi_task_t *task)
+{
+  rt_cpi_frame_t *frame = __pi_cpi_frame_pop(&cpi->ready_first);
+
+  task->implem.data[0] = cpi->pending_dropped;
+  task->implem.data[1] = (int)frame->buffer;
+
+  frame->held = 1;
+  cpi->pending_dropped = 0;
+}
+
+
+
+static void __pi_cpi_stream_handle_transfer(void *arg);
+
+// Keep the 2 uDMA slots busy with the next slices to capture. As no more than
+// 2 transfers are given to the channel, they are always directly enqueued to
+// the uDMA, and the next one is already there when a slice is finished.
+static void __pi_cpi_stream_enqueue(rt_cpi_t *cpi)
+{
+  while (cpi->nb_inflight < 2)
+  {
+    rt_cpi_frame_t *frame = cpi->enq_frame;
+
+    if (frame == NULL)
+    {
+      frame = __pi_cpi_frame_pop(&cpi->free_first);
+      if (frame == NULL)
+      {
+        // The application is late, overwrite the oldest frame it has not
+        // read yet
+        frame = __pi_cpi_frame_pop(&cpi->ready_first);
+        if (frame == NULL)
+        {
+          // All frames are owned by the application. Stop the interface
+          // once the on-going frame is over so that it restarts on a frame
+          // boundary when a frame is released. Nothing is overwritten, so
+          // this is not accounted as a dropped frame.
+          if (cpi->nb_inflight == 0 && !cpi->stalled)
+          {
+            __pi_cpi_enable(cpi, 0);
+            cpi->stalled = 1;
+          }
+          break;
+        }
+
+        cpi->dropped++;
+        cpi->pending_dropped++;
+      }
+
+      cpi->enq_frame = frame;
+      cpi->enq_slice = 0;
+    }
+
+    pi_task_t *task = pi_task_callback(&cpi->stream_task[cpi->task_enq], __pi_cpi_stream_handle_transfer, (void *)cpi);
+    cpi->task_enq ^= 1;
+
+    task->implem.data[4] = (int)frame;
+    task->implem.data[5] = cpi->enq_slice;
+
+    __rt_udma_copy_enqueue(task, UDMA_CHANNEL_ID(cpi->channel_id), &cpi->channel,
+      (uint32_t)frame->buffer + cpi->enq_slice * cpi->slice_size, cpi->slice_size, UDMA_CHANNEL_CFG_SIZE_16);
+
+    cpi->nb_inflight++;
+    cpi->enq_slice++;
+    if (cpi->enq_slice == cpi->nb_slices)
+      cpi->enq_frame = NULL;
+  }
+
+  // Restart the interface as soon as it has somewhere to write, which may be
+  // only one transfer, e.g. when frames are captured in one slice
+  if (cpi->stalled && cpi->nb_inflight)
+  {
+    cpi->stalled = 0;
+    __pi_cpi_enable(cpi, 1);
+  }
+}
+
+
+
+// Called for each finished slice, transfers finish in the order they are
+// enqueued
+static void __pi_cpi_stream_handle_transfer(void *arg)
+{
+  rt_cpi_t *cpi = (rt_cpi_t *)arg;
+
+  int irq = rt_irq_disable();
+
+  if (!cpi->streaming)
+    goto end;
+
+  pi_task_t *task = &cpi->stream_task[cpi->task_done];
+  cpi->task_done ^= 1;
+  cpi->nb_inflight--;
+
+  rt_cpi_frame_t *frame = (rt_cpi_frame_t *)task->implem.data[4];
+  int slice = task->implem.data[5];
+
+#if defined(ARCHI_HAS_CLUSTER)
+  pi_cpi_ingest_t *ingest = cpi->ingest;
+  if (ingest)
+  {
+    // The frame is owned by the cluster until all its stripes are released,
+    // just publish the stripe and wake-up the cluster
+    if (slice == 0)
+      ingest->ring[(ingest->produced / cpi->nb_slices) % cpi->nb_frames] = frame;
+    ingest->produced++;
+    __rt_cluster_notif_req_done(ingest->cid);
+  }
+  else
+#endif
+  if (slice == cpi->nb_slices - 1)
+  {
+    __pi_cpi_frame_push(&cpi->ready_first, &cpi->ready_last, frame);
+
+    pi_task_t *waiting = cpi->waiting_first;
+    if (waiting)
+    {
+      cpi->waiting_first = waiting->implem.next;
+      __pi_cpi_stream_deliver(cpi, waiting);
+      __rt_event_enqueue(waiting);
+    }
+  }
+
+  __pi_cpi_stream_enqueue(cpi);
+
+  if (cpi->slice_callback)
+  {
+    rt_irq_restore(irq);
+    cpi->slice_callback(cpi->slice_arg, frame->buffer, slice);
+    return;
+  }
+
+end:
+  rt_irq_restore(irq);
+}
+
+
+
+static void __pi_cpi_stream_free(rt_cpi_t *cpi)
+{
+  if (cpi->pool)
+    pmsis_l2_malloc_free(cpi->pool, cpi->nb_frames * cpi->nb_slices * cpi->slice_size);
+  if (cpi->ingest)
+    pmsis_l2_malloc_free(cpi->ingest->ring, cpi->nb_frames * sizeof(rt_cpi_frame_t *));
+  pmsis_l2_malloc_free(cpi->frames, cpi->nb_frames * sizeof(rt_cpi_frame_t));
+}
+
+
+
+int pi_cpi_stream_start(struct pi_device *device, struct pi_cpi_stream_conf *conf)
+{
+  rt_cpi_t *cpi = (rt_cpi_t *)device->data;
+  int nb_frames = conf->nb_buffers;
+
+  if (cpi->streaming || nb_frames < 2 || nb_frames > 255 || conf->nb_slices < 1 ||
+    conf->nb_slices > 255 || conf->frame_size % conf->nb_slices)
+    return -1;
+
+  int irq = rt_irq_disable();
+
+  cpi->frames = pmsis_l2_malloc(nb_frames * sizeof(rt_cpi_frame_t));
+  if (cpi->frames == NULL)
+    goto error;
+
+  cpi->pool = NULL;
+  if (conf->buffers == NULL)
+  {
+    cpi->pool = pmsis_l2_malloc(nb_frames * conf->frame_size);
+    if (cpi->pool == NULL)
+    {
+      pmsis_l2_malloc_free(cpi->frames, nb_frames * sizeof(rt_cpi_frame_t));
+      goto error;
+    }
+  }
+
+  cpi->nb_frames = nb_frames;
+  cpi->nb_slices = conf->nb_slices;
+  cpi->slice_size = conf->frame_size / conf->nb_slices;
+  cpi->slice_callback = cpi->ingest ? NULL : conf->slice_callback;
+  cpi->slice_arg = conf->slice_arg;
+  cpi->free_first = NULL;
+  cpi->ready_first = NULL;
+  cpi->enq_frame = NULL;
+  cpi->waiting_first = NULL;
+  cpi->nb_inflight = 0;
+  cpi->task_enq = 0;
+  cpi->task_done = 0;
+  cpi->stalled = 0;
+  cpi->dropped = 0;
+  cpi->pending_dropped = 0;
+  cpi->streaming = 1;
+
+  for (int i=0; i<nb_frames; i++)
+  {
+    rt_cpi_frame_t *frame = &cpi->frames[i];
+    if (conf->buffers)
+      frame->buffer = conf->buffers[i];
+    else
+      frame->buffer = (void *)((uint32_t)cpi->pool + i * conf->frame_size);
+    frame->cpi = (void *)cpi;
+    frame->held = 0;
+
+    __pi_cpi_frame_push(&cpi->free_first, &cpi->free_last, frame);
+  }
+
+  __pi_cpi_stream_enqueue(cpi);
+
+  __pi_cpi_enable(cpi, 1);
+
+  rt_irq_restore(irq);
+
+  return 0;
+
+error:
+  rt_irq_restore(irq);
+  return -1;
+}
+
+
+
+void pi_cpi_stream_stop(struct pi_device *device)
+{
+  rt_cpi_t *cpi = (rt_cpi_t *)device->data;
+
+  int irq = rt_irq_disable();
+
+  if (cpi->streaming)
+  {
+    cpi->streaming = 0;
+
+    __pi_cpi_enable(cpi, 0);
+
+    // Drop the on-going transfers so that the channel can be used again
+    plp_udma_clr(hal_udma_channel_base(UDMA_CHANNEL_ID(cpi->channel_id)));
+    __rt_udma_channel_init(UDMA_EVENT_ID(cpi->channel_id), &cpi->channel);
+
+    // Waiting reads can not get any frame anymore, complete them with a NULL
+    // frame
+    pi_task_t *waiting = cpi->waiting_first;
+    while (waiting)
+    {
+      pi_task_t *next = waiting->implem.next;
+      waiting->implem.data[0] = cpi->pending_dropped;
+      waiting->implem.data[1] = 0;
+      cpi->pending_dropped = 0;
+      __rt_event_enqueue(waiting);
+      waiting = next;
+    }
+    cpi->waiting_first = NULL;
+
+    __pi_cpi_stream_free(cpi);
+#if defined(ARCHI_HAS_CLUSTER)
+    if (cpi->ingest)
+    {
+      __rt_cluster_idle_busy(&__rt_fc_cluster_data[cpi->ingest->cid], 0);
+      cpi->ingest = NULL;
+    }
+#endif
+  }
+
+  rt_irq_restore(irq);
+}
+
+
+
+void pi_cpi_stream_read_async(struct pi_device *device, pi_task_t *task)
+{
+  rt_cpi_t *cpi = (rt_cpi_t *)device->data;
+
+  int irq = rt_irq_disable();
+
+  __rt_task_init(task);
+
+  if (cpi->ready_first && cpi->waiting_first == NULL)
+  {
+    __pi_cpi_stream_deliver(cpi, task);
+    __rt_event_enqueue(task);
+  }
+  else
+  {
+    if (cpi->waiting_first)
+      cpi->waiting_last->implem.next = task;
+    else
+      cpi->waiting_first = task;
+
+    task->implem.next = NULL;
+    cpi->waiting_last = task;
+  }
+
+  rt_irq_restore(irq);
+}
+
+
+
+static void __pi_cpi_stream_release_frame(rt_cpi_t *cpi, rt_cpi_frame_t *frame)
+{
+  __pi_cpi_frame_push(&cpi->free_first, &cpi->free_last, frame);
+
+  // Restart the interface in case it was stopped due to missing buffers
+  if (cpi->streaming)
+    __pi_cpi_stream_enqueue(cpi);
+}
+
+
+
+int pi_cpi_stream_release(struct pi_device *device, void *buffer)
+{
+  rt_cpi_t *cpi = (rt_cpi_t *)device->data;
+  int err = -1;
+
+  int irq = rt_irq_disable();
+
+  if (!cpi->streaming)
+    goto end;
+
+  for (int i=0; i<cpi->nb_frames; i++)
+  {
+    rt_cpi_frame_t *frame = &cpi->frames[i];
+    if (frame->buffer == buffer)
+    {
+      // Only a frame returned by a read can be given back, any other one is
+      // still used by the stream
+      if (frame->held)
+      {
+        frame->held = 0;
+        __pi_cpi_stream_release_frame(cpi, frame);
+        err = 0;
+      }
+      break;
+    }
+  }
+
+end:
+  rt_irq_restore(irq);
+
+  return err;
+}
+
+
+
+#if defined(ARCHI_HAS_CLUSTER)
+
+int pi_cpi_ingest_start(struct pi_device *device, struct pi_cpi_stream_conf *conf, pi_cpi_ingest_t *ingest, int cid)
+{
+  rt_cpi_t *cpi = (rt_cpi_t *)device->data;
+
+  // Stripes are copied to L1 with a single cluster DMA transfer, whose size
+  // is limited to 16 bits
+  if (cpi->streaming || conf->nb_slices < 1 || conf->frame_size / conf->nb_slices > 0xFFFF)
+    return -1;
+
+  ingest->ring = pmsis_l2_malloc(conf->nb_buffers * sizeof(rt_cpi_frame_t *));
+  if (ingest->ring == NULL)
+    return -1;
+
+  ingest->produced = 0;
+  ingest->fetched = 0;
+  ingest->consumed = 0;
+  ingest->nb_frames = conf->nb_buffers;
+  ingest->nb_slices = conf->nb_slices;
+  ingest->slice_size = conf->frame_size / conf->nb_slices;
+  ingest->cid = cid;
+
+  cpi->ingest = ingest;
+
+  // The cluster only waits for stripes and is not sent any task, keep it
+  // active whatever its idle policy until the stream is stopped
+  __rt_cluster_idle_busy(&__rt_fc_cluster_data[cid], 1);
+
+  if (pi_cpi_stream_start(device, conf))
+  {
+    __rt_cluster_idle_busy(&__rt_fc_cluster_data[cid], 0);
+    cpi->ingest = NULL;
+    pmsis_l2_malloc_free(ingest->ring, conf->nb_buffers * sizeof(rt_cpi_frame_t *));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+static void __pi_cpi_ingest_release_frame(void *arg)
+{
+  rt_cpi_frame_t *frame = (rt_cpi_frame_t *)arg;
+
+  int irq = rt_irq_disable();
+  __pi_cpi_stream_release_frame((rt_cpi_t *)frame->cpi, frame);
+  rt_irq_restore(irq);
+}
+
+
+
+int pi_cl_cpi_ingest_get(pi_cpi_ingest_t *ingest, void *l1_buffer, pi_cl_dma_copy_t *copy)
+{
+  uint32_t index = ingest->fetched++;
+
+  while (*(volatile uint32_t *)&ingest->produced <= index)
+  {
+    eu_evt_maskWaitAndClr(1<<RT_CLUSTER_CALL_EVT);
+  }
+
+  rt_cpi_frame_t *frame = ingest->ring[(index / ingest->nb_slices) % ingest->nb_frames];
+  int slice = index % ingest->nb_slices;
+
+  copy->ext = (uint32_t)frame->buffer + slice * ingest->slice_size;
+  copy->loc = (uint32_t)l1_buffer;
+  copy->size = ingest->slice_size;
+  copy->dir = PI_CL_DMA_DIR_EXT2LOC;
+  copy->merge = 0;
+
+  pi_cl_dma_memcpy(copy);
+
+  return slice;
+}
+
+
+
+void pi_cl_cpi_ingest_release(pi_cpi_ingest_t *ingest)
+{
+  uint32_t index = ingest->consumed++;
+
+  // Give the frame back to the stream once its last stripe is released
+  if (index % ingest->nb_slices == ingest->nb_slices - 1)
+  {
+    rt_cpi_frame_t *frame = ingest->ring[(index / ingest->nb_slices) % ingest->nb_frames];
+    rt_event_t *event = &frame->release_task;
+    __rt_init_event(event, rt_event_internal_sched(), __pi_cpi_ingest_release_frame, (void *)frame);
+    // Mark it as pending event so that it is not added to the list of free events
+    // as it stands inside the frame
+    __rt_event_set_pending(event);
+    __rt_cluster_push_fc_event(event);
+  }
+}
+
+#endif
+
+
+
 static void __attribute__((constructor)) __rt_cpi_init()
 {
   for (int i=0; i<ARCHI_UDMA_NB_CAM; i++)
   {
     __rt_cpi[i].open_count = 0;
+    __rt_cpi[i].streaming = 0;
+    __rt_cpi[i].ingest = NULL;
     __rt_udma_channel_init(UDMA_EVENT_ID(ARCHI_UDMA_CAM_ID(0) + i), &__rt_cpi[i].channel);
   }
 }
@@ -23,6 +23,8 @@
 
 static L2_DATA pi_i2c_t __rt_i2c[ARCHI_UDMA_NB_I2C];
 
+void __rt_i2c_handle_batch_step(pi_i2c_t *i2c);
+
 
 #ifndef __RT_I2C_COPY_ASM
 
@@ -65,6 +67,11 @@ void udma_event_handler_end(pi_i2c_t *i2c)
   __rt_event_handle_end_of_task(task);
 }
 
+void __rt_i2c_batch_step(pi_i2c_t *i2c)
+{
+  __rt_i2c_handle_batch_step(i2c);
+}
+
 #else
 
 void __rt_i2c_handle_tx_copy();
@@ -73,6 +80,7 @@ extern void __rt_i2c_step1();
 extern void __rt_i2c_step2();
 extern void __rt_i2c_step3();
 extern void udma_event_handler_end();
+extern void __rt_i2c_batch_step();
 
 #endif
 
@@ -230,6 +238,185 @@ void pi_i2c_read(struct pi_device *device, uint8_t *data, int length, pi_i2c_xfe
   pi_task_wait_on(&task);
 }
 
+static inline int __rt_i2c_write_read_check(uint32_t tx_size, uint32_t rx_size)
+{
+  return tx_size >= 1 && tx_size <= PI_I2C_WRITE_READ_MAX_TX && rx_size >= 1 && rx_size <= 256;
+}
+
+void pi_i2c_write_read_async(struct pi_device *device, void *tx_buffer, void *rx_buffer, uint32_t tx_size, uint32_t rx_size, pi_task_t *task)
+{
+  int irq = rt_irq_disable();
+
+  __rt_task_init(task);
+
+  pi_i2c_t *i2c = (pi_i2c_t *)device->data;
+
+  // The bytes to be written must fit the command sequence and the number of
+  // bytes to be read the 8 bits repeat counter. There is no way to report an
+  // error through the task, so it is just notified without any transfer.
+  if (!__rt_i2c_write_read_check(tx_size, rx_size))
+  {
+    __rt_event_handle_end_of_task(task);
+    goto end;
+  }
+
+  i2c->pending_copy = task;
+
+  // The whole transaction, including the bytes to be written, is put in one
+  // command sequence, so that we only get the final notification
+  int seq_index = 0;
+  unsigned char *cmd = i2c->udma_seq_cmd[0];
+  uint8_t *tx_data = (uint8_t *)tx_buffer;
+  i2c->pending_step = (uint32_t)udma_event_handler_end;
+
+  cmd[seq_index++] = I2C_CMD_CFG;
+  cmd[seq_index++] = (i2c->div >> 8) & 0xFF;
+  cmd[seq_index++] = (i2c->div & 0xFF);
+  cmd[seq_index++] = I2C_CMD_START;
+  cmd[seq_index++] = I2C_CMD_WR;
+  cmd[seq_index++] = i2c->cs;
+
+  if (tx_size > 1){
+    cmd[seq_index++] = I2C_CMD_RPT;
+    cmd[seq_index++] = tx_size;
+  }
+  cmd[seq_index++] = I2C_CMD_WR;
+
+  for (int i=0; i<tx_size; i++)
+  {
+    cmd[seq_index++] = tx_data[i];
+  }
+
+  cmd[seq_index++] = I2C_CMD_START;
+  cmd[seq_index++] = I2C_CMD_WR;
+  cmd[seq_index++] = i2c->cs | 0x1;
+
+  if (rx_size > 1){
+    cmd[seq_index++] = I2C_CMD_RPT;
+    cmd[seq_index++] = rx_size - 1;
+    cmd[seq_index++] = I2C_CMD_RD_ACK;
+  }
+  cmd[seq_index++] = I2C_CMD_RD_NACK;
+  cmd[seq_index++] = I2C_CMD_STOP;
+
+  unsigned int base = hal_udma_channel_base(i2c->channel);
+
+  plp_udma_enqueue(base + UDMA_CHANNEL_RX_OFFSET, (unsigned int)rx_buffer, rx_size, UDMA_CHANNEL_CFG_EN);
+  plp_udma_enqueue(base + UDMA_CHANNEL_TX_OFFSET, (unsigned int)cmd, seq_index, UDMA_CHANNEL_CFG_EN);
+
+end:
+  rt_irq_restore(irq);
+}
+
+int pi_i2c_write_read(struct pi_device *device, void *tx_buffer, void *rx_buffer, uint32_t tx_size, uint32_t rx_size)
+{
+  if (!__rt_i2c_write_read_check(tx_size, rx_size))
+    return -1;
+
+  struct pi_task task;
+  pi_i2c_write_read_async(device, tx_buffer, rx_buffer, tx_size, rx_size, pi_task_block(&task));
+  pi_task_wait_on(&task);
+
+  return 0;
+}
+
+static void __rt_i2c_batch_enqueue(pi_i2c_t *i2c, int seq_index)
+{
+  unsigned char *cmd = i2c->udma_seq_cmd[i2c->batch_index];
+
+  // Pack as many register writes as possible in the command sequence, each one
+  // takes at most 10 bytes
+  while (i2c->batch_remaining && seq_index + 10 <= PI_I2C_SEQ_CMD_SIZE)
+  {
+    pi_i2c_reg_t *reg = i2c->batch_regs++;
+    i2c->batch_remaining--;
+
+    cmd[seq_index++] = I2C_CMD_START;
+    cmd[seq_index++] = I2C_CMD_WR;
+    cmd[seq_index++] = i2c->cs;
+    if (i2c->batch_addr_size == 2)
+    {
+      cmd[seq_index++] = I2C_CMD_WR;
+      cmd[seq_index++] = reg->addr >> 8;
+    }
+    cmd[seq_index++] = I2C_CMD_WR;
+    cmd[seq_index++] = reg->addr & 0xFF;
+    cmd[seq_index++] = I2C_CMD_WR;
+    cmd[seq_index++] = reg->value;
+    cmd[seq_index++] = I2C_CMD_STOP;
+  }
+
+  plp_udma_enqueue(i2c->pending_base, (unsigned int)cmd, seq_index, UDMA_CHANNEL_CFG_EN);
+
+  i2c->batch_index ^= 1;
+  i2c->batch_inflight++;
+}
+
+void __rt_i2c_handle_batch_step(pi_i2c_t *i2c)
+{
+  i2c->batch_inflight--;
+
+  // Refill the sequence which has just been sent, while the other one is
+  // being sent, so that the bus is never idle
+  if (i2c->batch_remaining)
+  {
+    __rt_i2c_batch_enqueue(i2c, 0);
+  }
+  else if (i2c->batch_inflight == 0)
+  {
+    pi_task_t *task = i2c->pending_copy;
+    i2c->pending_copy = NULL;
+    __rt_event_handle_end_of_task(task);
+  }
+}
+
+void pi_i2c_write_regs_async(struct pi_device *device, pi_i2c_reg_t *regs, int nb_regs, int addr_size, pi_task_t *task)
+{
+  int irq = rt_irq_disable();
+
+  __rt_task_init(task);
+
+  pi_i2c_t *i2c = (pi_i2c_t *)device->data;
+
+  if (nb_regs == 0)
+  {
+    __rt_event_handle_end_of_task(task);
+    goto end;
+  }
+
+  i2c->pending_copy = task;
+  i2c->pending_step = (uint32_t)__rt_i2c_batch_step;
+  i2c->pending_base = hal_udma_channel_base(i2c->channel + 1);
+  i2c->batch_regs = regs;
+  i2c->batch_remaining = nb_regs;
+  i2c->batch_addr_size = addr_size;
+  i2c->batch_index = 0;
+  i2c->batch_inflight = 0;
+
+  // The configuration is kept by the interface, it is only needed in the
+  // first sequence
+  unsigned char *cmd = i2c->udma_seq_cmd[0];
+  cmd[0] = I2C_CMD_CFG;
+  cmd[1] = (i2c->div >> 8) & 0xFF;
+  cmd[2] = (i2c->div & 0xFF);
+
+  // Use both uDMA slots so that the second sequence is already queued when
+  // the first one is over
+  __rt_i2c_batch_enqueue(i2c, 3);
+  if (i2c->batch_remaining)
+    __rt_i2c_batch_enqueue(i2c, 0);
+
+end:
+  rt_irq_restore(irq);
+}
+
+void pi_i2c_write_regs(struct pi_device *device, pi_i2c_reg_t *regs, int nb_regs, int addr_size)
+{
+  struct pi_task task;
+  pi_i2c_write_regs_async(device, regs, nb_regs, addr_size, pi_task_block(&task));
+  pi_task_wait_on(&task);
+}
+
 int pi_i2c_open(struct pi_device *device)
 {
   int irq = rt_irq_disable();
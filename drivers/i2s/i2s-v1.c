@@ -51,8 +51,132 @@ void pi_i2s_conf_init(struct pi_i2s_conf *conf)
 }
 
 
+void pi_i2s_ring_conf_init(struct pi_i2s_ring_conf *conf)
+{
+    conf->buffers = NULL;
+    conf->nb_buffers = 4;
+    conf->explicit_release = 0;
+}
+
+
+static inline void __pos_i2s_block_push(pos_i2s_block_t **first, pos_i2s_block_t **last, pos_i2s_block_t *block)
+{
+    if (*first)
+        (*last)->next = block;
+    else
+        *first = block;
+
+    block->next = NULL;
+    *last = block;
+}
+
+
+static inline pos_i2s_block_t *__pos_i2s_block_pop(pos_i2s_block_t **first)
+{
+    pos_i2s_block_t *block = *first;
+    if (block)
+        *first = block->next;
+    return block;
+}
+
+
+// Give the oldest full block to a read task. In implicit release mode, the
+// block stays owned by the application until its next read.
+static void __pos_i2s_ring_deliver(pos_i2s_t *i2s, pi_task_t *task)
+{
+    pos_i2s_block_t *block = __pos_i2s_block_pop(&i2s->ready_first);
+
+    block->held = 1;
+    if (!i2s->explicit_release)
+    {
+        // When several reads were queued, this one is the next read of the
+        // block delivered to the previous one, which is then released
+        if (i2s->held)
+        {
+            i2s->held->held = 0;
+            __pos_i2s_block_push(&i2s->free_first, &i2s->free_last, i2s->held);
+        }
+        i2s->held = block;
+    }
+
+    task->implem.data[0] = i2s->pending_overruns;
+    task->implem.data[1] = (int)block->buffer;
+    task->implem.data[2] = i2s->conf.block_size;
+    task->implem.data[3] = block->timestamp;
+
+    i2s->pending_overruns = 0;
+}
+
+
+// Give blocks to the uDMA until both channel slots are used. If the consumer
+// is late and all blocks are full, the oldest one which has not been read yet
+// is overwritten. If the application holds all the other blocks, there is
+// nothing to give and the uDMA is re-armed when a block is released.
+static void __pos_i2s_ring_rearm(pos_i2s_t *i2s)
+{
+    unsigned int base = hal_udma_channel_base(i2s->channel);
+
+    while (i2s->nb_dma_blocks < 2)
+    {
+        pos_i2s_block_t *next = __pos_i2s_block_pop(&i2s->free_first);
+        if (next == NULL)
+        {
+            next = __pos_i2s_block_pop(&i2s->ready_first);
+            if (next == NULL)
+                return;
+
+            i2s->overruns++;
+            i2s->pending_overruns++;
+        }
+
+        __pos_i2s_block_push(&i2s->dma_first, &i2s->dma_last, next);
+        i2s->nb_dma_blocks++;
+        plp_udma_enqueue(base, (int)next->buffer, i2s->conf.block_size, i2s->udma_cfg);
+    }
+}
+
+
+static void __pos_i2s_ring_handle_copy(pos_i2s_t *i2s)
+{
+    // The block at the head of the uDMA queue is the one which is now full
+    pos_i2s_block_t *block = __pos_i2s_block_pop(&i2s->dma_first);
+    i2s->nb_dma_blocks--;
+    block->timestamp = rt_time_get_us();
+    __pos_i2s_block_push(&i2s->ready_first, &i2s->ready_last, block);
+
+    // Give the block to a waiting reader before choosing a block to
+    // overwrite, so that the reader cannot find the ready list empty
+    pi_task_t *waiting = i2s->waiting_first;
+
+    if (waiting)
+    {
+        i2s->waiting_first = waiting->implem.next;
+        __pos_i2s_ring_deliver(i2s, waiting);
+        __rt_event_enqueue(waiting);
+    }
+
+    if (i2s->reenqueue)
+    {
+        __pos_i2s_ring_rearm(i2s);
+
+        // Samples are lost until the application releases a block
+        if (i2s->nb_dma_blocks == 0)
+        {
+            i2s->overruns++;
+            i2s->pending_overruns++;
+        }
+    }
+}
+
+
 void __pos_i2s_handle_copy(pos_i2s_t *i2s)
 {
+    if (i2s->nb_blocks)
+    {
+        __pos_i2s_ring_handle_copy(i2s);
+        return;
+    }
+
     if (i2s->reenqueue)
     {
         unsigned int base = hal_udma_channel_base(i2s->channel);
@@ -84,9 +208,6 @@ int pi_i2s_open(struct pi_device *device)
     pos_i2s_t *i2s = &__pos_i2s[itf_id];
     int periph_id = ARCHI_UDMA_I2S_ID(itf_id >> 1);
 
-    if (conf->pingpong_buffers[0] == NULL || conf->pingpong_buffers[1] == NULL)
-        return -1;
-
     device->data = (void *)i2s;
 
     memcpy(&i2s->conf, conf, sizeof(struct pi_i2s_conf));
@@ -107,6 +228,7 @@ int pi_i2s_open(struct pi_device *device)
 
         i2s->channel = channel_id;
         i2s->reenqueue = 0;
+        i2s->nb_blocks = 0;
         if (conf->word_size == 16)
             i2s->udma_cfg = UDMA_CHANNEL_CFG_EN | UDMA_CHANNEL_CFG_SIZE_16;
         else
@@ -178,6 +300,106 @@ int pi_i2s_open(struct pi_device *device)
 }
 
 
+static void __pos_i2s_ring_free(pos_i2s_t *i2s)
+{
+    if (i2s->nb_blocks)
+    {
+        if (i2s->pool)
+            pmsis_l2_malloc_free(i2s->pool, i2s->nb_blocks * i2s->conf.block_size);
+        pmsis_l2_malloc_free(i2s->blocks, i2s->nb_blocks * sizeof(pos_i2s_block_t));
+        i2s->nb_blocks = 0;
+    }
+}
+
+
+int pi_i2s_ring_setup(struct pi_device *device, struct pi_i2s_ring_conf *conf)
+{
+    pos_i2s_t *i2s = (pos_i2s_t *)device->data;
+    int nb_blocks = conf->nb_buffers;
+
+    // At least one block is needed in addition to the 2 enqueued to the
+    // uDMA, otherwise this is just ping-pong mode
+    if (nb_blocks < 3 || nb_blocks > 255)
+        return -1;
+
+    int irq = rt_irq_disable();
+
+    // The uDMA may still be writing to the current blocks
+    if (i2s->reenqueue)
+        goto error;
+
+    __pos_i2s_ring_free(i2s);
+
+    i2s->blocks = pmsis_l2_malloc(nb_blocks * sizeof(pos_i2s_block_t));
+    if (i2s->blocks == NULL)
+        goto error;
+
+    i2s->pool = NULL;
+    if (conf->buffers == NULL)
+    {
+        i2s->pool = pmsis_l2_malloc(nb_blocks * i2s->conf.block_size);
+        if (i2s->pool == NULL)
+        {
+            pmsis_l2_malloc_free(i2s->blocks, nb_blocks * sizeof(pos_i2s_block_t));
+            goto error;
+        }
+    }
+
+    for (int i=0; i<nb_blocks; i++)
+    {
+        if (conf->buffers)
+            i2s->blocks[i].buffer = conf->buffers[i];
+        else
+            i2s->blocks[i].buffer = (void *)((uint32_t)i2s->pool + i * i2s->conf.block_size);
+    }
+
+    i2s->nb_blocks = nb_blocks;
+    i2s->explicit_release = conf->explicit_release;
+
+    rt_irq_restore(irq);
+
+    return 0;
+
+error:
+    rt_irq_restore(irq);
+    return -1;
+}
+
+
+int pi_i2s_ring_release(struct pi_device *device, void *mem_block)
+{
+    pos_i2s_t *i2s = (pos_i2s_t *)device->data;
+    int err = -1;
+
+    int irq = rt_irq_disable();
+
+    // Only blocks delivered by a read and not released yet can be released,
+    // giving twice the same block would corrupt the free list
+    for (int i=0; i<i2s->nb_blocks; i++)
+    {
+        pos_i2s_block_t *block = &i2s->blocks[i];
+        if (block->buffer == mem_block)
+        {
+            if (i2s->explicit_release && block->held)
+            {
+                block->held = 0;
+                __pos_i2s_block_push(&i2s->free_first, &i2s->free_last, block);
+
+                if (i2s->reenqueue)
+                    __pos_i2s_ring_rearm(i2s);
+
+                err = 0;
+            }
+            break;
+        }
+    }
+
+    rt_irq_restore(irq);
+
+    return err;
+}
+
+
 static inline void __pos_i2s_suspend(pos_i2s_t *i2s)
 {
     unsigned int base = hal_udma_channel_base(i2s->channel);
@@ -214,6 +436,8 @@ void pi_i2s_close(struct pi_device *device)
     {
         // Deactivate event routing
         soc_eu_fcEventMask_clearEvent(i2s->channel);
+
+        __pos_i2s_ring_free(i2s);
     }
 
     __pos_i2s_global_open_count--;
@@ -245,8 +469,29 @@ static inline void __pos_i2s_resume(pos_i2s_t *i2s)
     i2s->nb_ready_buffer = 0;
     i2s->waiting_first = NULL;
 
-    plp_udma_enqueue(base, (int)i2s->conf.pingpong_buffers[0], i2s->conf.block_size, i2s->udma_cfg);
-    plp_udma_enqueue(base, (int)i2s->conf.pingpong_buffers[1], i2s->conf.block_size, i2s->udma_cfg);
+    if (i2s->nb_blocks)
+    {
+        i2s->free_first = NULL;
+        i2s->dma_first = NULL;
+        i2s->ready_first = NULL;
+        i2s->held = NULL;
+        i2s->overruns = 0;
+        i2s->pending_overruns = 0;
+
+        for (int i=0; i<i2s->nb_blocks; i++)
+        {
+            i2s->blocks[i].held = 0;
+            __pos_i2s_block_push(&i2s->free_first, &i2s->free_last, &i2s->blocks[i]);
+        }
+
+        i2s->nb_dma_blocks = 0;
+        __pos_i2s_ring_rearm(i2s);
+    }
+    else
+    {
+        plp_udma_enqueue(base, (int)i2s->conf.pingpong_buffers[0], i2s->conf.block_size, i2s->udma_cfg);
+        plp_udma_enqueue(base, (int)i2s->conf.pingpong_buffers[1], i2s->conf.block_size, i2s->udma_cfg);
+    }
 
     unsigned int conf = 
         UDMA_I2S_CFG_CLKGEN0_BITS_WORD(i2s->conf.word_size - 1) | 
@@ -266,6 +511,12 @@ int pi_i2s_ioctl(struct pi_device *device, uint32_t cmd, void *arg)
     switch (cmd)
     {
         case PI_I2S_IOCTL_START:
+            if (i2s->nb_blocks == 0 &&
+                (i2s->conf.pingpong_buffers[0] == NULL || i2s->conf.pingpong_buffers[1] == NULL))
+            {
+                rt_irq_restore(irq);
+                return -1;
+            }
             __pos_i2s_resume(i2s);
             break;
 
@@ -291,6 +542,35 @@ int pi_i2s_read_async(struct pi_device *device, pi_task_t *task)
 
     int irq = rt_irq_disable();
 
+    if (i2s->nb_blocks)
+    {
+        // The block returned by the previous read can now be overwritten
+        if (i2s->held)
+        {
+            i2s->held->held = 0;
+            __pos_i2s_block_push(&i2s->free_first, &i2s->free_last, i2s->held);
+            i2s->held = NULL;
+        }
+
+        if (i2s->ready_first && i2s->waiting_first == NULL)
+        {
+            __pos_i2s_ring_deliver(i2s, task);
+            __rt_event_enqueue(task);
+        }
+        else
+        {
+            if (i2s->waiting_first)
+                i2s->waiting_last->implem.next = task;
+            else
+                i2s->waiting_first = task;
+
+            task->implem.next = NULL;
+            i2s->waiting_last = task;
+        }
+
+        goto end;
+    }
+
     // Prepare now the task results, the IRQ handler can still overwrite
     // them if they are different.
     task->implem.data[0] = 0;
@@ -314,6 +594,7 @@ int pi_i2s_read_async(struct pi_device *device, pi_task_t *task)
         i2s->waiting_last = task;
     }
 
+end:
     rt_irq_restore(irq);
 
     return 0;
@@ -341,9 +622,12 @@ int pi_i2s_read(struct pi_device *dev, void **mem_block, size_t *size)
 }
 
 
+// This version of the I2S peripheral can only receive samples, its 2 uDMA
+// channels are both used for reception, one per interface, so report
+// the failure instead of silently dropping the samples.
 int pi_i2s_write(struct pi_device *dev, void *mem_block, size_t size)
 {
-    return 0;
+    return -1;
 }
 
 static void __attribute__((constructor)) __pos_i2s_init()
@@ -353,5 +637,6 @@ static void __attribute__((constructor)) __pos_i2s_init()
     for (int i=0; i<ARCHI_UDMA_NB_I2S; i++)
     {
         __pos_i2s[i].open_count = 0;
+        __pos_i2s[i].nb_blocks = 0;
     }
 }
\ No newline at end of file
@@ -45,33 +45,14 @@ typedef struct {
 } rt_spim_cmd_t;
 
 
-void __pi_handle_waiting_copy(pi_task_t *task);
-
-void __rt_spi_handle_repeat(void *arg);
+void __pi_spim_handle_step_end(pi_spim_t *spim);
 
 
 #ifndef __RT_SPIM_COPY_ASM
 
 void __pi_spim_handle_eot(int event, void *arg)
 {
-  pi_spim_t *spim = (pi_spim_t *)arg;
-
-  if (spim->pending_repeat_len)
-  {
-    __rt_spi_handle_repeat((void *)spim);
-    return;
-  }
-
-  pi_task_t *task = spim->pending_copy;
-  spim->pending_copy = NULL;
-  __rt_event_handle_end_of_task(task);
-
-  task = spim->waiting_first;
-  if (task)
-  {
-    spim->waiting_first = task->implem.next;
-    __pi_handle_waiting_copy(task);
-  }
+  __pi_spim_handle_step_end((pi_spim_t *)arg);
 }
 
 void __rt_spim_handle_rx_copy(int event, void *arg)
@@ -164,7 +145,9 @@ int pi_spi_open(struct pi_device *device)
     __rt_udma_callback_data[periph_id] = spim;
     soc_eu_fcEventMask_setEvent(ARCHI_SOC_EVENT_PERIPH_EVT_BASE(periph_id) + ARCHI_UDMA_SPIM_EOT_EVT);
 
-    spim->pending_repeat_len = 0;
+    spim->step_head = 0;
+    spim->step_count = 0;
+    spim->prod_task = NULL;
   }
 
   rt_irq_restore(irq);
@@ -228,161 +211,273 @@ void pi_spi_close(struct pi_device *device)
   rt_irq_restore(irq);
 }
 
-void __rt_spi_handle_repeat(void *arg)
+// All operations are split into steps, each one being a sequence of SPI
+// commands terminated by an end-of-transfer command, so that each step
+// generates an end-of-transfer event. As the uDMA channels have 2 slots, up to
+// 2 steps are enqueued at the same time, so that the next step is already
+// in the uDMA when the current one finishes and the bus does not stay idle
+// between them. The command buffers of the steps are alternated as the one
+// of the current step is still read by the uDMA.
+
+// Maximum number of bits transferred by one step, longer transfers are
+// split into several steps
+#define __PI_SPIM_CHUNK_BITS (8192*8)
+
+#define __PI_SPIM_RECEIVE  0
+#define __PI_SPIM_SEND     1
+#define __PI_SPIM_TRANSFER 2
+#define __PI_SPIM_LIST     3
+
+// Fill and enqueue the next step of a send, receive or transfer. The first
+// step also contains the SPI configuration and the start of transfer, and the
+// chip select is kept active at the end of all steps except the last one,
+// which follows the transfer flags.
+// Returns 1 if this was the last step of the operation.
+static int __pi_spim_chunk_step(pi_spim_t *spim, pi_spim_cs_t *spim_cs, unsigned int *cmd)
 {
-  int irq = rt_irq_disable();
+  unsigned int len = spim->pending_repeat_queued;
+  if (len > __PI_SPIM_CHUNK_BITS)
+    len = __PI_SPIM_CHUNK_BITS;
 
-  pi_spim_t *spim = (pi_spim_t *)arg;
-  pi_spim_cs_t *spim_cs = (pi_spim_cs_t *)spim->pending_repeat_device->data;
-  unsigned int len = spim->pending_repeat_len;
-  int cs_mode = (spim->pending_repeat_flags >> 0) & 0x3;
-  int qspi = (spim->pending_repeat_flags & (0x3 << 2)) == PI_SPI_LINES_QUAD;
-  if (len > 8192*8)
+  int index = 0;
+  if (spim->pending_repeat_queued == spim->pending_repeat_len)
   {
-    len = 8192*8;
+    cmd[index++] = spim_cs->cfg;
+    cmd[index++] = SPI_CMD_SOT(spim_cs->cs);
   }
-  spim->pending_repeat_len -= len;
+
+  spim->pending_repeat_queued -= len;
+
+  int flags = spim->pending_repeat_flags;
+  int qspi = (flags & (0x3 << 2)) == PI_SPI_LINES_QUAD;
+  int cs_keep = spim->pending_repeat_queued || ((flags >> 0) & 0x3) == RT_SPIM_CS_KEEP;
   int size = (len + 7) >> 3;
+  int cfg = UDMA_CHANNEL_CFG_SIZE_32 | UDMA_CHANNEL_CFG_EN;
+  unsigned int rx_base = spim_cs->periph_base + UDMA_CHANNEL_RX_OFFSET;
+  unsigned int tx_base = spim_cs->periph_base + UDMA_CHANNEL_TX_OFFSET;
+  unsigned int cmd_base = spim_cs->periph_base + ARCHI_SPIM_CMD_OFFSET;
+
+  if (spim->pending_repeat_send == __PI_SPIM_SEND)
+  {
+    cmd[index++] = SPI_CMD_TX_DATA(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, qspi, SPI_CMD_MSB_FIRST);
+    plp_udma_enqueue(tx_base, spim->pending_repeat_addr, size, cfg);
+  }
+  else if (spim->pending_repeat_send == __PI_SPIM_RECEIVE)
+  {
+    cmd[index++] = SPI_CMD_RX_DATA(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, qspi, SPI_CMD_MSB_FIRST);
+    plp_udma_enqueue(rx_base, spim->pending_repeat_addr, size, cfg);
+  }
+  else
+  {
+    cmd[index++] = SPI_CMD_FUL(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, SPI_CMD_MSB_FIRST);
+    plp_udma_enqueue(rx_base, spim->pending_repeat_addr, size, cfg);
+    plp_udma_enqueue(tx_base, spim->pending_repeat_dup_addr, size, cfg);
+    spim->pending_repeat_dup_addr += size;
+  }
+
+  cmd[index++] = SPI_CMD_EOT(1, cs_keep);
+
+  spim->pending_repeat_addr += size;
 
-#if 0
-  if (spim->pending_repeat_send == 1)
+  plp_udma_enqueue(cmd_base, (unsigned int)cmd, index*4, cfg);
+
+  return spim->pending_repeat_queued == 0;
+}
+
+// Fill and enqueue the next step of a transaction list. Each transaction
+// takes one step, except when its data phase is longer than a chunk, in which
+// case the following steps only contain the rest of the data and the chip
+// select is kept active between them.
+// Returns 1 if this was the last step of the list.
+static int __pi_spim_list_step(pi_spim_t *spim, pi_spim_cs_t *spim_cs, unsigned int *cmd)
+{
+  pi_spi_transaction_t *transaction = spim->prod_list;
+  unsigned int done = spim->prod_list_done;
+  unsigned int len = transaction->len - done;
+  if (len > __PI_SPIM_CHUNK_BITS)
+    len = __PI_SPIM_CHUNK_BITS;
+
+  int last_chunk = done + len == transaction->len;
+  int flags = transaction->flags;
+  int qspi = (flags & (0x3 << 2)) == PI_SPI_LINES_QUAD;
+  int cs_keep = !last_chunk || ((flags >> 0) & 0x3) == RT_SPIM_CS_KEEP;
+  int addr_bits = transaction->addr_bits;
+  int cfg = UDMA_CHANNEL_CFG_SIZE_32 | UDMA_CHANNEL_CFG_EN;
+  unsigned int cmd_base = spim_cs->periph_base + ARCHI_SPIM_CMD_OFFSET;
+  int index = 0;
+
+  if (done == 0)
   {
-    spim->udma_cmd[0] = SPI_CMD_TX_DATA(len, qspi, spim_cs->byte_align);
+    cmd[index++] = spim_cs->cfg;
+    cmd[index++] = SPI_CMD_SOT(spim_cs->cs);
 
-    plp_udma_enqueue(spim->pending_repeat_base, (unsigned int)spim->udma_cmd, 1*4, UDMA_CHANNEL_CFG_EN);
-    while(plp_udma_busy(spim->pending_repeat_base));
+    if (transaction->cmd_bits)
+      cmd[index++] = SPI_CMD_SEND_CMD(transaction->cmd, transaction->cmd_bits, qspi);
 
-    if (spim->pending_repeat_len == 0 && cs_mode == PI_SPI_CS_AUTO)
+    // The send command is limited to 16 bits, bigger addresses are sent in 2 parts
+    if (addr_bits > 16)
     {
-      plp_udma_enqueue(spim->pending_repeat_base, spim->pending_repeat_addr, size, UDMA_CHANNEL_CFG_EN);
-      spim->udma_cmd[0] = SPI_CMD_EOT(1);
-      plp_udma_enqueue(spim->pending_repeat_base, (unsigned int)spim->udma_cmd, 1*4, UDMA_CHANNEL_CFG_EN);
+      cmd[index++] = SPI_CMD_SEND_CMD(transaction->addr >> 16, addr_bits - 16, qspi);
+      cmd[index++] = SPI_CMD_SEND_CMD(transaction->addr & 0xffff, 16, qspi);
     }
-    else
+    else if (addr_bits)
     {
-      soc_eu_fcEventMask_setEvent(spim_cs->channel + 1);
-      plp_udma_enqueue(spim->pending_repeat_base, spim->pending_repeat_addr, size, UDMA_CHANNEL_CFG_EN);
-      spim->pending_repeat_addr += size;
+      cmd[index++] = SPI_CMD_SEND_CMD(transaction->addr, addr_bits, qspi);
     }
-  }
-  else if (spim->pending_repeat_send == 2)
-  {
-    unsigned int tx_base = hal_udma_channel_base(spim_cs->channel + 1);
-    unsigned int rx_base = hal_udma_channel_base(spim_cs->channel);
 
-    spim->udma_cmd[0] = SPI_CMD_FUL(len, spim_cs->byte_align);
+    if (transaction->dummy_cycles)
+      cmd[index++] = SPI_CMD_DUMMY(transaction->dummy_cycles);
+  }
 
-    plp_udma_enqueue(tx_base, (unsigned int)spim->udma_cmd, 1*4, UDMA_CHANNEL_CFG_EN);
+  if (len)
+  {
+    int size = (len + 7) >> 3;
+    unsigned int data = (unsigned int)transaction->data + (done >> 3);
 
-    if (spim->pending_repeat_len == 0 && cs_mode == PI_SPI_CS_AUTO)
+    if (transaction->receive)
     {
-      plp_udma_enqueue(rx_base, (unsigned int)spim->pending_repeat_addr, size, UDMA_CHANNEL_CFG_EN | (2<<1));
-      plp_udma_enqueue(tx_base, (unsigned int)spim->pending_repeat_dup_addr, size, UDMA_CHANNEL_CFG_EN);
-      while(!plp_udma_canEnqueue(tx_base));
-      spim->udma_cmd[0] = SPI_CMD_EOT(1);
-      plp_udma_enqueue(tx_base, (unsigned int)spim->udma_cmd, 1*4, UDMA_CHANNEL_CFG_EN);
+      cmd[index++] = SPI_CMD_RX_DATA(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, qspi, SPI_CMD_MSB_FIRST);
+      plp_udma_enqueue(spim_cs->periph_base + UDMA_CHANNEL_RX_OFFSET, data, size, cfg);
     }
     else
     {
-      while(plp_udma_busy(tx_base));
-      soc_eu_fcEventMask_setEvent(spim_cs->channel);
-      plp_udma_enqueue(rx_base, (unsigned int)spim->pending_repeat_addr, size, UDMA_CHANNEL_CFG_EN | (2<<1));
-      plp_udma_enqueue(tx_base, (unsigned int)spim->pending_repeat_dup_addr, size, UDMA_CHANNEL_CFG_EN);
-      spim->pending_repeat_addr += size;
-      spim->pending_repeat_dup_addr += size;
+      cmd[index++] = SPI_CMD_TX_DATA(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, qspi, SPI_CMD_MSB_FIRST);
+      plp_udma_enqueue(spim_cs->periph_base + UDMA_CHANNEL_TX_OFFSET, data, size, cfg);
     }
   }
+
+  cmd[index++] = SPI_CMD_EOT(1, cs_keep);
+
+  plp_udma_enqueue(cmd_base, (unsigned int)cmd, index*4, cfg);
+
+  if (last_chunk)
+  {
+    spim->prod_list++;
+    spim->prod_list_nb--;
+    spim->prod_list_done = 0;
+  }
   else
   {
-    int cmd_size = 0;
-    unsigned int tx_base = hal_udma_channel_base(spim_cs->channel + 1);
-    unsigned int rx_base = hal_udma_channel_base(spim_cs->channel);
+    spim->prod_list_done = done + len;
+  }
 
-    spim->udma_cmd[cmd_size++] = SPI_CMD_RX_DATA(len, qspi, spim_cs->byte_align);
+  return spim->prod_list_nb == 0;
+}
 
-    if (spim->pending_repeat_len == 0 && cs_mode == PI_SPI_CS_AUTO)
+// Make the first waiting operation the one being split into steps
+static void __pi_spim_prod_init(pi_spim_t *spim, pi_task_t *task)
+{
+  spim->prod_task = task;
+  spim->pending_repeat_device = (struct pi_device *)task->implem.data[1];
+
+  if (task->implem.data[0] == __PI_SPIM_LIST)
+  {
+    spim->prod_list = (pi_spi_transaction_t *)task->implem.data[2];
+    spim->prod_list_nb = task->implem.data[3];
+    spim->prod_list_done = 0;
+  }
+  else
+  {
+    spim->pending_repeat_send = task->implem.data[0];
+    spim->pending_repeat_addr = task->implem.data[2];
+    spim->pending_repeat_dup_addr = task->implem.data[3];
+    spim->pending_repeat_len = task->implem.data[4];
+    spim->pending_repeat_queued = task->implem.data[4];
+    spim->pending_repeat_flags = task->implem.data[5];
+  }
+}
+
+// Enqueue steps until both uDMA slots are used or there is nothing left to do.
+// The task of an operation is attached to its last step so that it is
+// notified when this step is over.
+static void __pi_spim_refill(pi_spim_t *spim)
+{
+  while (spim->step_count < 2)
+  {
+    pi_task_t *task = spim->prod_task;
+
+    if (task == NULL)
     {
-      spim->udma_cmd[cmd_size++] = SPI_CMD_EOT(1);
+      task = spim->waiting_first;
+      if (task == NULL)
+        return;
+
+      spim->waiting_first = task->implem.next;
+      __pi_spim_prod_init(spim, task);
     }
+
+    pi_spim_cs_t *spim_cs = (pi_spim_cs_t *)spim->pending_repeat_device->data;
+    int slot = (spim->step_head + spim->step_count) & 1;
+    int last;
+
+    if (task->implem.data[0] == __PI_SPIM_LIST)
+      last = __pi_spim_list_step(spim, spim_cs, spim->step_cmd[slot]);
     else
+      last = __pi_spim_chunk_step(spim, spim_cs, spim->step_cmd[slot]);
+
+    if (last)
     {
-      soc_eu_fcEventMask_setEvent(spim_cs->channel);
+      spim->step_task[slot] = task;
+      spim->prod_task = NULL;
+    }
+    else
+    {
+      spim->step_task[slot] = NULL;
     }
 
-    plp_udma_enqueue(rx_base, (unsigned int)spim->pending_repeat_addr, size, UDMA_CHANNEL_CFG_EN | (2<<1));
-    plp_udma_enqueue(tx_base, (unsigned int)spim->udma_cmd, cmd_size*4, UDMA_CHANNEL_CFG_EN);
-
-    spim->pending_repeat_addr += size;
+    spim->step_count++;
   }
-#endif
-
-  rt_irq_restore(irq);
 }
 
-
-void pi_spi_send_async(struct pi_device *device, void *data, size_t len, pi_spi_flags_e flags, pi_task_t *task)
+// Called on the end-of-transfer event of each step
+void __pi_spim_handle_step_end(pi_spim_t *spim)
 {
   int irq = rt_irq_disable();
 
-  __rt_task_init(task);
+  pi_task_t *task = spim->step_task[spim->step_head];
+  spim->step_head ^= 1;
+  spim->step_count--;
 
-  pi_spim_cs_t *spim_cs = (pi_spim_cs_t *)device->data;
-  pi_spim_t *spim = spim_cs->spim;
-  int qspi = (flags & (0x3 << 2)) == PI_SPI_LINES_QUAD;
-  int cs_mode = (flags >> 0) & 0x3;
+  // The next step, if any, is already on-going, enqueue the one after in the
+  // slots which have just been released
+  __pi_spim_refill(spim);
 
-  if (spim->pending_copy)
-  {
-    task->implem.data[0] = 0;
-    task->implem.data[1] = (int)device;
-    task->implem.data[2] = (int)data;
-    task->implem.data[3] = len;
-    task->implem.data[4] = flags;
-
-    if (spim->waiting_first)
-      spim->waiting_last->implem.next = task;
-    else
-      spim->waiting_first = task;
+  if (task)
+    __rt_event_handle_end_of_task(task);
 
-    spim->waiting_last = task;
-    task->implem.next = NULL;
+  rt_irq_restore(irq);
+}
 
-    goto end;
-  }
+static void __pi_spim_enqueue(pi_spim_t *spim, pi_task_t *task)
+{
+  if (spim->waiting_first)
+    spim->waiting_last->implem.next = task;
+  else
+    spim->waiting_first = task;
 
-  unsigned int cmd_base = spim_cs->periph_base + ARCHI_SPIM_CMD_OFFSET;
-  unsigned int channel_base = spim_cs->periph_base + UDMA_CHANNEL_TX_OFFSET;
-  int buffer_size = (len+7)/8;
+  spim->waiting_last = task;
+  task->implem.next = NULL;
 
-  if (len > 8192*8)
-  {
-    spim->pending_repeat_len = len - 8192*8;
-    spim->pending_repeat_addr = (uint32_t)data + 8192;
-    spim->pending_repeat_base = spim_cs->periph_base;
-    spim->pending_repeat_device = device;
-    spim->pending_repeat_send = 1;
-    spim->pending_repeat_flags = flags;
-    len = 8192*8;
-  }
-  
-  spim->pending_copy = task;
+  __pi_spim_refill(spim);
+}
 
-  int size = (len + 7) >> 3;
 
-  // First enqueue the header with SPI config, cs, and send command.
-  // The rest will be sent by the assembly code.
-  // First the user data and finally an epilogue with the EOT command.
+void pi_spi_send_async(struct pi_device *device, void *data, size_t len, pi_spi_flags_e flags, pi_task_t *task)
+{
+  int irq = rt_irq_disable();
 
-  spim->udma_cmd[0] = spim_cs->cfg;
-  spim->udma_cmd[1] = SPI_CMD_SOT(spim_cs->cs);
-  spim->udma_cmd[2] = SPI_CMD_TX_DATA(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, qspi, SPI_CMD_MSB_FIRST);
-  spim->udma_cmd[3] = SPI_CMD_EOT(1, cs_mode == RT_SPIM_CS_KEEP);
+  __rt_task_init(task);
 
-  int cfg = UDMA_CHANNEL_CFG_SIZE_32 | UDMA_CHANNEL_CFG_EN;
-  plp_udma_enqueue(cmd_base, (int)spim->udma_cmd, 4*4, cfg);
-  plp_udma_enqueue(channel_base, (int)data, buffer_size, cfg);
+  pi_spim_cs_t *spim_cs = (pi_spim_cs_t *)device->data;
+
+  task->implem.data[0] = __PI_SPIM_SEND;
+  task->implem.data[1] = (int)device;
+  task->implem.data[2] = (int)data;
+  task->implem.data[4] = len;
+  task->implem.data[5] = flags;
+
+  __pi_spim_enqueue(spim_cs->spim, task);
 
-end:
   rt_irq_restore(irq);
 }
 
@@ -405,57 +500,15 @@ void pi_spi_receive_async(struct pi_device *device, void *data, size_t len, pi_s
   __rt_task_init(task);
 
   pi_spim_cs_t *spim_cs = (pi_spim_cs_t *)device->data;
-  pi_spim_t *spim = spim_cs->spim;
-  int qspi = (flags & (0x3 << 2)) == PI_SPI_LINES_QUAD;
-  int cs_mode = (flags >> 0) & 0x3;
-
-  if (spim->pending_copy)
-  {
-    task->implem.data[0] = 1;
-    task->implem.data[1] = (int)device;
-    task->implem.data[2] = (int)data;
-    task->implem.data[3] = len;
-    task->implem.data[4] = flags;
-
-    if (spim->waiting_first)
-      spim->waiting_last->implem.next = task;
-    else
-      spim->waiting_first = task;
-
-    spim->waiting_last = task;
-    task->implem.next = NULL;
-
-    goto end;
-  }
-
-  spim->pending_copy = task;
-
-  unsigned int rx_base = spim_cs->periph_base + UDMA_CHANNEL_RX_OFFSET;
-  unsigned int cmd_base = spim_cs->periph_base + ARCHI_SPIM_CMD_OFFSET;
 
-  if (len > 8192*8)
-  {
-    spim->pending_repeat_len = len - 8192*8;
-    spim->pending_repeat_addr = (uint32_t)data + 8192;
-    spim->pending_repeat_base = rx_base;
-    spim->pending_repeat_device = device;
-    spim->pending_repeat_send = 0;
-    spim->pending_repeat_flags = flags;
-    len = 8192*8;
-  }
-  
-  int size = (len + 7) >> 3;
+  task->implem.data[0] = __PI_SPIM_RECEIVE;
+  task->implem.data[1] = (int)device;
+  task->implem.data[2] = (int)data;
+  task->implem.data[4] = len;
+  task->implem.data[5] = flags;
 
-  spim->udma_cmd[0] = spim_cs->cfg;
-  spim->udma_cmd[1] = SPI_CMD_SOT(spim_cs->cs);
-  spim->udma_cmd[2] = SPI_CMD_RX_DATA(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, qspi, SPI_CMD_MSB_FIRST);
-  spim->udma_cmd[3] = SPI_CMD_EOT(1, cs_mode == RT_SPIM_CS_KEEP);
+  __pi_spim_enqueue(spim_cs->spim, task);
 
-    int cfg = UDMA_CHANNEL_CFG_SIZE_32 | UDMA_CHANNEL_CFG_EN;
-  plp_udma_enqueue(rx_base, (unsigned int)data, size, cfg);
-  plp_udma_enqueue(cmd_base, (unsigned int)spim->udma_cmd, 4*4, cfg);
-
-end:
   rt_irq_restore(irq);
 }
 
@@ -476,85 +529,58 @@ void pi_spi_transfer_async(struct pi_device *device, void *tx_data, void *rx_dat
   __rt_task_init(task);
 
   pi_spim_cs_t *spim_cs = (pi_spim_cs_t *)device->data;
-  pi_spim_t *spim = spim_cs->spim;
-  int cs_mode = (flags >> 0) & 0x3;
 
-  if (spim->pending_copy)
-  {
-    task->implem.data[0] = 2;
-    task->implem.data[1] = (int)device;
-    task->implem.data[2] = (int)tx_data;
-    task->implem.data[3] = (int)rx_data;
-    task->implem.data[4] = len;
-    task->implem.data[5] = cs_mode;
-
-    if (spim->waiting_first)
-      spim->waiting_last->implem.next = task;
-    else
-      spim->waiting_first = task;
+  task->implem.data[0] = __PI_SPIM_TRANSFER;
+  task->implem.data[1] = (int)device;
+  task->implem.data[2] = (int)rx_data;
+  task->implem.data[3] = (int)tx_data;
+  task->implem.data[4] = len;
+  task->implem.data[5] = (flags >> 0) & 0x3;
 
-    spim->waiting_last = task;
-    task->implem.next = NULL;
+  __pi_spim_enqueue(spim_cs->spim, task);
 
-    goto end;
-  }
+  rt_irq_restore(irq);
+}
 
-  int channel_id = UDMA_CHANNEL_ID(spim_cs->channel);
+void pi_spi_transfer(struct pi_device *device, void *tx_data, void *rx_data, size_t len, pi_spi_flags_e flags)
+{
+  pi_task_t task;
+  pi_spi_transfer_async(device, tx_data, rx_data, len, flags, pi_task_block(&task));
+  pi_task_wait_on(&task);
+}
 
-  unsigned int cmd_base = spim_cs->periph_base + ARCHI_SPIM_CMD_OFFSET;
-  unsigned int rx_base = spim_cs->periph_base + UDMA_CHANNEL_RX_OFFSET;
-  unsigned int tx_base = spim_cs->periph_base + UDMA_CHANNEL_TX_OFFSET;
+void pi_spi_transactions_async(struct pi_device *device, pi_spi_transaction_t *transactions, int nb_transactions, pi_task_t *task)
+{
+  int irq = rt_irq_disable();
 
-  if (len > 8192*8)
+  __rt_task_init(task);
+
+  pi_spim_cs_t *spim_cs = (pi_spim_cs_t *)device->data;
+
+  if (nb_transactions == 0)
   {
-    spim->pending_repeat_len = len - 8192*8;
-    spim->pending_repeat_base = tx_base;
-    spim->pending_repeat_addr = (uint32_t)rx_data + 8192;
-    spim->pending_repeat_dup_addr = (uint32_t)tx_data + 8192;
-    spim->pending_repeat_device = device;
-    spim->pending_repeat_send = 2;
-    spim->pending_repeat_flags = flags;
-    len = 8192*8;
+    __rt_event_handle_end_of_task(task);
+    goto end;
   }
-  
-  spim->pending_copy = task;
 
-  // First enqueue the header with SPI config, cs, and send command.
-  // The rest will be sent by the assembly code.
-  // First the user data and finally an epilogue with the EOT command.
-  spim->udma_cmd[0] = spim_cs->cfg;
-  spim->udma_cmd[1] = SPI_CMD_SOT(spim_cs->cs);
-  spim->udma_cmd[2] = SPI_CMD_FUL(len/32, SPI_CMD_1_WORD_PER_TRANSF, 32, SPI_CMD_MSB_FIRST);
-  spim->udma_cmd[3] = SPI_CMD_EOT(1, cs_mode == RT_SPIM_CS_KEEP);
+  task->implem.data[0] = __PI_SPIM_LIST;
+  task->implem.data[1] = (int)device;
+  task->implem.data[2] = (int)transactions;
+  task->implem.data[3] = nb_transactions;
 
-  int size = (len + 7) >> 3;
-
-  int cfg = UDMA_CHANNEL_CFG_SIZE_32 | UDMA_CHANNEL_CFG_EN;
-  plp_udma_enqueue(cmd_base, (unsigned int)spim->udma_cmd, 4*4, UDMA_CHANNEL_CFG_EN);
-  plp_udma_enqueue(rx_base, (unsigned int)rx_data, size, cfg);
-  plp_udma_enqueue(tx_base, (unsigned int)tx_data, size, cfg);
+  __pi_spim_enqueue(spim_cs->spim, task);
 
 end:
   rt_irq_restore(irq);
 }
 
-void pi_spi_transfer(struct pi_device *device, void *tx_data, void *rx_data, size_t len, pi_spi_flags_e flags)
+void pi_spi_transactions(struct pi_device *device, pi_spi_transaction_t *transactions, int nb_transactions)
 {
   pi_task_t task;
-  pi_spi_transfer_async(device, tx_data, rx_data, len, flags, pi_task_block(&task));
+  pi_spi_transactions_async(device, transactions, nb_transactions, pi_task_block(&task));
   pi_task_wait_on(&task);
 }
 
-void __pi_handle_waiting_copy(pi_task_t *task)
-{
-  if (task->implem.data[0] == 0)
-    pi_spi_send_async((struct pi_device *)task->implem.data[1], (void *)task->implem.data[2], task->implem.data[3], task->implem.data[4], task);
-  else if (task->implem.data[0] == 1)
-    pi_spi_receive_async((struct pi_device *)task->implem.data[1], (void *)task->implem.data[2], task->implem.data[3], task->implem.data[4], task);
-  else
-    pi_spi_transfer_async((struct pi_device *)task->implem.data[1], (void *)task->implem.data[2], (void *)task->implem.data[3], task->implem.data[4], task->implem.data[5], task);
-}
-
 void pi_spi_conf_init(struct pi_spi_conf *conf)
 {
   conf->wordsize = PI_SPI_WORDSIZE_8;
@@ -573,6 +599,9 @@ static void __attribute__((constructor)) __rt_spim_init()
     __rt_spim[i].open_count = 0;
     __rt_spim[i].pending_copy = NULL;
     __rt_spim[i].waiting_first = NULL;
+    __rt_spim[i].prod_task = NULL;
+    __rt_spim[i].step_head = 0;
+    __rt_spim[i].step_count = 0;
     __rt_spim[i].id = i;
     __rt_udma_channel_reg_data(UDMA_EVENT_ID(ARCHI_UDMA_SPIM_ID(0) + i), &__rt_spim[i]);
     __rt_udma_channel_reg_data(UDMA_EVENT_ID(ARCHI_UDMA_SPIM_ID(0) + i)+1, &__rt_spim[i]);
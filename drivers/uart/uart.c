@@ -23,6 +23,10 @@
 
 #define __RT_UART_BAUDRATE 115200
 
+#define __PI_UART_RX_CHECK_COUNT 0
+#define __PI_UART_RX_CHECK_IDLE  1
+#define __PI_UART_RX_CHECK_FLUSH 2
+
 
 
 L2_DATA static pi_uart_t __rt_uart[ARCHI_UDMA_NB_UART];
@@ -162,6 +166,12 @@ int pi_uart_open(struct pi_device *device)
   uart->open_count++;
   uart->baudrate = baudrate;
   uart->channel = channel;
+  uart->tx_first = NULL;
+  uart->tx_coalesce_size = 0;
+  uart->tx_slot_enq = 0;
+  uart->tx_slot_done = 0;
+  uart->tx_nb_inflight = 0;
+  uart->rx_ring_active = 0;
 
   // First activate uart device
   plp_udma_cg_set(plp_udma_cg_get() | (1<<periph_id));
@@ -197,7 +207,18 @@ void pi_uart_close(struct pi_device *device)
 
   uart->open_count--;
 
-  // First wait for pending transfers to finish before stoppping uart in case
+  if (uart->rx_ring_active)
+    pi_uart_rx_ring_stop(device);
+
+  // Let the queued writes go out, their transfers are only given to the uDMA
+  // by the end-of-transfer callbacks, which also still use the staging
+  // buffers
+  while (uart->tx_first || uart->tx_nb_inflight)
+  {
+    __rt_event_execute(NULL, 1);
+  }
+
+  // Then wait for the last bits to be sent before stoppping uart in case
   // some printf are still pending
   __rt_uart_wait_tx_done(uart);
 
@@ -208,6 +229,12 @@ void pi_uart_close(struct pi_device *device)
   // Then stop the uart
   plp_udma_cg_set(plp_udma_cg_get() & ~(1<<uart->channel));
 
+  if (uart->tx_coalesce_size)
+  {
+    pmsis_l2_malloc_free(uart->tx_staging[0], uart->tx_coalesce_size * 2);
+    uart->tx_coalesce_size = 0;
+  }
+
   rt_irq_restore(irq);
 }
 
@@ -248,11 +275,134 @@ int pi_cl_uart_write(pi_device_t *device, void *buffer, uint32_t size, pi_cl_uar
 
 
 
+static void __pi_uart_tx_handle_end(void *arg);
+
+// Give the queued writes to the uDMA, at most one transfer per uDMA slot.
+// When coalescing is enabled, the consecutive small writes are gathered
+// into the staging buffer of the slot so that they go out with a single
+// transfer.
+static void __pi_uart_tx_flush(pi_uart_t *uart)
+{
+  while (uart->tx_nb_inflight < 2 && uart->tx_first)
+  {
+    int slot = uart->tx_slot_enq;
+    pi_task_t *first = uart->tx_first;
+    pi_task_t *last = first;
+    uint32_t buffer = first->implem.data[0];
+    uint32_t size = first->implem.data[1];
+
+    if (uart->tx_coalesce_size && size <= uart->tx_coalesce_size)
+    {
+      uint8_t *staging = uart->tx_staging[slot];
+      pi_task_t *task = first;
+      size = 0;
+
+      while (task && size + task->implem.data[1] <= uart->tx_coalesce_size)
+      {
+        memcpy(&staging[size], (void *)task->implem.data[0], task->implem.data[1]);
+        size += task->implem.data[1];
+        last = task;
+        task = task->implem.next;
+      }
+
+      buffer = (uint32_t)staging;
+    }
+
+    uart->tx_first = last->implem.next;
+    last->implem.next = NULL;
+
+    uart->tx_slot_first[slot] = first;
+    uart->tx_slot_enq ^= 1;
+    uart->tx_nb_inflight++;
+
+    pi_task_t *task = pi_task_callback(&uart->tx_slot_task[slot], __pi_uart_tx_handle_end, (void *)uart);
+    __rt_udma_copy_enqueue(task, uart->channel + 1, &uart->tx_channel, buffer, size, UDMA_CHANNEL_CFG_SIZE_8);
+  }
+}
+
+
+
+static void __pi_uart_tx_handle_end(void *arg)
+{
+  pi_uart_t *uart = (pi_uart_t *)arg;
+
+  int irq = rt_irq_disable();
+
+  int slot = uart->tx_slot_done;
+  uart->tx_slot_done ^= 1;
+  uart->tx_nb_inflight--;
+
+  // Notify all the writes which were sent by this transfer
+  pi_task_t *task = uart->tx_slot_first[slot];
+  while (task)
+  {
+    pi_task_t *next = task->implem.next;
+    __rt_event_enqueue(task);
+    task = next;
+  }
+
+  __pi_uart_tx_flush(uart);
+
+  rt_irq_restore(irq);
+}
+
+
+
+int pi_uart_tx_coalesce_setup(struct pi_device *device, uint32_t size)
+{
+  pi_uart_t *uart = (pi_uart_t *)device->data;
+  uint8_t *staging = NULL;
+
+  if (size)
+  {
+    staging = pmsis_l2_malloc(size * 2);
+    if (staging == NULL)
+      return -1;
+  }
+
+  int irq = rt_irq_disable();
+
+  // The staging buffers may still be used by on-going transfers
+  while (uart->tx_nb_inflight)
+  {
+    __rt_event_execute(NULL, 1);
+  }
+
+  if (uart->tx_coalesce_size)
+    pmsis_l2_malloc_free(uart->tx_staging[0], uart->tx_coalesce_size * 2);
+
+  uart->tx_coalesce_size = size;
+  uart->tx_staging[0] = staging;
+  uart->tx_staging[1] = staging + size;
+
+  rt_irq_restore(irq);
+
+  return 0;
+}
+
+
+
 int pi_uart_write_async(struct pi_device *device, void *buffer, uint32_t size, pi_task_t *task)
 {
+  int irq = rt_irq_disable();
+
   __rt_task_init(task);
   pi_uart_t *uart = (pi_uart_t *)device->data;
-  __rt_udma_copy_enqueue(task, uart->channel + 1, &uart->tx_channel, (uint32_t)buffer, size, UDMA_CHANNEL_CFG_SIZE_8);
+
+  task->implem.data[0] = (uint32_t)buffer;
+  task->implem.data[1] = size;
+  task->implem.next = NULL;
+
+  if (uart->tx_first)
+    uart->tx_last->implem.next = task;
+  else
+    uart->tx_first = task;
+  uart->tx_last = task;
+
+  __pi_uart_tx_flush(uart);
+
+  rt_irq_restore(irq);
+
   return 0;
 }
 
@@ -268,6 +418,306 @@ int pi_uart_read_async(struct pi_device *device, void *buffer, uint32_t size, pi
 
 
 
+void pi_uart_rx_ring_conf_init(struct pi_uart_rx_ring_conf *conf)
+{
+  conf->buffer = NULL;
+  conf->size = 256;
+  conf->nb_chunks = 4;
+  conf->idle_us = 0;
+}
+
+
+
+// Return the total number of bytes received since the ring was started.
+// The uDMA only notifies full chunks, so the bytes of the current chunk are
+// computed from the remaining size of the active transfer. In case a chunk
+// has just finished and is not yet handled, this returns the bytes of the
+// next chunk as if they were in the finished one, which is fine as this
+// can only be less than the actual number.
+static uint32_t __pi_uart_rx_received(pi_uart_t *uart)
+{
+  uint32_t remaining = pulp_read32(hal_udma_channel_base(uart->channel) + UDMA_CHANNEL_SIZE_OFFSET);
+  uint32_t partial = remaining < uart->rx_chunk_size ? uart->rx_chunk_size - remaining : 0;
+  return uart->rx_head + partial;
+}
+
+
+
+static void __pi_uart_rx_copy(pi_uart_t *uart, uint8_t *buffer, uint32_t size)
+{
+  uint32_t index = uart->rx_tail % uart->rx_ring_size;
+  uint32_t iter_size = uart->rx_ring_size - index;
+
+  if (iter_size > size)
+    iter_size = size;
+
+  memcpy(buffer, &uart->rx_ring[index], iter_size);
+  if (size > iter_size)
+    memcpy(&buffer[iter_size], uart->rx_ring, size - iter_size);
+
+  uart->rx_tail += size;
+}
+
+
+
+// Complete the pending reads which can be, either because enough bytes were
+// received, because the line was idle since the last timer check, or because
+// the ring is stopped.
+static void __pi_uart_rx_check(pi_uart_t *uart, int mode)
+{
+  uint32_t received = __pi_uart_rx_received(uart);
+  pi_task_t *task;
+
+  while ((task = uart->rx_waiting_first) != NULL)
+  {
+    uint32_t size = task->implem.data[1];
+    uint32_t available = received - uart->rx_tail;
+
+    if (available < size)
+    {
+      if (mode == __PI_UART_RX_CHECK_COUNT)
+        break;
+
+      if (mode == __PI_UART_RX_CHECK_IDLE && (available == 0 || received != uart->rx_last_received))
+        break;
+
+      size = available;
+    }
+
+    uart->rx_waiting_first = task->implem.next;
+    __pi_uart_rx_copy(uart, (uint8_t *)task->implem.data[0], size);
+    task->implem.data[2] = size;
+    __rt_event_enqueue(task);
+  }
+}
+
+
+
+static void __pi_uart_rx_handle_timer(void *arg);
+
+static void __pi_uart_rx_arm_timer(pi_uart_t *uart)
+{
+  if (!uart->rx_timer_armed && uart->rx_waiting_first)
+  {
+    // The line is considered idle if nothing is received until the timer
+    // expires
+    uart->rx_last_received = __pi_uart_rx_received(uart);
+    uart->rx_timer_armed = 1;
+    rt_event_push_delayed(pi_task_callback(&uart->rx_timer_task, __pi_uart_rx_handle_timer, (void *)uart), uart->rx_idle_us);
+  }
+}
+
+
+
+static void __pi_uart_rx_handle_timer(void *arg)
+{
+  pi_uart_t *uart = (pi_uart_t *)arg;
+
+  int irq = rt_irq_disable();
+
+  uart->rx_timer_armed = 0;
+
+  if (uart->rx_ring_active)
+  {
+    __pi_uart_rx_check(uart, __PI_UART_RX_CHECK_IDLE);
+    __pi_uart_rx_arm_timer(uart);
+  }
+
+  rt_irq_restore(irq);
+}
+
+
+
+static void __pi_uart_rx_handle_chunk(void *arg);
+
+// Enqueue the next chunk of the ring. The UART can not be stalled, so if the
+// application is late, the oldest bytes are dropped to make room for it.
+static void __pi_uart_rx_enqueue(pi_uart_t *uart)
+{
+  uint32_t end = uart->rx_enq + uart->rx_chunk_size;
+
+  if (end - uart->rx_tail > uart->rx_ring_size)
+  {
+    uint32_t tail = end - uart->rx_ring_size;
+    uart->rx_overruns += tail - uart->rx_tail;
+    uart->rx_tail = tail;
+  }
+
+  pi_task_t *task = pi_task_callback(&uart->rx_ring_task[uart->rx_task_enq], __pi_uart_rx_handle_chunk, (void *)uart);
+  uart->rx_task_enq ^= 1;
+
+  __rt_udma_copy_enqueue(task, uart->channel, &uart->rx_channel, (uint32_t)&uart->rx_ring[uart->rx_enq % uart->rx_ring_size], uart->rx_chunk_size, UDMA_CHANNEL_CFG_SIZE_8);
+
+  uart->rx_enq = end;
+}
+
+
+
+static void __pi_uart_rx_handle_chunk(void *arg)
+{
+  pi_uart_t *uart = (pi_uart_t *)arg;
+
+  int irq = rt_irq_disable();
+
+  if (uart->rx_ring_active)
+  {
+    uart->rx_head += uart->rx_chunk_size;
+    __pi_uart_rx_enqueue(uart);
+    __pi_uart_rx_check(uart, __PI_UART_RX_CHECK_COUNT);
+  }
+
+  rt_irq_restore(irq);
+}
+
+
+
+int pi_uart_rx_ring_start(struct pi_device *device, struct pi_uart_rx_ring_conf *conf)
+{
+  pi_uart_t *uart = (pi_uart_t *)device->data;
+
+  // At least one chunk is needed in addition to the 2 enqueued to the uDMA,
+  // otherwise bytes would be overwritten as soon as they are received
+  if (uart->rx_ring_active || conf->nb_chunks < 3 || conf->size % conf->nb_chunks)
+    return -1;
+
+  uint8_t *pool = NULL;
+  uint8_t *ring = (uint8_t *)conf->buffer;
+
+  if (ring == NULL)
+  {
+    pool = pmsis_l2_malloc(conf->size);
+    if (pool == NULL)
+      return -1;
+    ring = pool;
+  }
+
+  int irq = rt_irq_disable();
+
+  uart->rx_ring = ring;
+  uart->rx_pool = pool;
+  uart->rx_ring_size = conf->size;
+  uart->rx_chunk_size = conf->size / conf->nb_chunks;
+  uart->rx_head = 0;
+  uart->rx_tail = 0;
+  uart->rx_enq = 0;
+  uart->rx_overruns = 0;
+  uart->rx_task_enq = 0;
+  uart->rx_waiting_first = NULL;
+
+  // By default, consider the line idle after 2 characters of 10 bits
+  uart->rx_idle_us = conf->idle_us;
+  if (uart->rx_idle_us == 0)
+    uart->rx_idle_us = (20 * 1000000 + uart->baudrate - 1) / uart->baudrate;
+
+  uart->rx_ring_active = 1;
+
+  __pi_uart_rx_enqueue(uart);
+  __pi_uart_rx_enqueue(uart);
+
+  rt_irq_restore(irq);
+
+  return 0;
+}
+
+
+
+void pi_uart_rx_ring_stop(struct pi_device *device)
+{
+  pi_uart_t *uart = (pi_uart_t *)device->data;
+
+  int irq = rt_irq_disable();
+
+  if (uart->rx_ring_active)
+  {
+    __pi_uart_rx_check(uart, __PI_UART_RX_CHECK_FLUSH);
+
+    uart->rx_ring_active = 0;
+
+    // Drop the on-going transfers so that the channel can be used again
+    plp_udma_clr(hal_udma_channel_base(uart->channel));
+    __rt_udma_channel_init(uart->channel, &uart->rx_channel);
+
+    if (uart->rx_pool)
+      pmsis_l2_malloc_free(uart->rx_pool, uart->rx_ring_size);
+  }
+
+  rt_irq_restore(irq);
+}
+
+
+
+uint32_t pi_uart_read_available(struct pi_device *device)
+{
+  pi_uart_t *uart = (pi_uart_t *)device->data;
+
+  if (!uart->rx_ring_active)
+    return 0;
+
+  int irq = rt_irq_disable();
+  uint32_t available = __pi_uart_rx_received(uart) - uart->rx_tail;
+  rt_irq_restore(irq);
+
+  return available;
+}
+
+
+
+uint32_t pi_uart_rx_ring_read(struct pi_device *device, void *buffer, uint32_t size)
+{
+  pi_uart_t *uart = (pi_uart_t *)device->data;
+
+  if (!uart->rx_ring_active)
+    return 0;
+
+  int irq = rt_irq_disable();
+
+  uint32_t available = __pi_uart_rx_received(uart) - uart->rx_tail;
+  if (size > available)
+    size = available;
+
+  __pi_uart_rx_copy(uart, (uint8_t *)buffer, size);
+
+  rt_irq_restore(irq);
+
+  return size;
+}
+
+
+
+void pi_uart_rx_ring_read_async(struct pi_device *device, void *buffer, uint32_t size, pi_task_t *task)
+{
+  pi_uart_t *uart = (pi_uart_t *)device->data;
+
+  int irq = rt_irq_disable();
+
+  __rt_task_init(task);
+
+  task->implem.data[0] = (uint32_t)buffer;
+  task->implem.data[1] = size;
+  task->implem.data[2] = 0;
+  task->implem.next = NULL;
+
+  if (!uart->rx_ring_active)
+  {
+    __rt_event_enqueue(task);
+    goto end;
+  }
+
+  if (uart->rx_waiting_first)
+    uart->rx_waiting_last->implem.next = task;
+  else
+    uart->rx_waiting_first = task;
+  uart->rx_waiting_last = task;
+
+  __pi_uart_rx_check(uart, __PI_UART_RX_CHECK_COUNT);
+  __pi_uart_rx_arm_timer(uart);
+
+end:
+  rt_irq_restore(irq);
+}
+
+
+
 int pi_uart_write(struct pi_device *device, void *buffer, uint32_t size)
 {
   pi_task_t task;
@@ -314,6 +764,8 @@ RT_FC_BOOT_CODE void __attribute__((constructor)) __pi_uart_init()
   for (int i=0; i<ARCHI_UDMA_NB_UART; i++)
   {
     __rt_uart[i].open_count = 0;
+    __rt_uart[i].rx_ring_active = 0;
+    __rt_uart[i].rx_timer_armed = 0;
     __rt_udma_channel_init(UDMA_EVENT_ID(ARCHI_UDMA_UART_ID(i))+1, &__rt_uart[i].tx_channel);
     __rt_udma_channel_init(UDMA_EVENT_ID(ARCHI_UDMA_UART_ID(i)), &__rt_uart[i].rx_channel);
   }
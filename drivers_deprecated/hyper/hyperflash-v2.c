@@ -49,21 +49,6 @@ void __rt_hyperflash_set_reg(rt_hyperflash_t *dev, unsigned int addr, unsigned s
   rt_event_wait(event);
 }
 
-static void __rt_hyperflash_set_reg_noshift(rt_hyperflash_t *dev, unsigned int addr, unsigned short value)
-{
-  rt_event_t *event = rt_event_get_blocking(NULL);
-  __rt_hyperflash_set_reg_buffer[0] = value;
-  rt_hyperflash_copy(dev, UDMA_CHANNEL_ID(dev->channel) + 1, __rt_hyperflash_set_reg_buffer, (void *)(addr), 2, event);
-  rt_event_wait(event);
-}
-
-static unsigned int __rt_hyperflash_get_status_reg(rt_hyperflash_t *dev)
-{
-  __rt_hyperflash_set_reg(dev, 0x555, 0x70);
-  __rt_hyperflash_read((rt_flash_t *)dev, __rt_hyperflash_set_reg_buffer, 0, 4, NULL);
-  return __rt_hyperflash_set_reg_buffer[0];
-}
-
 static void __rt_hyperflash_free(rt_hyperflash_t *hyper)
 {
   if (hyper != NULL) {
@@ -98,6 +83,8 @@ static rt_flash_t *__rt_hyperflash_open(rt_dev_t *dev, rt_flash_conf_t *conf, rt
   if (pi_hyper_open(&hyper->device))
     return NULL;
 
+  hyper->pending_first = NULL;
+
   // HyperFlash
 #if !defined(ARCHI_UDMA_HYPER_VERSION) || ARCHI_UDMA_HYPER_VERSION == 1
   hal_hyper_udma_dt1_set(0);
@@ -133,80 +120,198 @@ static void __rt_hyperflash_read(rt_flash_t *_dev, void *data, void *addr, size_
   rt_irq_restore(irq);
 }
 
-// TODO this only works if event is NULL. This should be implemented with a state
-// machine as for hyperram accesses
-static void __rt_hyperflash_program(rt_flash_t *_dev, void *data, void *addr, size_t size, rt_event_t *event)
+#define __RT_HYPERFLASH_PROGRAM      0
+#define __RT_HYPERFLASH_ERASE_SECTOR 1
+#define __RT_HYPERFLASH_ERASE_CHIP   2
+
+// Steps of the program and erase state machine
+#define __RT_HYPERFLASH_STEP_COMMAND 0
+#define __RT_HYPERFLASH_STEP_POLL    1
+#define __RT_HYPERFLASH_STEP_STATUS  2
+
+// Delay between 2 reads of the status register while the flash is busy
+#define __RT_HYPERFLASH_PROGRAM_POLL_US 100
+#define __RT_HYPERFLASH_ERASE_POLL_US   1000
+
+// Values of the register writes of the command sequences. They are all
+// enqueued at the same time, each one needs its own buffer.
+#define __RT_HYPERFLASH_CMD_AA 0
+#define __RT_HYPERFLASH_CMD_55 1
+#define __RT_HYPERFLASH_CMD_A0 2
+#define __RT_HYPERFLASH_CMD_80 3
+#define __RT_HYPERFLASH_CMD_30 4
+#define __RT_HYPERFLASH_CMD_10 5
+#define __RT_HYPERFLASH_CMD_70 6
+
+RT_L2_DATA static unsigned short __rt_hyperflash_cmd_buffer[] = { 0xAA, 0x55, 0xA0, 0x80, 0x30, 0x10, 0x70 };
+RT_L2_DATA static unsigned short __rt_hyperflash_status_buffer[2];
+
+static void __rt_hyperflash_handle_step(void *arg);
+
+// Enqueue a register write without waiting for it, the next access is only
+// handled by the device once this one is done
+static void __rt_hyperflash_set_reg_async(rt_hyperflash_t *dev, unsigned int addr, int value, int index)
 {
-  rt_hyperflash_t *dev = (rt_hyperflash_t *)_dev;
+  rt_event_t *event = pi_task_block(&dev->cmd_event[index]);
+  rt_hyperflash_copy(dev, UDMA_CHANNEL_ID(dev->channel) + 1, &__rt_hyperflash_cmd_buffer[value], (void *)addr, 2, event);
+}
 
-  unsigned int hyper_addr = (unsigned int)addr;
-  unsigned int buffer = (unsigned int)data;
+static rt_event_t *__rt_hyperflash_step_event(rt_hyperflash_t *dev, int step)
+{
+  dev->pending_step = step;
+  return pi_task_callback(&dev->step_event, __rt_hyperflash_handle_step, (void *)dev);
+}
 
-  while (size > 0)
-  {
-    // Hyperflash burst can go up to 512 bytes and should not cross a 512 bytes
-    // boundary
-    unsigned int iter_size = 512 - (hyper_addr & 0x1ff);
-    if (iter_size > size)
-      iter_size = size;
+// Start reading the status register, the state machine is called back
+// once the value is available
+static void __rt_hyperflash_read_status(rt_hyperflash_t *dev)
+{
+  __rt_hyperflash_set_reg_async(dev, 0x555<<1, __RT_HYPERFLASH_CMD_70, 0);
+  rt_hyperflash_copy(dev, 0, __rt_hyperflash_status_buffer, 0, 4, __rt_hyperflash_step_event(dev, __RT_HYPERFLASH_STEP_STATUS));
+}
 
-    __rt_hyperflash_set_reg(dev, 0x555, 0xAA);
-    __rt_hyperflash_set_reg(dev, 0x2AA, 0x55);
-    __rt_hyperflash_set_reg(dev, 0x555, 0xA0);
+// Enqueue the command sequence for programming the next burst of the
+// on-going program operation
+static void __rt_hyperflash_program_burst(rt_hyperflash_t *dev)
+{
+  unsigned int hyper_addr = dev->pending_hyper_addr;
 
-    int irq = rt_irq_disable();
+  // Hyperflash burst can go up to 512 bytes and should not cross a 512 bytes
+  // boundary
+  unsigned int iter_size = 512 - (hyper_addr & 0x1ff);
+  if (iter_size > dev->pending_size)
+    iter_size = dev->pending_size;
 
-    rt_event_t *call_event = __rt_wait_event_prepare(event);
+  __rt_hyperflash_set_reg_async(dev, 0x555<<1, __RT_HYPERFLASH_CMD_AA, 0);
+  __rt_hyperflash_set_reg_async(dev, 0x2AA<<1, __RT_HYPERFLASH_CMD_55, 1);
+  __rt_hyperflash_set_reg_async(dev, 0x555<<1, __RT_HYPERFLASH_CMD_A0, 2);
 
-    rt_hyperflash_copy(dev, 1, (void *)buffer, (void *)hyper_addr, iter_size, call_event);
+  rt_hyperflash_copy(dev, 1, (void *)dev->pending_buffer, (void *)hyper_addr, iter_size, __rt_hyperflash_step_event(dev, __RT_HYPERFLASH_STEP_COMMAND));
 
-  __rt_wait_event_check(event, call_event);
+  dev->pending_size -= iter_size;
+  dev->pending_hyper_addr += iter_size;
+  dev->pending_buffer += iter_size;
+}
 
-    rt_irq_restore(irq);
+static void __rt_hyperflash_erase_cmd(rt_hyperflash_t *dev, unsigned int addr, int last_value)
+{
+  __rt_hyperflash_set_reg_async(dev, 0x555<<1, __RT_HYPERFLASH_CMD_AA, 0);
+  __rt_hyperflash_set_reg_async(dev, 0x2AA<<1, __RT_HYPERFLASH_CMD_55, 1);
+  __rt_hyperflash_set_reg_async(dev, 0x555<<1, __RT_HYPERFLASH_CMD_80, 2);
+  __rt_hyperflash_set_reg_async(dev, 0x555<<1, __RT_HYPERFLASH_CMD_AA, 3);
+  __rt_hyperflash_set_reg_async(dev, 0x2AA<<1, __RT_HYPERFLASH_CMD_55, 4);
 
-    while(((__rt_hyperflash_get_status_reg(dev) >> 7) & 1) == 0)
-    {
-      rt_time_wait_us(100);
-    }
+  rt_hyperflash_copy(dev, UDMA_CHANNEL_ID(dev->channel) + 1, &__rt_hyperflash_cmd_buffer[last_value], (void *)addr, 2, __rt_hyperflash_step_event(dev, __RT_HYPERFLASH_STEP_COMMAND));
+}
 
-    size -= iter_size;
-    hyper_addr += iter_size;
-    buffer += iter_size;
+// Start the first operation of the queue
+static void __rt_hyperflash_start(rt_hyperflash_t *dev)
+{
+  rt_event_t *event = dev->pending_first;
+
+  if (event->implem.data[0] == __RT_HYPERFLASH_PROGRAM)
+  {
+    dev->pending_hyper_addr = event->implem.data[1];
+    dev->pending_buffer = event->implem.data[2];
+    dev->pending_size = event->implem.data[3];
+    __rt_hyperflash_program_burst(dev);
+  }
+  else if (event->implem.data[0] == __RT_HYPERFLASH_ERASE_SECTOR)
+  {
+    __rt_hyperflash_erase_cmd(dev, event->implem.data[1], __RT_HYPERFLASH_CMD_30);
+  }
+  else
+  {
+    __rt_hyperflash_erase_cmd(dev, 0x555<<1, __RT_HYPERFLASH_CMD_10);
   }
 }
 
-static void __rt_hyperflash_erase_chip(rt_flash_t *_dev, rt_event_t *event)
+// Called each time a step of the on-going operation is done. Instead of
+// keeping the core busy while the flash is programming or erasing, the status
+// register is polled from delayed events so that the core is free to do
+// something else in the meantime.
+static void __rt_hyperflash_handle_step(void *arg)
 {
-  rt_hyperflash_t *dev = (rt_hyperflash_t *)_dev;
-
-  __rt_hyperflash_set_reg(dev, 0x555, 0xAA);
-  __rt_hyperflash_set_reg(dev, 0x2AA, 0x55);
-  __rt_hyperflash_set_reg(dev, 0x555, 0x80);
-  __rt_hyperflash_set_reg(dev, 0x555, 0xAA);
-  __rt_hyperflash_set_reg(dev, 0x2AA, 0x55);
-  __rt_hyperflash_set_reg(dev, 0x555, 0x10);
+  rt_hyperflash_t *dev = (rt_hyperflash_t *)arg;
+  rt_event_t *event = dev->pending_first;
+  int irq = rt_irq_disable();
 
-  while(((__rt_hyperflash_get_status_reg(dev) >> 7) & 1) == 0)
+  switch (dev->pending_step)
   {
-    rt_time_wait_us(1000);
+    case __RT_HYPERFLASH_STEP_COMMAND:
+    case __RT_HYPERFLASH_STEP_POLL:
+      __rt_hyperflash_read_status(dev);
+      break;
+
+    case __RT_HYPERFLASH_STEP_STATUS:
+      if (((__rt_hyperflash_status_buffer[0] >> 7) & 1) == 0)
+      {
+        int delay = event->implem.data[0] == __RT_HYPERFLASH_PROGRAM ?
+          __RT_HYPERFLASH_PROGRAM_POLL_US : __RT_HYPERFLASH_ERASE_POLL_US;
+        rt_event_push_delayed(__rt_hyperflash_step_event(dev, __RT_HYPERFLASH_STEP_POLL), delay);
+      }
+      else if (event->implem.data[0] == __RT_HYPERFLASH_PROGRAM && dev->pending_size)
+      {
+        __rt_hyperflash_program_burst(dev);
+      }
+      else
+      {
+        dev->pending_first = event->implem.next;
+        __rt_event_enqueue(event);
+
+        if (dev->pending_first)
+          __rt_hyperflash_start(dev);
+      }
+      break;
   }
+
+  rt_irq_restore(irq);
 }
 
-static void __rt_hyperflash_erase_sector(rt_flash_t *_dev, void *data, rt_event_t *event)
+// Queue a program or erase operation, which is started immediately if the
+// device is idle or after the ones already queued otherwise
+static void __rt_hyperflash_enqueue(rt_hyperflash_t *dev, int op, unsigned int addr, unsigned int buffer, unsigned int size, rt_event_t *event)
 {
-  rt_hyperflash_t *dev = (rt_hyperflash_t *)_dev;
+  int irq = rt_irq_disable();
+
+  rt_event_t *call_event = __rt_wait_event_prepare(event);
 
-  __rt_hyperflash_set_reg(dev, 0x555, 0xAA);
-  __rt_hyperflash_set_reg(dev, 0x2AA, 0x55);
-  __rt_hyperflash_set_reg(dev, 0x555, 0x80);
-  __rt_hyperflash_set_reg(dev, 0x555, 0xAA);
-  __rt_hyperflash_set_reg(dev, 0x2AA, 0x55);
-  __rt_hyperflash_set_reg_noshift(dev, (int)data, 0x30);
+  call_event->implem.data[0] = op;
+  call_event->implem.data[1] = addr;
+  call_event->implem.data[2] = buffer;
+  call_event->implem.data[3] = size;
+  call_event->implem.next = NULL;
 
-  while(((__rt_hyperflash_get_status_reg(dev) >> 7) & 1) == 0)
+  if (dev->pending_first)
   {
-    rt_time_wait_us(1000);
+    dev->pending_last->implem.next = call_event;
+    dev->pending_last = call_event;
   }
+  else
+  {
+    dev->pending_first = call_event;
+    dev->pending_last = call_event;
+    __rt_hyperflash_start(dev);
+  }
+
+  __rt_wait_event_check(event, call_event);
+
+  rt_irq_restore(irq);
+}
+
+static void __rt_hyperflash_program(rt_flash_t *_dev, void *data, void *addr, size_t size, rt_event_t *event)
+{
+  __rt_hyperflash_enqueue((rt_hyperflash_t *)_dev, __RT_HYPERFLASH_PROGRAM, (unsigned int)addr, (unsigned int)data, size, event);
+}
+
+static void __rt_hyperflash_erase_chip(rt_flash_t *_dev, rt_event_t *event)
+{
+  __rt_hyperflash_enqueue((rt_hyperflash_t *)_dev, __RT_HYPERFLASH_ERASE_CHIP, 0, 0, 0, event);
+}
+
+static void __rt_hyperflash_erase_sector(rt_flash_t *_dev, void *data, rt_event_t *event)
+{
+  __rt_hyperflash_enqueue((rt_hyperflash_t *)_dev, __RT_HYPERFLASH_ERASE_SECTOR, (unsigned int)data, 0, 0, event);
 }
 
 static void __rt_hyperflash_erase(rt_flash_t *_dev, void *data, int size, rt_event_t *event)
@@ -37,6 +37,10 @@
 #include "rt/rt_api.h"
 
 
+#define FS_PREFETCH_EMPTY   0
+#define FS_PREFETCH_PENDING 1
+#define FS_PREFETCH_VALID   2
+
 
 // Called by global rt_error_str to display fs errors
 //
@@ -80,6 +84,7 @@ static inline void __rt_fs_error(int error)
 void rt_fs_conf_init(rt_fs_conf_t *conf)
 {
   conf->type = RT_FS_READ_ONLY;
+  conf->prefetch_size = FS_PREFETCH_SIZE;
   rt_flash_conf_init(&conf->flash_conf);
 }
 
@@ -92,6 +97,7 @@ static void __rt_fs_free(rt_fs_t *fs)
     if (fs->flash) rt_flash_close(fs->flash, NULL);
     if (fs->fs_l2) rt_free(RT_ALLOC_PERIPH, fs->fs_l2, sizeof(rt_fs_l2_t));
     if (fs->cache) rt_free(RT_ALLOC_PERIPH, fs->cache, FS_READ_THRESHOLD_BLOCK_FULL);
+    if (fs->prefetch) rt_free(RT_ALLOC_PERIPH, fs->prefetch, fs->prefetch_size);
   }
 }
 
@@ -177,6 +183,10 @@ void rt_fs_unmount(rt_fs_t *fs, rt_event_t *event)
 {
   int irq = rt_irq_disable();
 
+  // The prefetch buffer may still be written by the flash
+  while (fs->prefetch_state == FS_PREFETCH_PENDING)
+    __rt_event_execute(NULL, 1);
+
   __rt_fs_free(fs);
   if (event) __rt_event_enqueue(event);
 
@@ -203,11 +213,18 @@ rt_fs_t *rt_fs_mount(const char *dev_name, rt_fs_conf_t *conf, rt_event_t *event
   fs->cache = NULL;
   fs->flash = NULL;
   fs->fs_info = NULL;
+  fs->prefetch = NULL;
 
   if (conf)
+  {
     memcpy((void *)&fs->flash_conf, (void *)&conf->flash_conf, sizeof(conf->flash_conf));
+    fs->prefetch_size = (conf->prefetch_size + 7) & ~7;
+  }
   else
+  {
     rt_flash_conf_init(&fs->flash_conf);
+    fs->prefetch_size = FS_PREFETCH_SIZE;
+  }
 
   fs->fs_l2 = rt_alloc(RT_ALLOC_PERIPH, sizeof(rt_fs_l2_t));
   if (fs->fs_l2 == NULL) goto error;
@@ -215,6 +232,17 @@ rt_fs_t *rt_fs_mount(const char *dev_name, rt_fs_conf_t *conf, rt_event_t *event
   fs->cache = rt_alloc(RT_ALLOC_PERIPH, FS_READ_THRESHOLD_BLOCK_FULL);
   if (fs->cache == NULL) goto error;
 
+  if (fs->prefetch_size)
+  {
+    fs->prefetch = rt_alloc(RT_ALLOC_PERIPH, fs->prefetch_size);
+    if (fs->prefetch == NULL) goto error;
+  }
+
+  fs->prefetch_state = FS_PREFETCH_EMPTY;
+  fs->prefetch_waiters = NULL;
+  // Nothing is in the cache yet
+  fs->cache_addr = -1;
+
   fs->mount_step = 0;
   fs->dev_name = dev_name;
   fs->fs_info = NULL;
@@ -274,6 +302,7 @@ rt_file_t *rt_fs_open(rt_fs_t *fs, const char *file_name, int flags, rt_event_t
   file->size = desc->size;
   file->addr = desc->addr;
   file->fs = fs;
+  file->last_addr = desc->addr;
 
   return file;
 
@@ -372,6 +401,118 @@ int __rt_fs_read(rt_file_t *file, unsigned int buffer, unsigned int addr, int si
   return block_size;
 }
 
+// Called when the flash read of the prefetch window is done
+static void __rt_fs_prefetch_end(void *arg)
+{
+  rt_fs_t *fs = (rt_fs_t *)arg;
+
+  fs->prefetch_state = FS_PREFETCH_VALID;
+
+  // Resume the reads which were waiting for the window
+  rt_file_t *waiter = fs->prefetch_waiters;
+  fs->prefetch_waiters = NULL;
+  while (waiter)
+  {
+    rt_file_t *next = waiter->prefetch_next;
+    rt_event_enqueue(waiter->step_event);
+    waiter = next;
+  }
+}
+
+// Starts reading the window which follows the end of the last read of a
+// sequential reader, so that the flash access is overlapped with whatever
+// the reader is doing until its next read.
+static void __rt_fs_prefetch(rt_file_t *file)
+{
+  rt_fs_t *fs = file->fs;
+  unsigned int addr = file->last_addr & ~0x7;
+  unsigned int end = (file->addr + file->size + 7) & ~0x7;
+
+  // The next bytes may already be in the cache, e.g. after a small read,
+  // in which case the window starts after the cached block
+  if (addr >= fs->cache_addr && addr < fs->cache_addr + FS_READ_THRESHOLD_BLOCK_FULL)
+    addr = fs->cache_addr + FS_READ_THRESHOLD_BLOCK_FULL;
+
+  if (!fs->prefetch_size || fs->prefetch_state == FS_PREFETCH_PENDING || addr >= end)
+    return;
+
+  // Nothing to do if the current window already covers it
+  if (fs->prefetch_state == FS_PREFETCH_VALID && addr >= fs->prefetch_addr &&
+    addr < fs->prefetch_addr + fs->prefetch_len)
+    return;
+
+  unsigned int size = fs->prefetch_size;
+  if (size > end - addr) size = end - addr;
+
+  rt_trace(RT_TRACE_FS, "[FS] Prefetching block (addr: 0x%x, size: 0x%x)\n", addr, size);
+
+  fs->prefetch_addr = addr;
+  fs->prefetch_len = size;
+  fs->prefetch_state = FS_PREFETCH_PENDING;
+
+  rt_event_t *event = __rt_init_event(&fs->prefetch_event, rt_event_internal_sched(), __rt_fs_prefetch_end, (void *)fs);
+  // Mark it as pending event so that it is not added to the list of free events
+  // as it stands inside the file-system
+  __rt_event_set_pending(event);
+
+  __rt_fs_read_block(fs, addr, (unsigned int)fs->prefetch, size, event);
+}
+
+// Reads the beginning of a block if it is already in the cache, with no
+// alignment constraint. Returns -1 if the read does not start inside the
+// cache, otherwise the number of bytes copied.
+static int __rt_fs_read_cache_hit(rt_file_t *file, unsigned int buffer, unsigned int addr, unsigned int size)
+{
+  rt_fs_t *fs = file->fs;
+
+  if (addr < fs->cache_addr || addr >= fs->cache_addr + FS_READ_THRESHOLD_BLOCK_FULL)
+    return -1;
+
+  if (size > fs->cache_addr + FS_READ_THRESHOLD_BLOCK_FULL - addr)
+    size = fs->cache_addr + FS_READ_THRESHOLD_BLOCK_FULL - addr;
+
+  return __rt_fs_read_from_cache(file, buffer, addr, size);
+}
+
+// Reads a block from the prefetch window, with no alignment constraint.
+// Returns -1 if the read does not start inside the window, otherwise the
+// number of bytes copied, which can be 0 if the window is still being read,
+// in which case the read is resumed once it is done.
+static int __rt_fs_read_prefetched(rt_file_t *file, unsigned int buffer, unsigned int addr, unsigned int size, int *pending, rt_event_t *event)
+{
+  rt_fs_t *fs = file->fs;
+
+  if (fs->prefetch_state == FS_PREFETCH_EMPTY || addr < fs->prefetch_addr ||
+    addr >= fs->prefetch_addr + fs->prefetch_len)
+    return -1;
+
+  if (fs->prefetch_state == FS_PREFETCH_PENDING)
+  {
+    if (event)
+    {
+      // Several reads, e.g. of different files, can wait for the same window
+      file->prefetch_next = fs->prefetch_waiters;
+      fs->prefetch_waiters = file;
+      *pending = 1;
+      return 0;
+    }
+
+    int irq = rt_irq_disable();
+    while (*(volatile int *)&fs->prefetch_state == FS_PREFETCH_PENDING)
+      __rt_event_execute(NULL, 1);
+    rt_irq_restore(irq);
+  }
+
+  rt_trace(RT_TRACE_FS, "[FS] Read from prefetch window (buffer: 0x%x, addr: 0x%x, size: 0x%x)\n", buffer, addr, size);
+
+  unsigned int offset = addr - fs->prefetch_addr;
+  if (size > fs->prefetch_len - offset) size = fs->prefetch_len - offset;
+
+  memcpy((void *)buffer, &fs->prefetch[offset], size);
+
+  return size;
+}
+
 int rt_fs_seek(rt_file_t *file, unsigned int offset)
 {
   rt_trace(RT_TRACE_FS, "[FS] File seek (file: %p, offset: 0x%x)\n", file, offset);
@@ -399,11 +540,28 @@ static void __rt_fs_try_read(void *arg)
 
   while (file->pending_size) {
 
-    int size = __rt_fs_read(
-      file, file->pending_buffer, file->pending_addr, file->pending_size, &pending,
-      event
+    // The cache is checked first as it may hold the next bytes while the
+    // window after them is still being read
+    int size = __rt_fs_read_cache_hit(
+      file, file->pending_buffer, file->pending_addr, file->pending_size
     );
 
+    if (size < 0)
+    {
+      size = __rt_fs_read_prefetched(
+        file, file->pending_buffer, file->pending_addr, file->pending_size, &pending,
+        event
+      );
+    }
+
+    if (size < 0)
+    {
+      size = __rt_fs_read(
+        file, file->pending_buffer, file->pending_addr, file->pending_size, &pending,
+        event
+      );
+    }
+
     file->pending_addr += size;
     file->pending_buffer += size;
     file->pending_size -= size;
@@ -411,6 +569,9 @@ static void __rt_fs_try_read(void *arg)
     if (pending && event) return;
   }
 
+  file->last_addr = file->pending_addr;
+  if (file->sequential) __rt_fs_prefetch(file);
+
   // In case there was a user event specified, enqueue it now that all
   // steps are done to notify the user
   if (file->step_event) {
@@ -454,6 +615,10 @@ int rt_fs_read(rt_file_t *file, void *buffer, size_t size, rt_event_t *event)
   file->pending_size = real_size;
   file->pending_addr = file->addr + file->offset;
 
+  // Only readers continuing where their last read stopped get a prefetch
+  // window, to not waste flash bandwidth on random accesses
+  file->sequential = file->pending_addr == file->last_addr;
+
   file->offset += real_size;
 
   __rt_fs_try_read((void *)file);
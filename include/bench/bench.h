@@ -128,6 +128,15 @@ void run_benchmark(testcase_t *test, testresult_t *result);
  */
 int run_suite(testcase_t *tests);
 
+/**
+ * @brief Runs the same balanced and unbalanced loops with the static, dynamic
+ * and guided OpenMP schedules and prints their execution time.
+ * This must be called by the master core of a cluster, outside of any
+ * parallel region, and is only available when OpenMP is enabled.
+ * @return the number of errors.
+ */
+int bench_omp_schedules(void);
+
 /**
  * @brief Checks if actual == expected and if not, prints fail_msg and
  * increases the error counter in the testresult struct.
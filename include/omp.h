@@ -24,6 +24,11 @@ typedef unsigned int omp_lock_t;
 
 int omp_get_thread_num(void);
 
+// Runtime profiling, only active when the OpenMP library is compiled with
+// CONFIG_OMP_STATS=1
+void omp_reset_stats(void);
+void omp_dump_stats(void);
+
 typedef int               kmp_int32;
 typedef void (*kmpc_micro)              ( kmp_int32 * global_tid, kmp_int32 * bound_tid, void *args);
 
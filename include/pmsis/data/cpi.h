@@ -19,11 +19,54 @@
 
 #include "pmsis/data/udma.h"
 
+typedef struct rt_cpi_frame_s {
+  struct rt_cpi_frame_s *next;
+  void *buffer;
+  void *cpi;
+  uint8_t held;
+  pi_task_t release_task;
+} rt_cpi_frame_t;
+
+typedef struct pi_cpi_ingest_s {
+  rt_cpi_frame_t **ring;
+  volatile uint32_t produced;
+  uint32_t fetched;
+  uint32_t consumed;
+  uint32_t nb_frames;
+  uint32_t nb_slices;
+  uint32_t slice_size;
+  int cid;
+} pi_cpi_ingest_t;
+
 typedef struct {
   int channel_id;
   int open_count;
   uint32_t base;
   rt_udma_channel_t channel;
+  uint8_t streaming;
+  uint8_t stalled;
+  uint8_t nb_frames;
+  uint8_t nb_slices;
+  uint8_t enq_slice;
+  uint8_t nb_inflight;
+  uint8_t task_enq;
+  uint8_t task_done;
+  uint32_t slice_size;
+  rt_cpi_frame_t *frames;
+  void *pool;
+  rt_cpi_frame_t *free_first;
+  rt_cpi_frame_t *free_last;
+  rt_cpi_frame_t *ready_first;
+  rt_cpi_frame_t *ready_last;
+  rt_cpi_frame_t *enq_frame;
+  pi_task_t *waiting_first;
+  pi_task_t *waiting_last;
+  pi_task_t stream_task[2];
+  void (*slice_callback)(void *arg, void *frame, int slice);
+  void *slice_arg;
+  uint32_t dropped;
+  uint32_t pending_dropped;
+  pi_cpi_ingest_t *ingest;
 } rt_cpi_t;
 
 #endif
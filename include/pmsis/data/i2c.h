@@ -17,8 +17,15 @@
 #ifndef __RT_DATA_I2C_H__
 #define __RT_DATA_I2C_H__
 
+#define PI_I2C_SEQ_CMD_SIZE 40
+
 #ifndef LANGUAGE_ASSEMBLY
 
+typedef struct {
+  uint16_t addr;
+  uint8_t value;
+} pi_i2c_reg_t;
+
 typedef struct {
   pi_task_t *pending_copy;
   pi_task_t *waiting_first;
@@ -35,6 +42,12 @@ typedef struct {
   char cs;
   unsigned int  max_baudrate;
   unsigned int  div;
+  unsigned char udma_seq_cmd[2][PI_I2C_SEQ_CMD_SIZE];
+  pi_i2c_reg_t *batch_regs;
+  int batch_remaining;
+  unsigned char batch_addr_size;
+  unsigned char batch_index;
+  unsigned char batch_inflight;
 } pi_i2c_t;
 
 #endif
@@ -21,6 +21,13 @@
 
 #include "pmsis/task.h"
 
+typedef struct pos_i2s_block_s {
+    struct pos_i2s_block_s *next;
+    void *buffer;
+    uint32_t timestamp;
+    uint8_t held;
+} pos_i2s_block_t;
+
 typedef struct {
     uint8_t reenqueue;
     uint8_t clk;
@@ -34,6 +41,20 @@ typedef struct {
     pi_task_t *waiting_last;
     int i2s_freq;
     uint32_t udma_cfg;
+    uint8_t nb_blocks;
+    uint8_t explicit_release;
+    uint8_t nb_dma_blocks;
+    pos_i2s_block_t *blocks;
+    void *pool;
+    pos_i2s_block_t *free_first;
+    pos_i2s_block_t *free_last;
+    pos_i2s_block_t *dma_first;
+    pos_i2s_block_t *dma_last;
+    pos_i2s_block_t *ready_first;
+    pos_i2s_block_t *ready_last;
+    pos_i2s_block_t *held;
+    uint32_t overruns;
+    uint32_t pending_overruns;
 } pos_i2s_t;
 
 #endif
@@ -21,6 +21,18 @@
 
 #include "pmsis/task.h"
 
+typedef struct pi_spi_transaction_s {
+  uint32_t cmd;               // Command sent first, up to 16 bits
+  uint32_t addr;              // Address sent after the command, up to 32 bits
+  void *data;                 // Buffer of the data phase
+  uint32_t len;               // Number of bits of the data phase, 0 for no data phase
+  uint32_t flags;             // Lines and chip select mode (pi_spi_flags_e)
+  uint8_t cmd_bits;           // Number of bits of the command, 0 for no command
+  uint8_t addr_bits;          // Number of bits of the address, 0 for no address
+  uint8_t dummy_cycles;       // Number of dummy cycles between the address and the data phase
+  uint8_t receive;            // 1 if the data phase is receiving data, 0 if it is sending it
+} pi_spi_transaction_t;
+
 typedef struct {
   pi_task_t *pending_copy;
   pi_task_t *waiting_first;
@@ -38,6 +50,15 @@ typedef struct {
   unsigned int pending_repeat_flags;
   uint32_t buffer;
   struct pi_device *pending_repeat_device;
+  unsigned int pending_repeat_queued;
+  pi_task_t *step_task[2];
+  unsigned int step_head;
+  unsigned int step_count;
+  unsigned int step_cmd[2][8];
+  pi_task_t *prod_task;
+  pi_spi_transaction_t *prod_list;
+  unsigned int prod_list_nb;
+  unsigned int prod_list_done;
 } pi_spim_t;
 
 #endif
@@ -24,6 +24,32 @@ typedef struct pi_uart_s {
   int active;
   rt_udma_channel_t rx_channel;
   rt_udma_channel_t tx_channel;
+  pi_task_t *tx_first;
+  pi_task_t *tx_last;
+  pi_task_t *tx_slot_first[2];
+  pi_task_t tx_slot_task[2];
+  uint8_t *tx_staging[2];
+  uint32_t tx_coalesce_size;
+  unsigned char tx_slot_enq;
+  unsigned char tx_slot_done;
+  unsigned char tx_nb_inflight;
+  unsigned char rx_ring_active;
+  unsigned char rx_task_enq;
+  unsigned char rx_timer_armed;
+  uint8_t *rx_ring;
+  uint8_t *rx_pool;
+  uint32_t rx_ring_size;
+  uint32_t rx_chunk_size;
+  uint32_t rx_head;
+  uint32_t rx_tail;
+  uint32_t rx_enq;
+  uint32_t rx_last_received;
+  uint32_t rx_overruns;
+  uint32_t rx_idle_us;
+  pi_task_t *rx_waiting_first;
+  pi_task_t *rx_waiting_last;
+  pi_task_t rx_ring_task[2];
+  pi_task_t rx_timer_task;
 } pi_uart_t;
 
 #endif
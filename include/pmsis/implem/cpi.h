@@ -104,6 +104,147 @@ static inline void pi_cpi_set_slice(struct pi_device *device, uint32_t x, uint32
   }
 }
 
+/** \brief CPI streaming configuration structure.
+ *
+ * This structure is used to capture frames continuously into a ring of
+ * frame buffers, without having to re-arm the capture for every frame.
+ */
+struct pi_cpi_stream_conf
+{
+  void **buffers;         /*!< Array of nb_buffers frame buffers, or NULL to allocate them in L2. */
+  int nb_buffers;         /*!< Number of frame buffers of the ring, at least 2. */
+  int32_t frame_size;     /*!< Size in bytes of a frame. */
+  int nb_slices;          /*!< Number of slices each frame is captured in, the frame size must be a multiple of it. */
+  void (*slice_callback)(void *arg, void *frame, int slice); /*!< If not NULL, called each time a slice of a frame is captured, e.g. to let the cluster start processing the top of the frame. */
+  void *slice_arg;        /*!< Argument given to the slice callback. */
+};
+
+/** \brief Initialize a CPI streaming configuration with default values.
+ *
+ * \param conf A pointer to the streaming configuration.
+ */
+void pi_cpi_stream_conf_init(struct pi_cpi_stream_conf *conf);
+
+/** \brief Start capturing frames continuously.
+ *
+ * Frame buffers are captured in a loop. Captured frames are retrieved with
+ * pi_cpi_stream_read_async and must be given back with
+ * pi_cpi_stream_release. When no buffer is available because the application
+ * is late, the oldest captured frame which has not been read yet is
+ * overwritten and counted as dropped. If the application holds all the
+ * buffers, the interface is stopped until one is released.
+ * This also enables the interface, the other capture functions must not be
+ * used until the stream is stopped.
+ *
+ * \param device The device structure of the CPI interface.
+ * \param conf   The streaming configuration.
+ * \return       0 if it succeeded or -1 if it failed.
+ */
+int pi_cpi_stream_start(struct pi_device *device, struct pi_cpi_stream_conf *conf);
+
+/** \brief Stop capturing frames continuously.
+ *
+ * This also disables the interface and frees the buffers allocated by the
+ * runtime. Pending reads are completed with a NULL frame.
+ *
+ * \param device The device structure of the CPI interface.
+ */
+void pi_cpi_stream_stop(struct pi_device *device);
+
+/** \brief Get the next captured frame.
+ *
+ * The task is notified as soon as a frame is available, and
+ * pi_cpi_stream_read_status can then be used to get it.
+ *
+ * \param device The device structure of the CPI interface.
+ * \param task   The task used to notify the end of the read.
+ */
+void pi_cpi_stream_read_async(struct pi_device *device, pi_task_t *task);
+
+/** \brief Get the result of a read.
+ *
+ * \param task  The task used for the read.
+ * \param frame A pointer where the frame buffer is returned, or NULL if the stream was stopped.
+ * \return      The number of frames dropped since the previous read.
+ */
+static inline int pi_cpi_stream_read_status(pi_task_t *task, void **frame)
+{
+  if (frame)
+    *frame = (void *)task->implem.data[1];
+  return task->implem.data[0];
+}
+
+/** \brief Give a frame back to the stream once it has been processed.
+ *
+ * \param device The device structure of the CPI interface.
+ * \param frame  The frame buffer returned by the read.
+ * \return       0 if it succeeded or -1 if the frame is not currently held by the application, e.g. if it was already released.
+ */
+int pi_cpi_stream_release(struct pi_device *device, void *frame);
+
+/** \brief Return the total number of frames dropped since the stream was started.
+ *
+ * \param device The device structure of the CPI interface.
+ * \return       The number of dropped frames.
+ */
+static inline uint32_t pi_cpi_stream_dropped(struct pi_device *device)
+{
+  return ((rt_cpi_t *)device->data)->dropped;
+}
+
+#if defined(ARCHI_HAS_CLUSTER)
+
+/** \brief Start capturing frames continuously and forward them to the cluster stripe by stripe.
+ *
+ * This is the same as pi_cpi_stream_start, except that the frames are not
+ * returned by pi_cpi_stream_read_async. Instead, each slice of a frame,
+ * called a stripe here, is made available to the cluster as soon as it is
+ * captured to L2, so that the cluster can copy it to L1 and start working
+ * on it one stripe period after the sensor sent it instead of one frame
+ * period. A frame is given back to the stream automatically once all its
+ * stripes have been released by the cluster.
+ * Stripes are retrieved by a single cluster core with
+ * pi_cl_cpi_ingest_get. The cluster is kept active whatever its idle policy
+ * until the stream is stopped. A stripe, i.e. the frame size divided by the
+ * number of slices, must not exceed 65535 bytes.
+ *
+ * \param device The device structure of the CPI interface.
+ * \param conf   The streaming configuration, the slice callback is ignored.
+ * \param ingest The ingestion structure, which must be kept allocated in a memory visible to the cluster until the stream is stopped.
+ * \param cid    The cluster which will retrieve the stripes.
+ * \return       0 if it succeeded or -1 if it failed.
+ */
+int pi_cpi_ingest_start(struct pi_device *device, struct pi_cpi_stream_conf *conf, pi_cpi_ingest_t *ingest, int cid);
+
+/** \brief Wait for the next stripe and copy it to L1.
+ *
+ * This blocks the calling core until the next stripe is captured and then
+ * enqueues a cluster DMA copy of it to the specified L1 buffer. The copy
+ * must be waited with pi_cl_dma_wait and the stripe must then be released
+ * with pi_cl_cpi_ingest_release. Several stripes can be retrieved before
+ * the first is released, e.g. to copy the next stripe to another L1 buffer
+ * while the current one is processed.
+ * This can only be called from a cluster.
+ *
+ * \param ingest    The ingestion structure given when the stream was started.
+ * \param l1_buffer The L1 buffer where the stripe is copied.
+ * \param copy      The DMA copy structure used for the copy.
+ * \return          The index of the stripe within its frame.
+ */
+int pi_cl_cpi_ingest_get(pi_cpi_ingest_t *ingest, void *l1_buffer, pi_cl_dma_copy_t *copy);
+
+/** \brief Release the oldest stripe retrieved with pi_cl_cpi_ingest_get.
+ *
+ * This must be called once the copy of the stripe to L1 is over, so that its
+ * L2 buffer can be used for capturing the next frames.
+ * This can only be called from a cluster.
+ *
+ * \param ingest The ingestion structure given when the stream was started.
+ */
+void pi_cl_cpi_ingest_release(pi_cpi_ingest_t *ingest);
+
+#endif
+
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018 ETH Zurich, University of Bologna and GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PMSIS_IMPLEM_I2C_H__
+#define __PMSIS_IMPLEM_I2C_H__
+
+#include "pmsis/drivers/i2c.h"
+#include "pmsis/data/i2c.h"
+
+/** Maximum number of bytes which can be written by pi_i2c_write_read. */
+#define PI_I2C_WRITE_READ_MAX_TX (PI_I2C_SEQ_CMD_SIZE - 17)
+
+/** \brief Write bytes and then read bytes in a single I2C transaction.
+ *
+ * This generates a start, writes the bytes, generates a repeated start,
+ * reads the bytes and finally generates a stop. This is typically used to
+ * read registers, where the register address is written first.
+ * The whole transaction is executed by the uDMA from a single command
+ * sequence and the task is notified once all the bytes have been read.
+ * If tx_size or rx_size is out of range, nothing is transferred and the task
+ * is notified immediately.
+ *
+ * \param device    The device structure of the I2C interface.
+ * \param tx_buffer The bytes to be written.
+ * \param rx_buffer The buffer where the read bytes are stored.
+ * \param tx_size   The number of bytes to be written, from 1 to PI_I2C_WRITE_READ_MAX_TX.
+ * \param rx_size   The number of bytes to be read, from 1 to 256.
+ * \param task      The task used to notify the end of the transaction.
+ */
+void pi_i2c_write_read_async(struct pi_device *device, void *tx_buffer, void *rx_buffer, uint32_t tx_size, uint32_t rx_size, pi_task_t *task);
+
+/** \brief Write bytes and then read bytes in a single I2C transaction and wait for it.
+ *
+ * Same as pi_i2c_write_read_async but blocks until the transaction is done.
+ *
+ * \param device    The device structure of the I2C interface.
+ * \param tx_buffer The bytes to be written.
+ * \param rx_buffer The buffer where the read bytes are stored.
+ * \param tx_size   The number of bytes to be written, from 1 to PI_I2C_WRITE_READ_MAX_TX.
+ * \param rx_size   The number of bytes to be read, from 1 to 256.
+ * \return          0 if the transaction was done or -1 if a size is out of range.
+ */
+int pi_i2c_write_read(struct pi_device *device, void *tx_buffer, void *rx_buffer, uint32_t tx_size, uint32_t rx_size);
+
+/** \brief Write a table of registers.
+ *
+ * Each register is written with its own I2C transaction, made of the
+ * register address, on 1 or 2 bytes with the most significant byte first,
+ * followed by the value. This is typically used for sensor initialization
+ * tables. The transactions are packed into uDMA command sequences executed
+ * back-to-back, so that only a few interrupts are needed for the whole
+ * table.
+ *
+ * \param device    The device structure of the I2C interface.
+ * \param regs      The registers to be written, which must be kept alive until the task is finished.
+ * \param nb_regs   The number of registers.
+ * \param addr_size The size in bytes of the register addresses, 1 or 2.
+ * \param task      The task used to notify the end of the last write.
+ */
+void pi_i2c_write_regs_async(struct pi_device *device, pi_i2c_reg_t *regs, int nb_regs, int addr_size, pi_task_t *task);
+
+/** \brief Write a table of registers and wait for it.
+ *
+ * Same as pi_i2c_write_regs_async but blocks until all the registers are written.
+ *
+ * \param device    The device structure of the I2C interface.
+ * \param regs      The registers to be written.
+ * \param nb_regs   The number of registers.
+ * \param addr_size The size in bytes of the register addresses, 1 or 2.
+ */
+void pi_i2c_write_regs(struct pi_device *device, pi_i2c_reg_t *regs, int nb_regs, int addr_size);
+
+#endif
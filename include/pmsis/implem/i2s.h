@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2018 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PMSIS_IMPLEM_I2S_H__
+#define __PMSIS_IMPLEM_I2S_H__
+
+#include "pmsis/drivers/i2s.h"
+#include "pmsis/data/i2s.h"
+
+/** \brief I2S ring configuration structure.
+ *
+ * This structure is used to replace the ping-pong buffers of an I2S
+ * interface by a ring of N buffers, so that the consumer can be late by
+ * several blocks before samples are lost.
+ */
+struct pi_i2s_ring_conf
+{
+    void **buffers;        /*!< Array of nb_buffers buffers of block_size bytes, or NULL to allocate them in L2. */
+    int nb_buffers;        /*!< Number of buffers of the ring, at least 3. */
+    int explicit_release;  /*!< If 0, a block is given back to the ring by the next read. Otherwise it is owned by the application until it calls pi_i2s_ring_release, which allows keeping several blocks, e.g. while the cluster processes them. */
+};
+
+/** \brief Initialize an I2S ring configuration with default values.
+ *
+ * \param conf A pointer to the I2S ring configuration.
+ */
+void pi_i2s_ring_conf_init(struct pi_i2s_ring_conf *conf);
+
+/** \brief Switch an I2S interface to ring mode.
+ *
+ * This must be called after the interface is opened and while it is
+ * stopped. Blocks are then returned by the read functions in capture order.
+ * When all buffers are full and the consumer is late, the oldest block not
+ * yet read is overwritten, and the number of lost blocks is returned by
+ * pi_i2s_read_status for the next read.
+ *
+ * \param device The device structure of the I2S interface.
+ * \param conf   The ring configuration.
+ * \return       0 if it succeeded or -1 if it failed, e.g. because the interface is started.
+ */
+int pi_i2s_ring_setup(struct pi_device *device, struct pi_i2s_ring_conf *conf);
+
+/** \brief Give a block back to the ring.
+ *
+ * This is only needed in explicit release mode, once the application does
+ * not need the content of a block returned by a read anymore.
+ *
+ * \param device    The device structure of the I2S interface.
+ * \param mem_block The block returned by the read.
+ * \return          0 if it succeeded or -1 if the block is not currently held by the application, e.g. if it was already released.
+ */
+int pi_i2s_ring_release(struct pi_device *device, void *mem_block);
+
+/** \brief Return the total number of blocks lost since the interface was started.
+ *
+ * \param device The device structure of the I2S interface.
+ * \return       The number of overwritten blocks.
+ */
+static inline uint32_t pi_i2s_ring_overruns(struct pi_device *device)
+{
+    return ((pos_i2s_t *)device->data)->overruns;
+}
+
+/** \brief Return the time in microseconds when the block of a finished read was filled.
+ *
+ * This is only available in ring mode.
+ *
+ * \param task The task used for the read.
+ * \return     The FC timer value in microseconds.
+ */
+static inline uint32_t pi_i2s_read_timestamp(pi_task_t *task)
+{
+    return task->implem.data[3];
+}
+
+#endif
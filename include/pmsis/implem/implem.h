@@ -24,6 +24,13 @@
 #include "pmsis/implem/perf.h"
 #include "pmsis/implem/cpi.h"
 #include "pmsis/implem/uart.h"
+#include "pmsis/implem/i2c.h"
+#ifdef ARCHI_UDMA_HAS_SPIM
+#include "pmsis/implem/spi.h"
+#endif
+#ifdef ARCHI_UDMA_HAS_I2S
+#include "pmsis/implem/i2s.h"
+#endif
 #ifdef MCHAN_VERSION
 #include "pmsis/implem/dma.h"
 #endif
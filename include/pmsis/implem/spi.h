@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 ETH Zurich, University of Bologna and GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PMSIS_IMPLEM_SPI_H__
+#define __PMSIS_IMPLEM_SPI_H__
+
+#include "pmsis/drivers/spi.h"
+#include "pmsis/data/spi.h"
+
+/** \brief Execute a list of SPI transactions.
+ *
+ * Each transaction is made of an optional command, an optional address, optional dummy cycles and an optional
+ * data phase, and starts with its own chip select assertion. This is typically used for flash or display
+ * devices, where each access is a command followed by an address and data.
+ * The transactions are enqueued to the uDMA ahead of time so that they are executed back-to-back.
+ * Data phases longer than 8192 bytes are split into several uDMA transfers with the chip select kept active.
+ *
+ * \param device          The device.
+ * \param transactions    The array of transactions, which must be kept alive until the task is finished.
+ * \param nb_transactions The number of transactions.
+ * \param task            The task used to notify the end of the last transaction.
+ */
+void pi_spi_transactions_async(struct pi_device *device, pi_spi_transaction_t *transactions, int nb_transactions, pi_task_t *task);
+
+/** \brief Execute a list of SPI transactions and wait for them.
+ *
+ * Same as pi_spi_transactions_async but blocks until all the transactions are done.
+ *
+ * \param device          The device.
+ * \param transactions    The array of transactions.
+ * \param nb_transactions The number of transactions.
+ */
+void pi_spi_transactions(struct pi_device *device, pi_spi_transaction_t *transactions, int nb_transactions);
+
+#endif
@@ -20,6 +20,114 @@
 #include "pmsis/drivers/uart.h"
 #include "pmsis/data/data.h"
 
+/** \brief UART receive ring configuration structure.
+ *
+ * This structure is used to receive continuously into a circular buffer,
+ * so that data whose size is not known in advance can be received without
+ * enqueueing a read for each of them.
+ */
+struct pi_uart_rx_ring_conf
+{
+  void *buffer;       /*!< Ring buffer of size bytes, or NULL to allocate it in L2. */
+  uint32_t size;      /*!< Size in bytes of the ring, must be a multiple of nb_chunks. */
+  int nb_chunks;      /*!< Number of uDMA transfers the ring is divided into, at least 3. */
+  uint32_t idle_us;   /*!< Time in microseconds without any received byte after which a pending read is completed with the bytes already received, or 0 to use the duration of 2 characters. */
+};
+
+/** \brief Initialize a UART receive ring configuration with default values.
+ *
+ * \param conf A pointer to the UART receive ring configuration.
+ */
+void pi_uart_rx_ring_conf_init(struct pi_uart_rx_ring_conf *conf);
+
+/** \brief Start receiving continuously into a ring.
+ *
+ * Once started, the bytes received by the UART are continuously stored into
+ * the ring and can be retrieved with pi_uart_rx_ring_read or
+ * pi_uart_rx_ring_read_async. pi_uart_read can not be used until the ring
+ * is stopped.
+ * When the application is late and the ring is full, the oldest bytes are
+ * overwritten and counted by pi_uart_rx_ring_overruns.
+ *
+ * \param device The device structure of the UART interface.
+ * \param conf   The ring configuration.
+ * \return       0 if it succeeded or -1 if it failed.
+ */
+int pi_uart_rx_ring_start(struct pi_device *device, struct pi_uart_rx_ring_conf *conf);
+
+/** \brief Stop receiving into the ring.
+ *
+ * Pending reads are completed with the bytes already received.
+ *
+ * \param device The device structure of the UART interface.
+ */
+void pi_uart_rx_ring_stop(struct pi_device *device);
+
+/** \brief Return the number of received bytes which can be read from the ring.
+ *
+ * \param device The device structure of the UART interface.
+ * \return       The number of bytes.
+ */
+uint32_t pi_uart_read_available(struct pi_device *device);
+
+/** \brief Read bytes from the ring without waiting.
+ *
+ * \param device The device structure of the UART interface.
+ * \param buffer The buffer where the bytes are copied.
+ * \param size   The maximum number of bytes to be read.
+ * \return       The number of bytes actually read.
+ */
+uint32_t pi_uart_rx_ring_read(struct pi_device *device, void *buffer, uint32_t size);
+
+/** \brief Read bytes from the ring asynchronously.
+ *
+ * The task is notified as soon as size bytes have been received, or when
+ * at least one byte has been received and the line then stayed idle for the
+ * configured time. This allows receiving frames of variable length with a
+ * single read. The number of bytes actually read can then be retrieved with
+ * pi_uart_rx_ring_read_status.
+ *
+ * \param device The device structure of the UART interface.
+ * \param buffer The buffer where the bytes are copied.
+ * \param size   The maximum number of bytes to be read.
+ * \param task   The task used to notify the end of the read.
+ */
+void pi_uart_rx_ring_read_async(struct pi_device *device, void *buffer, uint32_t size, pi_task_t *task);
+
+/** \brief Return the number of bytes read by a finished ring read.
+ *
+ * \param task The task used for the read.
+ * \return     The number of bytes.
+ */
+static inline uint32_t pi_uart_rx_ring_read_status(pi_task_t *task)
+{
+  return task->implem.data[2];
+}
+
+/** \brief Return the total number of bytes lost since the ring was started.
+ *
+ * \param device The device structure of the UART interface.
+ * \return       The number of overwritten bytes.
+ */
+static inline uint32_t pi_uart_rx_ring_overruns(struct pi_device *device)
+{
+  return ((pi_uart_t *)device->data)->rx_overruns;
+}
+
+/** \brief Coalesce small writes into bigger uDMA transfers.
+ *
+ * Writes are always queued by the driver and at most 2 uDMA transfers are
+ * active at the same time. Once this is enabled, the consecutive writes
+ * of at most size bytes which are queued while the uDMA is busy are copied
+ * together into a staging buffer and sent with a single transfer, instead
+ * of one transfer and one interrupt per write.
+ *
+ * \param device The device structure of the UART interface.
+ * \param size   The size in bytes of each of the 2 staging buffers, or 0 to disable coalescing.
+ * \return       0 if it succeeded or -1 if it failed.
+ */
+int pi_uart_tx_coalesce_setup(struct pi_device *device, uint32_t size);
+
 struct pi_cl_uart_req_s {
   pi_device_t *device;
   void *buffer;
@@ -98,6 +98,90 @@ void rt_cluster_mount(int mount, int cid, int flags, rt_event_t *event);
 int rt_cluster_call(rt_cluster_call_t *call, int cid, void (*entry)(void *arg), void *arg, void *stacks, int master_stack_size, int slave_stack_size, int nb_pe, rt_event_t *event);
 
 
+/** \brief Open a cluster asynchronously.
+ *
+ * This starts the cluster power-up sequence and returns immediately. The specified task is pushed once the cluster is ready.
+ * While the cluster is being mounted, tasks can already be sent with pi_cluster_send_task_to_cl_async. They are kept
+ * on fabric controller side and are automatically pushed to the cluster as soon as it is ready, so that the
+ * power-up latency can be overlapped with the preparation of the first offload.
+ * Note that stacks of queued tasks are allocated only when the mount is done. If the allocation fails at this point,
+ * a warning is reported and the task is terminated without being executed.
+ *
+ * \param device      The cluster device, opened from a pi_cluster_conf structure.
+ * \param async_task  The task to be pushed when the cluster is ready.
+ * \return            0 if the power-up sequence was started, -1 otherwise.
+ */
+int pi_cluster_open_async(struct pi_device *device, pi_task_t *async_task);
+
+
+
+/** \brief Register data to be preloaded to L1 each time the cluster is mounted.
+ *
+ * The data are copied by the fabric controller during the mount sequence, as soon as the cluster memory is
+ * accessible, and before any queued task is started. The registration is kept for all the following mounts,
+ * which is useful for duty-cycled applications powering the cluster up for each computation.
+ * This must be called before the cluster is opened.
+ *
+ * \param device   The cluster device, configured from a pi_cluster_conf structure.
+ * \param preload  The structure for the preload. It must be kept allocated until pi_cluster_preload_clear is called.
+ * \param ext      Address in L2 where the data are.
+ * \param loc      Address in L1 where the data must be copied. This is usually a static variable declared with PI_L1 as the L1 allocator is not yet available. Both cluster-local and global L1 addresses are accepted, the data are copied to the L1 of this cluster.
+ * \param size     Size in bytes of the data.
+ */
+void pi_cluster_preload(struct pi_device *device, pi_cluster_preload_t *preload, void *ext, void *loc, int size);
+
+
+
+/** \brief Unregister all L1 preloads of a cluster.
+ *
+ * \param device   The cluster device.
+ */
+void pi_cluster_preload_clear(struct pi_device *device);
+
+
+
+/** \enum pi_cluster_idle_mode_e
+ * \brief Action taken when the cluster is idle.
+ */
+typedef enum {
+  PI_CLUSTER_IDLE_NONE       = 0,  /*!< The cluster is kept active until it is closed. */
+  PI_CLUSTER_IDLE_CLOCK_GATE = 1,  /*!< The cluster FLL is stopped while the cluster stays powered. L1 content, including the allocator state and stacks, is retained. This is only supported when the cluster runs on its own FLL. */
+  PI_CLUSTER_IDLE_POWER_DOWN = 2,  /*!< The cluster is powered down and L1 content is lost. Waking it up goes through the full mount sequence, including L1 preloads. */
+} pi_cluster_idle_mode_e;
+
+
+
+/** \brief Configure the automatic idle policy of a cluster.
+ *
+ * Once enabled, the cluster is switched off as specified by the mode when no task has been sent for the specified amount
+ * of time and the cluster has finished all its tasks. It is then transparently switched on again when the next
+ * task is sent with pi_cluster_send_task_to_cl or pi_cluster_send_task_to_cl_async.
+ * The idle detection is based on a runtime timer, so the cluster is actually switched off between one and two timeouts
+ * after its last task has finished.
+ * Note that with PI_CLUSTER_IDLE_POWER_DOWN, the application must not keep any data in L1 between tasks, except
+ * the ones registered with pi_cluster_preload.
+ *
+ * \param device      The cluster device, which must be opened.
+ * \param mode        The idle mode. PI_CLUSTER_IDLE_NONE disables the policy.
+ * \param timeout_us  The time in microseconds after which an idle cluster is switched off.
+ * \return            0 if the policy was applied, -1 if the mode is not supported on this chip or with the current cluster clock configuration.
+ */
+int pi_cluster_idle_policy(struct pi_device *device, pi_cluster_idle_mode_e mode, int timeout_us);
+
+
+
+/** \brief Get the statistics of the idle policy.
+ *
+ * This gives the number of times the cluster was switched off and on by the idle policy and the latency
+ * added by the wake-up to the tasks which triggered it.
+ *
+ * \param device  The cluster device.
+ * \param stats   The structure where the statistics are copied.
+ */
+void pi_cluster_idle_stats_get(struct pi_device *device, pi_cluster_idle_stats_t *stats);
+
+
+
 /** \brief Can be used to trigger a notification to all cluster cores */
 #define RT_TRIGGER_ALL_CORE 0
 
@@ -255,6 +339,14 @@ static inline void rt_cluster_notif_wait(int event)
 
 extern rt_fc_cluster_data_t __rt_fc_cluster_data[];
 
+void __rt_cluster_push_pending_tasks(rt_fc_cluster_data_t *data);
+
+void __rt_cluster_idle_activity(rt_fc_cluster_data_t *data);
+
+// Keep the cluster active whatever its idle policy, e.g. while a driver feeds
+// it without sending cluster tasks. Calls must be balanced.
+void __rt_cluster_idle_busy(rt_fc_cluster_data_t *data, int busy);
+
 #endif
 
 
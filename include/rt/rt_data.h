@@ -103,6 +103,9 @@ typedef void (*rt_error_callback_t)(void *arg, rt_event_t *event, int error, voi
 #define RT_DMA_EVENT 5
 #define RT_USER_EVENT 6
 
+// This event is used by the software team barrier to wake-up cores
+#define RT_BARRIER_EVENT 7
+
 #if defined(EU_VERSION) && (EU_VERSION == 1)
 #define RT_FORK_EVT 0
 #endif
@@ -112,6 +115,12 @@ typedef void (*rt_error_callback_t)(void *arg, rt_event_t *event, int error, voi
 #include <stddef.h>
 #include "archi/pulp.h"
 
+// The team barrier is implemented in software when there is no HW barrier.
+// It can also be forced with CONFIG_SW_TEAM_BARRIER.
+#if defined(ARCHI_HAS_NO_BARRIER) && !defined(__RT_SW_TEAM_BARRIER)
+#define __RT_SW_TEAM_BARRIER 1
+#endif
+
 #define RT_L1_GLOBAL_DATA __attribute__((section(".data_l1")))
 
 #define RT_L1_BSS __attribute__((section(".bss_l1")))
@@ -398,6 +407,20 @@ typedef struct
   struct pi_cluster_task *last_call_fc;
 } rt_cluster_call_pool_t;
 
+typedef struct pi_cluster_preload_s {
+  void *ext;
+  void *loc;
+  int size;
+  struct pi_cluster_preload_s *next;
+} pi_cluster_preload_t;
+
+typedef struct pi_cluster_idle_stats_s {
+  uint32_t nb_sleep;
+  uint32_t nb_wakeup;
+  uint32_t wakeup_total_us;
+  uint32_t wakeup_max_us;
+} pi_cluster_idle_stats_t;
+
 typedef struct cluster_data_t {
   int mount_count;
   rt_event_t *events;
@@ -409,6 +432,14 @@ typedef struct cluster_data_t {
   int state;
   int cid;
   rt_event_t *mount_event;
+  rt_event_t mount_step_event;
+  // Tasks sent while the cluster is still being mounted. They are kept on
+  // FC side as the cluster pool is not yet accessible and are pushed to the
+  // cluster as soon as the mount is done.
+  struct pi_cluster_task *first_pending_task;
+  struct pi_cluster_task *last_pending_task;
+  pi_cluster_preload_t *first_preload;
+  int mount_pending;
 } rt_fc_cluster_data_t;
 
 typedef struct {
@@ -456,6 +487,14 @@ typedef struct rt_hyperflash_s {
   rt_flash_t header;
   int channel;
   struct pi_device device;
+  rt_event_t *pending_first;
+  rt_event_t *pending_last;
+  int pending_step;
+  unsigned int pending_hyper_addr;
+  unsigned int pending_buffer;
+  unsigned int pending_size;
+  rt_event_t step_event;
+  rt_event_t cmd_event[5];
 } rt_hyperflash_t;
 
 // BEWARE, assembly offsets must be updated below if this structure is modified
@@ -478,16 +517,162 @@ typedef struct rt_dma_copy_s {
   int id;
 } rt_dma_copy_t;
 
+typedef struct rt_dma_cb_s {
+  rt_dma_copy_t copy;
+  void (*callback)(void *);
+  void *arg;
+  struct rt_dma_cb_s *next;
+} rt_dma_cb_t;
+
+typedef struct rt_dma_desc_s {
+  unsigned int ext;
+  unsigned int loc;
+  unsigned int cmd;
+  unsigned int cmd_last;
+  uint32_t nb_chunks;
+  uint32_t chunk_size;
+  uint32_t chunk_ext_inc;
+  uint32_t stride;
+  uint32_t length;
+  uint32_t nb_tiles;
+  uint32_t tile_ext_stride;
+  uint32_t tile_loc_stride;
+  struct rt_dma_desc_s *next;
+} rt_dma_desc_t;
+
+typedef struct rt_dma_tile_s {
+  void *in;
+  void *out;
+  uint32_t row;
+  uint32_t col;
+  uint32_t height;
+  uint32_t width;
+  uint32_t index;
+} rt_dma_tile_t;
+
+typedef struct rt_dma_tiler_conf_s {
+  unsigned int in;
+  unsigned int out;
+  uint32_t height;
+  uint32_t width;
+  uint32_t stride;
+  uint32_t elem_size;
+  uint32_t tile_height;
+  uint32_t tile_width;
+  uint32_t l1_budget;
+  int nb_buffers;
+  int nb_cores;
+  void (*compute)(rt_dma_tile_t *tile, void *arg);
+  void *arg;
+} rt_dma_tiler_conf_t;
+
+typedef struct rt_dma_tiler_stats_s {
+  uint32_t nb_tiles;
+  uint32_t tile_height;
+  uint32_t tile_width;
+  int nb_buffers;
+  uint32_t total_cycles;
+  uint32_t compute_cycles;
+  uint32_t dma_wait_cycles;
+} rt_dma_tiler_stats_t;
+
+typedef struct pi_cl_team_loop_s {
+  int start;
+  int end;
+  int chunk;
+  void (*fn)(int start, int end, void *arg);
+  void *arg;
+  unsigned int flags;
+  int next;
+} pi_cl_team_loop_t;
+
 typedef struct {
   unsigned int cluster_mask;
 } rt_iclock_t;
 
+typedef struct rt_iclock_cl_s rt_iclock_cl_t;
+
+// Lock state shared by all clusters, it is located in the memory of the
+// first cluster and is only accessed under the TAS lock
 typedef struct {
   unsigned int tas;
-  unsigned int addr;
-  unsigned int cluster_mask;
+  unsigned int locked;
+  unsigned int head;
+  unsigned int tail;
+  unsigned int nb_slots;
+  rt_iclock_cl_t *queue[];
+} rt_iclock_glob_t;
+
+typedef struct rt_iclock_cl_s {
+  rt_iclock_glob_t *glob;
+  volatile unsigned int granted;
+  unsigned int cid;
 } rt_iclock_cl_t;
 
+typedef struct {
+  unsigned int cluster_mask;
+} rt_icbarrier_t;
+
+typedef struct rt_icbarrier_cl_s rt_icbarrier_cl_t;
+
+typedef union {
+  int i;
+  float f;
+} rt_icbarrier_value_t;
+
+typedef struct {
+  unsigned int tas;
+  unsigned int nb_clusters;
+  unsigned int count;
+  rt_icbarrier_value_t value;
+  rt_icbarrier_cl_t *clusters[];
+} rt_icbarrier_glob_t;
+
+typedef struct rt_icbarrier_cl_s {
+  rt_icbarrier_glob_t *glob;
+  unsigned int sense;
+  volatile unsigned int release;
+  unsigned int cid;
+  rt_icbarrier_value_t value;
+} rt_icbarrier_cl_t;
+
+typedef struct {
+  void *buffer;
+  unsigned int size;
+} rt_icqueue_msg_t;
+
+typedef struct rt_icqueue_prod_s rt_icqueue_prod_t;
+typedef struct rt_icqueue_cons_s rt_icqueue_cons_t;
+
+// Each endpoint only reads its own memory, the producer writes the
+// messages and the tail into the consumer memory and the consumer writes
+// the head into the producer memory
+typedef struct rt_icqueue_prod_s {
+  rt_icqueue_msg_t *slots;
+  rt_icqueue_cons_t *cons;
+  unsigned int nb_slots;
+  unsigned int tail;
+  volatile unsigned int head;
+  int cons_cid;
+} rt_icqueue_prod_t;
+
+typedef struct rt_icqueue_cons_s {
+  rt_icqueue_msg_t *slots;
+  rt_icqueue_prod_t *prod;
+  unsigned int nb_slots;
+  volatile unsigned int tail;
+  unsigned int head;
+  int prod_cid;
+} rt_icqueue_cons_t;
+
+typedef struct {
+  rt_icqueue_prod_t *prod;
+  rt_icqueue_cons_t *cons;
+  int prod_cid;
+  int cons_cid;
+  unsigned int nb_slots;
+} rt_icqueue_t;
+
 #if defined(CSR_PCER_NB_EVENTS)
 
 #define RT_PERF_NB_EVENTS (CSR_PCER_NB_EVENTS + 1)
@@ -543,6 +728,7 @@ typedef struct rt_fs_l2_s {
 #define FS_READ_THRESHOLD            16
 #define FS_READ_THRESHOLD_BLOCK      128
 #define FS_READ_THRESHOLD_BLOCK_FULL (FS_READ_THRESHOLD_BLOCK + 8)
+#define FS_PREFETCH_SIZE             1024
 
 typedef struct {
 
@@ -794,7 +980,7 @@ extern RT_FC_TINY_DATA void *__rt_hyper_udma_handle;
 #define RT_CLUSTER_CALL_T_S_STACK_SIZE 20
 #define RT_CLUSTER_CALL_T_EVENT        24
 
-#define RT_FC_CLUSTER_DATA_T_SIZEOF       (10*4)
+#define RT_FC_CLUSTER_DATA_T_SIZEOF       (14*4)
 #define RT_FC_CLUSTER_DATA_T_MOUNT_COUNT  0
 #define RT_FC_CLUSTER_DATA_T_EVENTS       4
 #define RT_FC_CLUSTER_DATA_T_CALL_STACKS       8
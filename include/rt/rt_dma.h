@@ -49,6 +49,9 @@
  * The following API can be used to control the DMA in various ways:
  *   - Simple completion. This is only usable by a cluster. A set of transfers can be queued together. An identifier is allocated for the first transfer and reused for the following transfers. This identifier can then be used to block the calling core until all transfers are completed.
  *   - Event-based completion. This can be used on either the fabric controller or a cluster to enqueue a transfer and get notified on completion via an event on the fabric controller.
+ *   - Descriptors. This is only usable by a cluster. Transfers of any size, including 2D and 3D (tile of tiles) patterns, are described once in a descriptor, and the list of descriptors can then be replayed any number of times with a single call.
+ *   - Callback-based completion. This is only usable by a cluster. Each transfer carries a callback which is executed on the issuing core, or on a designated core, once the transfer is finished. This allows multi-buffering schemes where the cores just sleep until the next transfer finishes.
+ *   - Tiler. This is only usable by a cluster. A 2D tensor in external memory is cut into tiles fitting a cluster memory budget, and the tiles are streamed through a ring of cluster buffers so that transfers overlap with the computation done by the team of cores.
  */
 
 /**        
@@ -138,6 +141,267 @@ static inline void rt_dma_wait(rt_dma_copy_t *copy);
 
 
 
+/** \brief DMA copy structure for callback-based completion.
+ *
+ * This structure is used by the runtime to manage a DMA copy with a completion callback.
+ * It must be kept alive until the callback has been executed.
+ */
+typedef struct rt_dma_cb_s rt_dma_cb_t;
+
+
+
+/** \brief Initialize a DMA copy with a completion callback.
+ *
+ * The callback will be executed by the core which pushes the transfer, as it is the only one notified
+ * when the transfer is finished.
+ *
+ * This can only be called on a cluster.
+ *
+ * \param   copy      The copy structure.
+ * \param   callback  The function to be executed when the transfer is finished.
+ * \param   arg       The argument of the callback.
+ * \return            The copy structure.
+ */
+rt_dma_cb_t *rt_dma_cb(rt_dma_cb_t *copy, void (*callback)(void *), void *arg);
+
+
+
+/** \brief 1D DMA memory transfer with callback completion.
+ *
+ * This function is very similar to rt_dma_memcpy, except that the callback associated to the copy is executed
+ * once the transfer is finished. The transfer is never merged with the previous one.
+ * The callback is executed by the calling core the next time it calls rt_dma_cb_process, rt_dma_cb_wait_any or rt_dma_cb_wait_all.
+ *
+ * This can only be called on a cluster. As for rt_dma_memcpy, this must not be called inside a team critical
+ * section on chips with MCHAN version 7 or more, since the command is pushed under the same event unit mutex.
+ *
+ * \param   ext     Address in the external memory where to access the data. There is no restriction on memory alignment.
+ * \param   loc     Address in the cluster memory where to access the data. There is no restriction on memory alignment.
+ * \param   size    Number of bytes to be transfered. The only restriction is that this size must fit in 16 bits, i.e. must be less than 65536.
+ * \param   dir     Direction of the transfer.
+ * \param   copy    The copy structure, initialized with rt_dma_cb.
+ */
+void rt_dma_memcpy_cb(unsigned int ext, unsigned int loc, unsigned short size, rt_dma_dir_e dir, rt_dma_cb_t *copy);
+
+
+
+/** \brief 2D DMA memory transfer with callback completion.
+ *
+ * This function is very similar to rt_dma_memcpy_2d, except that the callback associated to the copy is executed
+ * once the transfer is finished. The transfer is never merged with the previous one.
+ *
+ * This can only be called on a cluster.
+ *
+ * \param   ext     Address in the external memory where to access the data. There is no restriction on memory alignment.
+ * \param   loc     Address in the cluster memory where to access the data. There is no restriction on memory alignment.
+ * \param   size    Number of bytes to be transfered. Must fit in 16 bits.
+ * \param   stride  2D stride. Must fit in 16 bits.
+ * \param   length  2D length. Must fit in 16 bits.
+ * \param   dir     Direction of the transfer.
+ * \param   copy    The copy structure, initialized with rt_dma_cb.
+ */
+void rt_dma_memcpy_2d_cb(unsigned int ext, unsigned int loc, unsigned short size, unsigned short stride, unsigned short length, rt_dma_dir_e dir, rt_dma_cb_t *copy);
+
+
+
+/** \brief DMA descriptor structure.
+ *
+ * A descriptor describes a 1D, 2D or 3D transfer whose size is not limited to 16 bits.
+ * The runtime computes all the DMA commands when the descriptor is built so that pushing it
+ * only consists in writing the commands to the DMA. Descriptors can be chained to describe
+ * several transfers which are pushed together and share the same completion.
+ */
+typedef struct rt_dma_desc_s rt_dma_desc_t;
+
+
+
+/** \brief Build a 1D descriptor.
+ *
+ * This can only be called on a cluster.
+ *
+ * \param   desc    The descriptor.
+ * \param   ext     Address in the external memory.
+ * \param   loc     Address in the cluster memory.
+ * \param   size    Number of bytes to be transfered. This is a 32 bits size, the transfer is split into several DMA commands if needed.
+ * \param   dir     Direction of the transfer.
+ */
+void rt_dma_desc_1d(rt_dma_desc_t *desc, unsigned int ext, unsigned int loc, uint32_t size, rt_dma_dir_e dir);
+
+
+
+/** \brief Build a 2D descriptor.
+ *
+ * The transfer is split on line boundaries into several 2D DMA commands if needed.
+ *
+ * This can only be called on a cluster.
+ *
+ * \param   desc    The descriptor.
+ * \param   ext     Address in the external memory.
+ * \param   loc     Address in the cluster memory.
+ * \param   size    Total number of bytes to be transfered.
+ * \param   stride  Number of bytes between the beginning of 2 lines in external memory.
+ * \param   length  Number of bytes of each line. This must be less or equal to RT_DMA_DESC_MAX_CHUNK.
+ * \param   dir     Direction of the transfer.
+ * \return          0 if the descriptor is valid, -1 otherwise.
+ */
+int rt_dma_desc_2d(rt_dma_desc_t *desc, unsigned int ext, unsigned int loc, uint32_t size, uint32_t stride, uint32_t length, rt_dma_dir_e dir);
+
+
+
+/** \brief Repeat a descriptor to build a 3D transfer.
+ *
+ * This turns a 1D or 2D descriptor into a tile of tiles: the transfer described by the descriptor is repeated
+ * for each tile, with both addresses moved by the specified strides.
+ *
+ * \param   desc             The descriptor, already built with rt_dma_desc_1d or rt_dma_desc_2d.
+ * \param   nb_tiles         Number of tiles.
+ * \param   tile_ext_stride  Number of bytes between 2 tiles in external memory.
+ * \param   tile_loc_stride  Number of bytes between 2 tiles in cluster memory.
+ */
+void rt_dma_desc_3d(rt_dma_desc_t *desc, uint32_t nb_tiles, uint32_t tile_ext_stride, uint32_t tile_loc_stride);
+
+
+
+/** \brief Chain 2 descriptors.
+ *
+ * \param   desc    The descriptor.
+ * \param   next    The descriptor pushed after it, or NULL to end the list.
+ */
+static inline void rt_dma_desc_link(rt_dma_desc_t *desc, rt_dma_desc_t *next);
+
+
+
+/** \brief Push a list of descriptors.
+ *
+ * All the transfers of the list share the same transfer identifier, so that rt_dma_wait can be used to wait
+ * for the whole list. The descriptors are not modified and can be pushed again.
+ *
+ * This can only be called on a cluster.
+ *
+ * \param   desc    The first descriptor of the list.
+ * \param   copy    The structure for the copy, to be used with rt_dma_wait.
+ */
+void rt_dma_desc_push(rt_dma_desc_t *desc, rt_dma_copy_t *copy);
+
+
+
+/** \brief Push a list of descriptors with callback completion.
+ *
+ * This is the same as rt_dma_desc_push, except that the callback of the copy is executed once the whole list is finished.
+ *
+ * This can only be called on a cluster.
+ *
+ * \param   desc    The first descriptor of the list.
+ * \param   copy    The copy structure, initialized with rt_dma_cb.
+ */
+void rt_dma_desc_push_cb(rt_dma_desc_t *desc, rt_dma_cb_t *copy);
+
+
+
+/** \brief Execute the callbacks of finished transfers.
+ *
+ * This checks the transfers whose callback must be executed by the calling core, and executes the callbacks of the ones
+ * which are finished. This never blocks. Callbacks can enqueue new transfers.
+ *
+ * This can only be called on a cluster.
+ *
+ * \return  The number of executed callbacks.
+ */
+int rt_dma_cb_process();
+
+
+
+/** \brief Wait until at least one transfer is finished and execute its callback.
+ *
+ * The calling core is put to sleep until a DMA transfer is finished, and then executes the callbacks of the finished transfers.
+ *
+ * This can only be called on a cluster.
+ *
+ * \return  The number of executed callbacks, or 0 if the calling core has no pending transfer.
+ */
+int rt_dma_cb_wait_any();
+
+
+
+/** \brief Wait until all transfers of the calling core are finished.
+ *
+ * The calling core sleeps and executes callbacks until no transfer is pending for it, including the ones enqueued by the callbacks.
+ *
+ * This can only be called on a cluster.
+ */
+void rt_dma_cb_wait_all();
+
+
+
+/** \brief Tile descriptor.
+ *
+ * This describes the tile being processed when the compute function of the tiler is called.
+ * in and out are the cluster memory buffers of the tile, which are NULL if the tensor has no input or no output.
+ * Lines of both buffers are packed, i.e. the stride between 2 lines is width*elem_size.
+ * row and col give the position of the tile in the tensor and height and width its actual size, which is smaller
+ * than the configured tile size for the tiles on the tensor edges. index is the tile number in processing order.
+ */
+typedef struct rt_dma_tile_s rt_dma_tile_t;
+
+
+
+/** \brief Tiler configuration structure.
+ *
+ * This describes the tensor to be processed and how it must be cut into tiles:
+ *   - in, out: addresses of the input and output tensors in external memory. Any of them can be 0 if the kernel has no input or output.
+ *   - height, width: tensor size in elements.
+ *   - stride: number of elements between the beginning of 2 lines in external memory. 0 means packed lines.
+ *   - elem_size: size in bytes of one element.
+ *   - tile_height, tile_width: tile size in elements. 0 lets the tiler choose the biggest tile fitting the budget, keeping full lines when possible.
+ *   - l1_budget: number of bytes of cluster memory that the tiler can allocate for its buffers.
+ *   - nb_buffers: buffering depth, e.g. 2 for double buffering. It is reduced if the budget is too small, down to 1 where transfers do not overlap computation.
+ *   - nb_cores: number of cores executing the compute function, 0 means the current team size.
+ *   - compute, arg: function called on each core for each tile, and its argument.
+ */
+typedef struct rt_dma_tiler_conf_s rt_dma_tiler_conf_t;
+
+
+
+/** \brief Tiler report structure.
+ *
+ * This reports the tiling which was chosen and how much time was spent computing and waiting for transfers.
+ * dma_wait_cycles is the time during which the cores were idle waiting for a transfer, a small value compared to
+ * compute_cycles means transfers were well overlapped with computation.
+ * Cycles are read from the cluster timer, which must have been started, for example with rt_perf_start, otherwise
+ * they are reported as 0.
+ */
+typedef struct rt_dma_tiler_stats_s rt_dma_tiler_stats_t;
+
+
+
+/** \brief Initialize a tiler configuration.
+ *
+ * The configuration is initialized with default values (double buffering, packed lines, automatic tile size, all cores).
+ * The tensor, budget and compute function must then be set by the caller.
+ *
+ * \param   conf    The configuration structure.
+ */
+void rt_dma_tiler_conf_init(rt_dma_tiler_conf_t *conf);
+
+
+
+/** \brief Run a kernel over a tensor tile by tile.
+ *
+ * This allocates the buffers in the memory of the calling cluster, and then for each tile prefetches the input of the
+ * next tiles, executes the compute function on all the cores and writes back the output, while
+ * previous output transfers are still running. Returns once all outputs are written back and the buffers are freed.
+ *
+ * This must be called by the master core of a cluster, outside of any rt_team_fork.
+ *
+ * \param   conf    The configuration.
+ * \param   stats   If not NULL, filled with the report of the execution.
+ * \return          0 if the operation was successful, -1 if the tensor cannot be tiled within the budget, buffers cannot be allocated
+ *                  or the transfer of a tile cannot be encoded, in which case the kernel is not executed on this tile and the next ones.
+ */
+int rt_dma_tiler_run(rt_dma_tiler_conf_t *conf, rt_dma_tiler_stats_t *stats);
+
+
+
 //!@}
 
 /**        
@@ -147,6 +411,14 @@ static inline void rt_dma_wait(rt_dma_copy_t *copy);
 
 /// @cond IMPLEM
 
+// Maximum size of a single DMA command built from a descriptor
+#define RT_DMA_DESC_MAX_CHUNK (1<<15)
+
+static inline void rt_dma_desc_link(rt_dma_desc_t *desc, rt_dma_desc_t *next)
+{
+  desc->next = next;
+}
+
 #if defined(MCHAN_VERSION)
 
 #if MCHAN_VERSION >= 6
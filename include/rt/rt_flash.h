@@ -199,6 +199,13 @@ typedef struct rt_fs_s {
   rt_mutex_t mutex;
   rt_event_t event;
   rt_flash_conf_t flash_conf;
+  unsigned char *prefetch;
+  unsigned int prefetch_addr;
+  unsigned int prefetch_len;
+  int prefetch_size;
+  int prefetch_state;
+  struct rt_file_s *prefetch_waiters;
+  rt_event_t prefetch_event;
 } rt_fs_t;
 
 typedef struct rt_file_s {
@@ -211,6 +218,9 @@ typedef struct rt_file_s {
   rt_event_t *step_event;
   unsigned int pending_buffer;
   unsigned int pending_size;
+  unsigned int last_addr;
+  int sequential;
+  struct rt_file_s *prefetch_next;
 } rt_file_t;
 
 extern rt_flash_dev_t hyperflash_desc;
@@ -88,6 +88,7 @@ typedef enum {
 typedef struct {
   rt_fs_type_e type;     /*!< File-system type. */
   rt_flash_conf_t flash_conf;        /*!< Flash configuration. */
+  int prefetch_size;     /*!< Size in bytes of the window read ahead of files which are read sequentially, 0 to disable prefetching. */
 } rt_fs_conf_t;
 
 
@@ -100,6 +100,140 @@ static inline void rt_team_critical_enter();
  */
 static inline void rt_team_critical_exit();
 
+
+
+/** \enum pi_cl_team_reduce_op_e
+ * \brief Reduction operation.
+ */
+typedef enum {
+  PI_CL_TEAM_REDUCE_ADD = 0,    /*!< Sum of the values. */
+  PI_CL_TEAM_REDUCE_MIN = 1,    /*!< Minimum of the values. */
+  PI_CL_TEAM_REDUCE_MAX = 2,    /*!< Maximum of the values. */
+} pi_cl_team_reduce_op_e;
+
+
+
+/** \brief Reduce custom data over the team.
+ *
+ * Each core of the team provides its partial data, and the partial data are combined 2 by 2 in a tree whose
+ * levels are separated by team barriers, so that no lock is needed and the reduction takes a logarithmic
+ * number of steps. Once this returns, the data of core 0 contains the result.
+ * The data of the other cores may have been modified and must be considered as undefined.
+ * All cores of the team must call this function.
+ *
+ * \param   data      The partial data of the calling core.
+ * \param   combine   The function combining the data src into the data dst.
+ * \param   arg       An argument passed to the combine function.
+ */
+void pi_cl_team_reduce(void *data, void (*combine)(void *dst, void *src, void *arg), void *arg);
+
+
+
+/** \brief Reduce an integer over the team.
+ *
+ * This is the same as pi_cl_team_reduce for one integer, except that the result is returned on all cores.
+ *
+ * \param   value     The partial value of the calling core.
+ * \param   op        The reduction operation.
+ * \return            The result of the reduction.
+ */
+int pi_cl_team_reduce_int(int value, pi_cl_team_reduce_op_e op);
+
+
+
+/** \brief Reduce a float over the team.
+ *
+ * This is the same as pi_cl_team_reduce for one float, except that the result is returned on all cores.
+ *
+ * \param   value     The partial value of the calling core.
+ * \param   op        The reduction operation.
+ * \return            The result of the reduction.
+ */
+float pi_cl_team_reduce_float(float value, pi_cl_team_reduce_op_e op);
+
+
+
+/** \brief Parallel loop descriptor.
+ *
+ * This describes one loop of a chain executed with pi_cl_team_parallel_for_chain.
+ */
+typedef struct pi_cl_team_loop_s pi_cl_team_loop_t;
+
+#define PI_CL_TEAM_LOOP_DYNAMIC  (1<<0)   /*!< Distribute the chunks dynamically instead of statically. */
+#define PI_CL_TEAM_LOOP_NOWAIT   (1<<1)   /*!< Do not wait for all cores at the end of the loop before starting the next one of the chain. */
+
+
+
+/** \brief Execute a loop in parallel with a static schedule.
+ *
+ * This forks the team, executes the loop and joins the team, without any other
+ * synchronization. The iterations between start and end are divided between the cores,
+ * and the function is called on each core with the bounds of each of its chunks.
+ * If chunk is zero or negative, each core gets one contiguous block of iterations, otherwise
+ * chunks of chunk iterations are given to the cores in a round-robin way.
+ *
+ * This must be called by the master core, outside of any fork.
+ *
+ * \param   nb_cores  The number of cores of the team. If it is zero, the number of cores of the previous fork is reused.
+ * \param   start     The first iteration.
+ * \param   end       The iteration after the last one.
+ * \param   chunk     The number of iterations of each chunk.
+ * \param   fn        The function called for each chunk with its first iteration and the iteration after its last one.
+ * \param   arg       The argument passed to the function.
+ */
+void pi_cl_team_parallel_for(int nb_cores, int start, int end, int chunk, void (*fn)(int start, int end, void *arg), void *arg);
+
+
+
+/** \brief Execute a loop in parallel with a dynamic schedule.
+ *
+ * This is the same as pi_cl_team_parallel_for, except that the chunks are given to the
+ * cores as soon as they are done with the previous one. The hardware loop unit is used when it
+ * is available. This is better for unbalanced iterations, while the static schedule has less
+ * overhead.
+ *
+ * \param   nb_cores  The number of cores of the team. If it is zero, the number of cores of the previous fork is reused.
+ * \param   start     The first iteration.
+ * \param   end       The iteration after the last one.
+ * \param   chunk     The number of iterations of each chunk. If it is zero or negative, chunks of 1 iteration are used.
+ * \param   fn        The function called for each chunk with its first iteration and the iteration after its last one.
+ * \param   arg       The argument passed to the function.
+ */
+void pi_cl_team_parallel_for_dynamic(int nb_cores, int start, int end, int chunk, void (*fn)(int start, int end, void *arg), void *arg);
+
+
+
+/** \brief Initialize a parallel loop descriptor.
+ *
+ * \param   loop      The loop descriptor.
+ * \param   start     The first iteration.
+ * \param   end       The iteration after the last one.
+ * \param   chunk     The number of iterations of each chunk, see pi_cl_team_parallel_for and pi_cl_team_parallel_for_dynamic.
+ * \param   fn        The function called for each chunk.
+ * \param   arg       The argument passed to the function.
+ * \param   flags     A combination of PI_CL_TEAM_LOOP_DYNAMIC and PI_CL_TEAM_LOOP_NOWAIT.
+ */
+static inline void pi_cl_team_loop_init(pi_cl_team_loop_t *loop, int start, int end, int chunk,
+  void (*fn)(int start, int end, void *arg), void *arg, unsigned int flags);
+
+
+
+/** \brief Execute a chain of loops in parallel.
+ *
+ * All the loops are executed in order within a single fork. Unless a loop has the
+ * PI_CL_TEAM_LOOP_NOWAIT flag, the cores wait for each other at the end of the loop before
+ * starting the next one, with a team barrier. The team is joined after the last loop.
+ * On clusters with a hardware loop unit, dynamic loops are always followed by a barrier
+ * as the unit is shared by all the loops.
+ *
+ * This must be called by the master core, outside of any fork.
+ *
+ * \param   nb_cores  The number of cores of the team. If it is zero, the number of cores of the previous fork is reused.
+ * \param   loops     The array of loop descriptors. It must be kept allocated until this function returns.
+ * \param   nb_loops  The number of loops.
+ */
+void pi_cl_team_parallel_for_chain(int nb_cores, pi_cl_team_loop_t *loops, int nb_loops);
+
 //!@}
 
 /**        
@@ -115,7 +249,11 @@ static inline void rt_team_critical_exit();
 
 #if defined(ARCHI_HAS_CLUSTER)
 
+#ifdef __RT_SW_TEAM_BARRIER
+void __rt_team_barrier();
+#else
 static inline void __rt_team_barrier();
+#endif
 
 #if defined(EU_VERSION) && EU_VERSION >= 3
 
@@ -146,13 +284,17 @@ static inline void rt_team_offload_wait() {
 
 #endif
 
-#ifdef ARCHI_HAS_NO_BARRIER
+#ifdef __RT_SW_TEAM_BARRIER
 extern RT_L1_TINY_DATA unsigned int __rt_barrier_wait_mask;
 #endif
 
 static inline int pi_cl_team_nb_cores()
 {
+#ifdef __RT_SW_TEAM_BARRIER
+  return __FL1(__rt_barrier_wait_mask + 1);
+#else
   return __FL1(pulp_read32(eu_bar_addr(0) + EU_HW_BARR_TRIGGER_MASK) + 1);
+#endif
 }
 
 static inline int rt_team_nb_cores()
@@ -162,7 +304,7 @@ static inline int rt_team_nb_cores()
 
 static inline void __rt_team_barrier_config(unsigned int core_mask)
 {
-#ifdef ARCHI_HAS_NO_BARRIER
+#ifdef __RT_SW_TEAM_BARRIER
   __rt_barrier_wait_mask = core_mask;
 #else
   eu_bar_setup(eu_bar_addr(0), core_mask);
@@ -187,6 +329,17 @@ static inline void pi_cl_team_barrier()
   rt_team_barrier();
 }
 
+static inline void pi_cl_team_loop_init(pi_cl_team_loop_t *loop, int start, int end, int chunk,
+  void (*fn)(int start, int end, void *arg), void *arg, unsigned int flags)
+{
+  loop->start = start;
+  loop->end = end;
+  loop->chunk = chunk;
+  loop->fn = fn;
+  loop->arg = arg;
+  loop->flags = flags;
+}
+
 static inline void pi_cl_team_critical_enter()
 {
   rt_team_critical_enter();
@@ -236,9 +389,11 @@ static inline void rt_team_fork(int nb_cores, void (*entry)(void *), void *arg)
 #endif
 
 
+#ifndef __RT_SW_TEAM_BARRIER
 static inline void __rt_team_barrier() {
   eu_bar_trig_wait_clr(eu_bar_addr(0));
 }
+#endif
 
 static inline void rt_team_barrier() {
 #ifdef __RT_USE_PROFILE
@@ -130,6 +130,7 @@ rt_iclock_cl_t *rt_iclock_cl(rt_iclock_t *lock);
  *
  * This will block the calling core until it is the only owner of the lock. If another core is owning the lock, it will sleep 
  * the calling cluster until the lock is released and is given to it (other cores could also be waiting for it).
+ * Clusters waiting for the lock are queued and get it in arrival order.
  *
  * This must be called from cluster side.
  *
@@ -142,7 +143,7 @@ void rt_iclock_lock(rt_iclock_cl_t *lock);
 /** \brief Release the lock.
  *
  * This will make the lock available. If at least one core is waiting for the lock, one of them will become the owner of the lock and
- * will be woken-up.
+ * will be woken-up. Only the cluster of the next owner is notified.
  *
  * This must be called from cluster side.
  *
@@ -151,6 +152,268 @@ void rt_iclock_lock(rt_iclock_cl_t *lock);
 void rt_iclock_unlock(rt_iclock_cl_t *lock);
 
 
+//!@}
+
+
+
+/**        
+ * @defgroup IcBarrier Inter-cluster barriers
+ *
+ * Inter-cluster barriers are hierarchical. The cores of a cluster first synchronize together
+ * with the cluster hardware barrier, then only one core per cluster takes part to the global
+ * synchronization. The last cluster reaching the barrier notifies each other cluster once.
+ *
+ * The same barriers can also be used to compute a reduction over all the cores of all the clusters.
+ */
+
+/**        
+ * @addtogroup IcBarrier
+ * @{        
+ */
+
+
+/** \brief Configuration structure for inter-cluster barriers.
+ *
+ * This can be initialized to default values by calling rt_icbarrier_conf_init and then specific fields can be set to the desired values.
+ */
+typedef struct {
+  unsigned int cluster_mask;  /**< Bitmask giving the set of clusters which take part to the barrier. Bit 0 is for cluster 0, a bit set to 1 means the cluster takes part. */
+} rt_icbarrier_conf_t;
+
+
+
+/** \brief Get default configuration.
+ *
+ * This will set all fields of the given configuration to default values so that only specific ones can be set.
+ * By default, all the clusters take part to the barrier.
+ *
+ * This must be called by the fabric controller.
+ *
+ * \param conf A pointer to the configuration. This must be allocated by the caller and must be kept alive until the barrier is allocated.
+ */
+void rt_icbarrier_conf_init(rt_icbarrier_conf_t *conf);
+
+
+
+/** \brief Allocate inter-cluster barrier.
+ *
+ * This will allocate all needed resources for the set of clusters specified in the configuration, and will initialize the barrier, which becomes usable
+ * by the clusters after this call returns.
+ *
+ * This must be called by the fabric controller.
+ *
+ * \param conf A pointer to the configuration. The configuration can be freed after this call.
+ * \return The barrier if the operation has succeeded, otherwise NULL.
+ */
+rt_icbarrier_t *rt_icbarrier_alloc(rt_icbarrier_conf_t *conf);
+
+
+
+/** \brief Free the barrier.
+ *
+ * Free all resources allocated for the barrier and also the barrier itself. After this call, the barrier should not be used anymore.
+ *
+ * This must be called by the fabric controller.
+ *
+ * \param barrier The fabric controller barrier.
+ */
+void rt_icbarrier_free(rt_icbarrier_t *barrier);
+
+
+
+/** \brief Get the barrier for the calling cluster.
+ *
+ * As for locks, a cluster can not use the global barrier allocated on fabric controller side and must call this function to get the barrier
+ * that it should use.
+ *
+ * This must be called from the cluster.
+ *
+ * \param barrier The global barrier allocated by the fabric controller.
+ * \return The cluster barrier.
+ */
+rt_icbarrier_cl_t *rt_icbarrier_cl(rt_icbarrier_t *barrier);
+
+
+
+/** \brief Wait on the barrier.
+ *
+ * This will block the calling core until all the cores of the current team of all the clusters of the barrier have reached it.
+ *
+ * This must be called from cluster side by all the cores of the current team, as this is also a team barrier.
+ *
+ * \param barrier The cluster barrier.
+ */
+void rt_icbarrier_wait(rt_icbarrier_cl_t *barrier);
+
+
+
+/** \brief Reduce an integer over all clusters.
+ *
+ * The values of all the cores of the current team of all the clusters of the barrier are combined with the specified operation and the result
+ * is returned to every core. This also acts as a barrier.
+ *
+ * This must be called from cluster side by all the cores of the current team.
+ *
+ * \param barrier The cluster barrier.
+ * \param value   The value of the calling core.
+ * \param op      The reduction operation.
+ * \return        The reduced value.
+ */
+int rt_icbarrier_reduce_int(rt_icbarrier_cl_t *barrier, int value, pi_cl_team_reduce_op_e op);
+
+
+
+/** \brief Reduce a float over all clusters.
+ *
+ * Same as rt_icbarrier_reduce_int but for single-precision floating-point values.
+ *
+ * \param barrier The cluster barrier.
+ * \param value   The value of the calling core.
+ * \param op      The reduction operation.
+ * \return        The reduced value.
+ */
+float rt_icbarrier_reduce_float(rt_icbarrier_cl_t *barrier, float value, pi_cl_team_reduce_op_e op);
+
+
+//!@}
+
+
+
+/**        
+ * @defgroup IcQueue Inter-cluster message queues
+ *
+ * Message queues can be used to send buffers from one cluster to another, or between the fabric controller and a cluster,
+ * without going through the fabric controller.
+ *
+ * A queue has exactly one producer and one consumer. Messages only contain a pointer and a size, the buffer itself is never copied,
+ * its ownership is given to the consumer when the message is pushed. The producer must not access the buffer anymore until
+ * the consumer gives it back, for example through another queue.
+ *
+ * The messages are stored in the memory of the consumer, and the consumer cluster is woken-up with an event when a message is pushed.
+ * When the fabric controller is waiting on a queue, it keeps executing its events and is woken-up by the cluster
+ * through an interrupt.
+ */
+
+/**        
+ * @addtogroup IcQueue
+ * @{        
+ */
+
+/** \brief Identifier to be used in the configuration when the fabric controller is an endpoint of the queue. */
+#define RT_ICQUEUE_FC -1
+
+/** \brief Configuration structure for inter-cluster queues.
+ *
+ * This can be initialized to default values by calling rt_icqueue_conf_init and then specific fields can be set to the desired values.
+ */
+typedef struct {
+  int producer;               /**< Cluster identifier of the producer, or RT_ICQUEUE_FC for the fabric controller. */
+  int consumer;               /**< Cluster identifier of the consumer, or RT_ICQUEUE_FC for the fabric controller. */
+  unsigned int nb_slots;      /**< Maximum number of messages which can be pending in the queue. */
+} rt_icqueue_conf_t;
+
+
+
+/** \brief Get default configuration.
+ *
+ * This will set all fields of the given configuration to default values so that only specific ones can be set.
+ * By default, the queue goes from the fabric controller to cluster 0 and can contain 4 messages.
+ *
+ * \param conf A pointer to the configuration.
+ */
+void rt_icqueue_conf_init(rt_icqueue_conf_t *conf);
+
+
+
+/** \brief Allocate an inter-cluster queue.
+ *
+ * This will allocate the queue endpoints in the memories of the producer and of the consumer.
+ *
+ * This must be called by the fabric controller.
+ *
+ * \param conf A pointer to the configuration. The configuration can be freed after this call.
+ * \return The queue if the operation has succeeded, otherwise NULL.
+ */
+rt_icqueue_t *rt_icqueue_alloc(rt_icqueue_conf_t *conf);
+
+
+
+/** \brief Free the queue.
+ *
+ * This must be called by the fabric controller, when there is no more activity on the queue.
+ *
+ * \param queue The queue.
+ */
+void rt_icqueue_free(rt_icqueue_t *queue);
+
+
+
+/** \brief Get the producer endpoint of the queue.
+ *
+ * \param queue The queue.
+ * \return The endpoint to be used by the producer.
+ */
+static inline rt_icqueue_prod_t *rt_icqueue_producer(rt_icqueue_t *queue);
+
+
+
+/** \brief Get the consumer endpoint of the queue.
+ *
+ * \param queue The queue.
+ * \return The endpoint to be used by the consumer.
+ */
+static inline rt_icqueue_cons_t *rt_icqueue_consumer(rt_icqueue_t *queue);
+
+
+
+/** \brief Push a message.
+ *
+ * Send a buffer to the consumer. If the queue is full, the caller waits until the consumer has popped a message.
+ *
+ * \param prod    The producer endpoint.
+ * \param buffer  The buffer whose ownership is given to the consumer. It must not be NULL.
+ * \param size    The size of the buffer. This is only passed to the consumer.
+ */
+void rt_icqueue_push(rt_icqueue_prod_t *prod, void *buffer, unsigned int size);
+
+
+
+/** \brief Try to push a message.
+ *
+ * Same as rt_icqueue_push but returns immediately if the queue is full.
+ *
+ * \param prod    The producer endpoint.
+ * \param buffer  The buffer whose ownership is given to the consumer.
+ * \param size    The size of the buffer.
+ * \return        0 if the message was pushed, -1 if the queue is full.
+ */
+int rt_icqueue_try_push(rt_icqueue_prod_t *prod, void *buffer, unsigned int size);
+
+
+
+/** \brief Pop a message.
+ *
+ * Get the oldest message of the queue. If the queue is empty, the caller waits until a message is pushed.
+ *
+ * \param cons    The consumer endpoint.
+ * \param size    If not NULL, the size of the buffer is returned here.
+ * \return        The buffer, which is now owned by the caller.
+ */
+void *rt_icqueue_pop(rt_icqueue_cons_t *cons, unsigned int *size);
+
+
+
+/** \brief Try to pop a message.
+ *
+ * Same as rt_icqueue_pop but returns immediately if the queue is empty.
+ *
+ * \param cons    The consumer endpoint.
+ * \param size    If not NULL, the size of the buffer is returned here.
+ * \return        The buffer, or NULL if the queue is empty.
+ */
+void *rt_icqueue_try_pop(rt_icqueue_cons_t *cons, unsigned int *size);
+
+
 //!@}
 
 /**        
@@ -160,6 +423,16 @@ void rt_iclock_unlock(rt_iclock_cl_t *lock);
 
 /// @cond IMPLEM
 
+static inline rt_icqueue_prod_t *rt_icqueue_producer(rt_icqueue_t *queue)
+{
+  return queue->prod;
+}
+
+static inline rt_icqueue_cons_t *rt_icqueue_consumer(rt_icqueue_t *queue)
+{
+  return queue->cons;
+}
+
 /// @endcond
 
 
@@ -37,8 +37,30 @@ typedef enum
   RT_CLUSTER_MOUNT_DONE,
 } __rt_cluster_mount_step_e;
 
+typedef enum
+{
+  RT_CLUSTER_IDLE_ACTIVE,
+  RT_CLUSTER_IDLE_GATED,
+  RT_CLUSTER_IDLE_OFF,
+} __rt_cluster_idle_state_e;
+
+typedef struct
+{
+  pi_task_t timer_task;
+  pi_task_t wake_task;
+  pi_cluster_idle_stats_t stats;
+  unsigned int last_activity;
+  unsigned int wake_start;
+  int timeout;
+  int nb_busy;
+  char mode;
+  char state;
+  char timer_armed;
+} __rt_cluster_idle_t;
+
 rt_fc_cluster_data_t __rt_fc_cluster_data[ARCHI_NB_CLUSTER];
 pi_task_t *__rt_cluster_tasks[ARCHI_NB_CLUSTER];
+static __rt_cluster_idle_t __rt_cluster_idle[ARCHI_NB_CLUSTER];
 
 #ifdef __RT_USE_PROFILE
 RT_L1_TINY_DATA int __rt_pe_trace[ARCHI_CLUSTER_NB_PE];
@@ -55,6 +77,9 @@ RT_L1_TINY_DATA rt_cluster_call_pool_t __rt_cluster_pool;
 RT_L1_TINY_DATA int __rt_cluster_nb_active_pe;
 RT_L1_TINY_DATA pi_cl_dma_cmd_t *__rt_dma_first_pending;
 RT_L1_TINY_DATA pi_cl_dma_cmd_t *__rt_dma_last_pending;
+// Task currently executed by the cluster master, NULL when it is sleeping.
+// Read by the FC to detect when the cluster is idle.
+RT_L1_TINY_DATA struct pi_cluster_task *__rt_cluster_current_task;
 
 
 
@@ -104,6 +129,26 @@ static void __rt_init_cluster_data(int cid)
 
 
 
+static void __rt_cluster_preload(rt_fc_cluster_data_t *cluster)
+{
+  // Copy the user data registered for L1 preloading, so that they are ready
+  // when the tasks queued during the mount start executing
+  pi_cluster_preload_t *preload = cluster->first_preload;
+
+  while (preload)
+  {
+    // The L1 address is usually the one of a PI_L1 variable, which is
+    // cluster-local, use the global alias of this cluster's L1 as the copy
+    // is done by the FC
+    void *loc = (void *)(ARCHI_CLUSTER_GLOBAL_ADDR(cluster->cid) + ((unsigned int)preload->loc & (ARCHI_CLUSTER_SIZE - 1)));
+    rt_trace(RT_TRACE_INIT, "L1 user preload (cluster: %d, ext: %p, loc: %p, size: 0x%x)\n", cluster->cid, preload->ext, loc, preload->size);
+    memcpy(loc, preload->ext, preload->size);
+    preload = preload->next;
+  }
+}
+
+
+
 static int __rt_cluster_power_up(rt_fc_cluster_data_t *cluster)
 {
   int cid = cluster->cid;
@@ -115,7 +160,7 @@ static int __rt_cluster_power_up(rt_fc_cluster_data_t *cluster)
   if (cid == 0)
   {
     int pending = 0;
-    cluster->powered_up = __rt_pmu_cluster_power_up(cluster->mount_event, &pending);
+    cluster->powered_up = __rt_pmu_cluster_power_up(&cluster->mount_step_event, &pending);
     return pending;
   }
 
@@ -124,20 +169,8 @@ static int __rt_cluster_power_up(rt_fc_cluster_data_t *cluster)
 
 
 
-static int __rt_cluster_setup(rt_fc_cluster_data_t *cluster)
+static void __rt_cluster_fll_setup()
 {
-  int cid = cluster->cid;
-  rt_event_t *event = cluster->mount_event;
-
-  rt_cluster_call_pool_t *pool = (rt_cluster_call_pool_t *)rt_cluster_tiny_addr(cid, &__rt_cluster_pool);
-
-  pool->first_call_fc = NULL;
-  pool->last_call_fc = NULL;
-  pool->first_call_fc_for_cl = NULL;
-
-
-
-
 #ifdef FLL_VERSION
   #if PULP_CHIP_FAMILY == CHIP_VIVOSOC3 || PULP_CHIP_FAMILY == CHIP_VIVOSOC3_1|| PULP_CHIP_FAMILY == CHIP_VIVOSOC4
     if (rt_platform() != ARCHI_PLATFORM_FPGA)
@@ -172,6 +205,79 @@ static int __rt_cluster_setup(rt_fc_cluster_data_t *cluster)
     }
   #endif  
 #endif
+}
+
+
+
+static void __rt_cluster_fll_teardown()
+{
+#ifdef FLL_VERSION
+  #if PULP_CHIP_FAMILY == CHIP_VIVOSOC3 || PULP_CHIP_FAMILY == CHIP_VIVOSOC3_1 || PULP_CHIP_FAMILY == CHIP_VIVOSOC4
+    if (rt_platform() != ARCHI_PLATFORM_FPGA)
+    {
+      // check if cl fll was used
+      if(rt_freq_config_get(RT_FREQ_DOMAIN_CL) == FREQ_DOMAIN_CLK_TREE_FLL_ALT)
+      {
+        // change back to soc fll
+        rt_freq_config_set(RT_FREQ_DOMAIN_CL, FREQ_DOMAIN_CLK_TREE_FLL_SOC);  // freq will be updated internally
+        // disable cl fll
+        __rt_fll_disable(HAL_FLL_CL);
+      }
+    }
+  #else
+    if (rt_platform() != ARCHI_PLATFORM_FPGA)
+    {
+      __rt_fll_deinit(__RT_FLL_CL);
+    }
+  #endif  
+#endif
+}
+
+
+
+// Stop or restart the cluster clock while the cluster stays powered. This is
+// only possible when the cluster is running on its own FLL, as the other
+// clock sources are shared with the rest of the chip.
+static int __rt_cluster_clock_gate(int gate)
+{
+#if defined(FLL_VERSION) && (PULP_CHIP_FAMILY == CHIP_VIVOSOC3 || PULP_CHIP_FAMILY == CHIP_VIVOSOC3_1 || PULP_CHIP_FAMILY == CHIP_VIVOSOC4)
+  if (rt_platform() != ARCHI_PLATFORM_FPGA && rt_freq_config_get(RT_FREQ_DOMAIN_CL) == FREQ_DOMAIN_CLK_TREE_FLL_ALT)
+  {
+    if (gate)
+      __rt_fll_disable(HAL_FLL_CL);
+    else
+      __rt_fll_enable(HAL_FLL_CL);
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+
+
+static int __rt_cluster_clock_gate_supported()
+{
+#if defined(FLL_VERSION) && (PULP_CHIP_FAMILY == CHIP_VIVOSOC3 || PULP_CHIP_FAMILY == CHIP_VIVOSOC3_1 || PULP_CHIP_FAMILY == CHIP_VIVOSOC4)
+  return rt_platform() != ARCHI_PLATFORM_FPGA && rt_freq_config_get(RT_FREQ_DOMAIN_CL) == FREQ_DOMAIN_CLK_TREE_FLL_ALT;
+#else
+  return 0;
+#endif
+}
+
+
+
+static int __rt_cluster_setup(rt_fc_cluster_data_t *cluster)
+{
+  int cid = cluster->cid;
+  rt_event_t *event = cluster->mount_event;
+
+  rt_cluster_call_pool_t *pool = (rt_cluster_call_pool_t *)rt_cluster_tiny_addr(cid, &__rt_cluster_pool);
+
+  pool->first_call_fc = NULL;
+  pool->last_call_fc = NULL;
+  pool->first_call_fc_for_cl = NULL;
+
+  __rt_cluster_fll_setup();
 
 #ifdef ARCHI_HAS_CLUSTER_CLK_GATE
     /* Activate cluster top level clock gating */
@@ -184,6 +290,9 @@ static int __rt_cluster_setup(rt_fc_cluster_data_t *cluster)
     // Initialize cluster L1 memory allocator
     __rt_alloc_init_l1(cid);
 
+    // Copy user data to L1
+    __rt_cluster_preload(cluster);
+
     // Initialize FC data for this cluster
     if (cluster->powered_up)
     {
@@ -235,10 +344,18 @@ static void __rt_cluster_mount_step(void *_cluster)
         break;
 
       case RT_CLUSTER_MOUNT_DONE:
-        __rt_event_restore(cluster->mount_event);
+      {
+        // Now that the cluster is ready, push the tasks which have been sent
+        // during the mount
+        int irq = rt_irq_disable();
+        cluster->mount_pending = 0;
+        __rt_cluster_push_pending_tasks(cluster);
+        rt_irq_restore(irq);
+
         __rt_event_enqueue(cluster->mount_event);
         end = 1;
         break;
+      }
     }
 
     cluster->state++;
@@ -255,10 +372,12 @@ static inline __attribute__((always_inline)) int __rt_cluster_mount(rt_fc_cluste
   {
     cluster->state = RT_CLUSTER_MOUNT_START;
     cluster->mount_event = event;
+    cluster->mount_pending = 1;
 
-    __rt_event_save(event);
-    __rt_init_event(event, rt_event_internal_sched(), __rt_cluster_mount_step, (void *)cluster);
-    __rt_event_set_pending(event);
+    // The steps are chained with an internal event so that the user task is
+    // only notified once the whole mount is done
+    __rt_init_event(&cluster->mount_step_event, rt_event_internal_sched(), __rt_cluster_mount_step, (void *)cluster);
+    __rt_event_set_pending(&cluster->mount_step_event);
 
     __rt_cluster_mount_step((void *)cluster);
   }
@@ -298,26 +417,7 @@ static inline __attribute__((always_inline)) void __rt_cluster_unmount(int cid,
 {
   rt_trace(RT_TRACE_CONF, "Unmounting cluster (cluster: %d)\n", cid);
 
-#ifdef FLL_VERSION
-  #if PULP_CHIP_FAMILY == CHIP_VIVOSOC3 || PULP_CHIP_FAMILY == CHIP_VIVOSOC3_1 || PULP_CHIP_FAMILY == CHIP_VIVOSOC4
-    if (rt_platform() != ARCHI_PLATFORM_FPGA)
-    {
-      // check if cl fll was used
-      if(rt_freq_config_get(RT_FREQ_DOMAIN_CL) == FREQ_DOMAIN_CLK_TREE_FLL_ALT)
-      {
-        // change back to soc fll
-        rt_freq_config_set(RT_FREQ_DOMAIN_CL, FREQ_DOMAIN_CLK_TREE_FLL_SOC);  // freq will be updated internally
-        // disable cl fll
-        __rt_fll_disable(HAL_FLL_CL);
-      }
-    }
-  #else
-    if (rt_platform() != ARCHI_PLATFORM_FPGA)
-    {
-      __rt_fll_deinit(__RT_FLL_CL);
-    }
-  #endif  
-#endif
+  __rt_cluster_fll_teardown();
 
   // Power-up the cluster
   // For now the PMU is only supporting one cluster
@@ -339,6 +439,246 @@ void pi_cluster_conf_init(struct pi_cluster_conf *conf)
 }
 
 
+static void __rt_cluster_idle_timer_arm(rt_fc_cluster_data_t *cluster, __rt_cluster_idle_t *idle, int us)
+{
+  idle->timer_armed = 1;
+  rt_event_push_delayed(&idle->timer_task, us);
+}
+
+
+
+static int __rt_cluster_is_idle(rt_fc_cluster_data_t *cluster)
+{
+  // The pool must be read before the current task. The cluster can only pick
+  // a task from a non-empty pool and publishes it as current task before
+  // emptying the pool, while only the FC can fill the pool.
+  if (*(struct pi_cluster_task * volatile *)&cluster->pool->first_call_fc_for_cl != NULL)
+    return 0;
+
+  if (*(struct pi_cluster_task * volatile *)rt_cluster_tiny_addr(cluster->cid, &__rt_cluster_current_task) != NULL)
+    return 0;
+
+  // Also wait until the end of task events have been received
+  return *(rt_event_t * volatile *)&cluster->events == NULL;
+}
+
+
+
+static void __rt_cluster_idle_check(void *arg)
+{
+  rt_fc_cluster_data_t *cluster = (rt_fc_cluster_data_t *)arg;
+  __rt_cluster_idle_t *idle = &__rt_cluster_idle[cluster->cid];
+
+  int irq = rt_irq_disable();
+
+  idle->timer_armed = 0;
+
+  if (idle->mode != PI_CLUSTER_IDLE_NONE && idle->state == RT_CLUSTER_IDLE_ACTIVE && !cluster->mount_pending)
+  {
+    int elapsed = rt_time_get_us() - idle->last_activity;
+
+    if (elapsed < idle->timeout)
+    {
+      // A task was sent since the timer was armed, check again later
+      __rt_cluster_idle_timer_arm(cluster, idle, idle->timeout - elapsed);
+    }
+    else if (idle->nb_busy || !__rt_cluster_is_idle(cluster))
+    {
+      __rt_cluster_idle_timer_arm(cluster, idle, idle->timeout);
+    }
+    else
+    {
+      rt_trace(RT_TRACE_CONF, "Cluster is idle, switching it off (cluster: %d, mode: %d)\n", cluster->cid, idle->mode);
+
+      if (idle->mode == PI_CLUSTER_IDLE_CLOCK_GATE)
+      {
+        // Cluster stays powered so that L1 content, including allocator
+        // and stacks, is retained.
+        // The clock source may have been changed since the policy was set,
+        // in which case the cluster is just kept active.
+        if (__rt_cluster_clock_gate(1))
+        {
+          __rt_cluster_idle_timer_arm(cluster, idle, idle->timeout);
+          goto end;
+        }
+        idle->state = RT_CLUSTER_IDLE_GATED;
+      }
+      else
+      {
+        __rt_cluster_unmount(cluster->cid, 0, NULL);
+        idle->state = RT_CLUSTER_IDLE_OFF;
+      }
+
+      idle->stats.nb_sleep++;
+    }
+  }
+
+end:
+  rt_irq_restore(irq);
+}
+
+
+
+static void __rt_cluster_idle_wake_done(void *arg)
+{
+  rt_fc_cluster_data_t *cluster = (rt_fc_cluster_data_t *)arg;
+  __rt_cluster_idle_t *idle = &__rt_cluster_idle[cluster->cid];
+
+  unsigned int latency = rt_time_get_us() - idle->wake_start;
+
+  idle->stats.nb_wakeup++;
+  idle->stats.wakeup_total_us += latency;
+  if (latency > idle->stats.wakeup_max_us)
+    idle->stats.wakeup_max_us = latency;
+}
+
+
+
+static void __rt_cluster_idle_wakeup(rt_fc_cluster_data_t *cluster, __rt_cluster_idle_t *idle)
+{
+  if (idle->state == RT_CLUSTER_IDLE_ACTIVE)
+    return;
+
+  rt_trace(RT_TRACE_CONF, "Waking-up idle cluster (cluster: %d, state: %d)\n", cluster->cid, idle->state);
+
+  idle->wake_start = rt_time_get_us();
+
+  if (idle->state == RT_CLUSTER_IDLE_GATED)
+  {
+    idle->state = RT_CLUSTER_IDLE_ACTIVE;
+    __rt_cluster_clock_gate(0);
+    __rt_cluster_idle_wake_done(cluster);
+  }
+  else
+  {
+    // The cluster is mounted asynchronously. Tasks sent in the meantime are
+    // queued and pushed once the mount is done.
+    idle->state = RT_CLUSTER_IDLE_ACTIVE;
+    pi_task_callback(&idle->wake_task, __rt_cluster_idle_wake_done, cluster);
+    __rt_cluster_mount(cluster, cluster->cid, 0, &idle->wake_task);
+  }
+}
+
+
+
+void __rt_cluster_idle_activity(rt_fc_cluster_data_t *cluster)
+{
+  __rt_cluster_idle_t *idle = &__rt_cluster_idle[cluster->cid];
+
+  if (idle->mode == PI_CLUSTER_IDLE_NONE)
+    return;
+
+  idle->last_activity = rt_time_get_us();
+
+  __rt_cluster_idle_wakeup(cluster, idle);
+
+  if (!idle->timer_armed)
+    __rt_cluster_idle_timer_arm(cluster, idle, idle->timeout);
+}
+
+
+
+void __rt_cluster_idle_busy(rt_fc_cluster_data_t *cluster, int busy)
+{
+  __rt_cluster_idle_t *idle = &__rt_cluster_idle[cluster->cid];
+
+  int irq = rt_irq_disable();
+
+  if (busy)
+  {
+    idle->nb_busy++;
+    __rt_cluster_idle_wakeup(cluster, idle);
+  }
+  else
+  {
+    idle->nb_busy--;
+    // Count the end of the busy period as an activity so that the cluster
+    // gets the full timeout before being switched off.
+    if (idle->mode != PI_CLUSTER_IDLE_NONE)
+    {
+      idle->last_activity = rt_time_get_us();
+      if (!idle->timer_armed)
+        __rt_cluster_idle_timer_arm(cluster, idle, idle->timeout);
+    }
+  }
+
+  rt_irq_restore(irq);
+}
+
+
+
+int pi_cluster_idle_policy(struct pi_device *cluster_dev, pi_cluster_idle_mode_e mode, int timeout_us)
+{
+#if !defined(EU_VERSION) || EU_VERSION < 3
+  // Idle detection relies on the master loop of the event unit v3
+  if (mode != PI_CLUSTER_IDLE_NONE)
+    return -1;
+#endif
+
+  // The cluster clock can only be stopped if it has its own FLL
+  if (mode == PI_CLUSTER_IDLE_CLOCK_GATE && !__rt_cluster_clock_gate_supported())
+    return -1;
+
+  rt_fc_cluster_data_t *cluster = (rt_fc_cluster_data_t *)cluster_dev->data;
+  __rt_cluster_idle_t *idle = &__rt_cluster_idle[cluster->cid];
+
+  int irq = rt_irq_disable();
+
+  // Start from an active cluster so that the policy can be changed at any time
+  __rt_cluster_idle_wakeup(cluster, idle);
+
+  pi_task_callback(&idle->timer_task, __rt_cluster_idle_check, cluster);
+  idle->mode = mode;
+  idle->timeout = timeout_us;
+
+  if (mode != PI_CLUSTER_IDLE_NONE)
+  {
+    idle->last_activity = rt_time_get_us();
+    if (!idle->timer_armed)
+      __rt_cluster_idle_timer_arm(cluster, idle, timeout_us);
+  }
+
+  rt_irq_restore(irq);
+
+  return 0;
+}
+
+
+
+void pi_cluster_idle_stats_get(struct pi_device *cluster_dev, pi_cluster_idle_stats_t *stats)
+{
+  rt_fc_cluster_data_t *cluster = (rt_fc_cluster_data_t *)cluster_dev->data;
+  int irq = rt_irq_disable();
+  *stats = __rt_cluster_idle[cluster->cid].stats;
+  rt_irq_restore(irq);
+}
+
+
+
+int pi_cluster_open_async(struct pi_device *cluster_dev, pi_task_t *async_task)
+{
+  int irq = rt_irq_disable();
+
+  struct pi_cluster_conf *conf = (struct pi_cluster_conf *)cluster_dev->config;
+  int cid = conf->id;
+
+  cluster_dev->data = (void *)&__rt_fc_cluster_data[cid];
+
+  __rt_task_init(async_task);
+
+  if (__rt_cluster_mount(&__rt_fc_cluster_data[cid], conf->id, 0, async_task))
+  {
+    rt_irq_restore(irq);
+    return -1;
+  }
+
+  rt_irq_restore(irq);
+
+  return 0;
+}
+
+
+
 int pi_cluster_open(struct pi_device *cluster_dev)
 {
   int irq = rt_irq_disable();
@@ -365,12 +705,55 @@ int pi_cluster_open(struct pi_device *cluster_dev)
 
 
 
+void pi_cluster_preload(struct pi_device *cluster_dev, pi_cluster_preload_t *preload, void *ext, void *loc, int size)
+{
+  struct pi_cluster_conf *conf = (struct pi_cluster_conf *)cluster_dev->config;
+  rt_fc_cluster_data_t *cluster = &__rt_fc_cluster_data[conf->id];
+
+  int irq = rt_irq_disable();
+
+  preload->ext = ext;
+  preload->loc = loc;
+  preload->size = size;
+  preload->next = cluster->first_preload;
+  cluster->first_preload = preload;
+
+  rt_irq_restore(irq);
+}
+
+
+
+void pi_cluster_preload_clear(struct pi_device *cluster_dev)
+{
+  struct pi_cluster_conf *conf = (struct pi_cluster_conf *)cluster_dev->config;
+  __rt_fc_cluster_data[conf->id].first_preload = NULL;
+}
+
+
+
 
 int pi_cluster_close(struct pi_device *cluster_dev)
 {
   rt_fc_cluster_data_t *data = (rt_fc_cluster_data_t *)cluster_dev->data;
+  __rt_cluster_idle_t *idle = &__rt_cluster_idle[data->cid];
+
+  int irq = rt_irq_disable();
+
+  // A pending idle timer will see the policy is disabled and stop
+  idle->mode = PI_CLUSTER_IDLE_NONE;
 
-  __rt_cluster_unmount(data->cid, 0, NULL);
+  // Restart the clock of a gated cluster so that the teardown done by the
+  // unmount only happens once, on a running FLL
+  if (idle->state == RT_CLUSTER_IDLE_GATED)
+    __rt_cluster_clock_gate(0);
+
+  // Nothing to do if the idle policy already powered it down
+  if (idle->state != RT_CLUSTER_IDLE_OFF)
+    __rt_cluster_unmount(data->cid, 0, NULL);
+
+  idle->state = RT_CLUSTER_IDLE_ACTIVE;
+
+  rt_irq_restore(irq);
 
   return 0;
 }
@@ -62,21 +62,8 @@ void cluster_irq_handler(void *arg)
 }
 #endif
 
-int pi_cluster_send_task_to_cl_async(struct pi_device *device, struct pi_cluster_task *task, pi_task_t *async_task)
+static int __rt_cluster_task_stacks_alloc(rt_fc_cluster_data_t *data, struct pi_cluster_task *task)
 {
-  rt_fc_cluster_data_t *data = (rt_fc_cluster_data_t *)device->data;
-
-  int lock = __rt_cluster_lock(data);
-
-  __rt_task_init(async_task);
-  
-  task->implem.pending = 1;
-
-  rt_cluster_call_pool_t *cl_data = data->pool;
-
-  if (task->nb_cores == 0)
-    task->nb_cores = pi_cl_cluster_nb_cores();
-
   if (task->stacks == NULL)
   {
     if (task->stack_size == 0)
@@ -99,18 +86,20 @@ int pi_cluster_send_task_to_cl_async(struct pi_device *device, struct pi_cluster
       data->stacks = rt_user_alloc(rt_alloc_l1(data->cid), stacks_size);
 
       if (data->stacks == NULL)
-        goto error;
+        return -1;
     }
 
     task->stacks = data->stacks;
   }
 
-  task->completion_callback = async_task;
-#ifdef ARCHI_HAS_CC
-  task->implem.core_mask = (1<<(task->nb_cores-1)) - 1;
-#else
-  task->implem.core_mask = (1<<task->nb_cores) - 1;
-#endif
+  return 0;
+}
+
+
+
+static void __rt_cluster_task_push(rt_fc_cluster_data_t *data, struct pi_cluster_task *task)
+{
+  rt_cluster_call_pool_t *cl_data = data->pool;
 
   task->next = NULL;
 
@@ -134,6 +123,87 @@ int pi_cluster_send_task_to_cl_async(struct pi_device *device, struct pi_cluster
 
   rt_compiler_barrier();
   eu_evt_trig(eu_evt_trig_cluster_addr(data->cid, RT_CLUSTER_CALL_EVT), 0);
+}
+
+
+
+void __rt_cluster_push_pending_tasks(rt_fc_cluster_data_t *data)
+{
+  struct pi_cluster_task *task = data->first_pending_task;
+
+  data->first_pending_task = NULL;
+  data->last_pending_task = NULL;
+
+  while (task)
+  {
+    struct pi_cluster_task *next = task->next;
+
+    if (__rt_cluster_task_stacks_alloc(data, task))
+    {
+      // The error can not be returned anymore to the caller as the task
+      // was accepted while the cluster was mounting. Just terminate it
+      // so that nobody is blocked on it.
+      rt_warning("Failed to allocate stacks for queued cluster task (task: %p)\n", task);
+      task->implem.pending = 0;
+      __rt_event_handle_end_of_task(task->completion_callback);
+    }
+    else
+    {
+      __rt_cluster_task_push(data, task);
+    }
+
+    task = next;
+  }
+}
+
+
+
+int pi_cluster_send_task_to_cl_async(struct pi_device *device, struct pi_cluster_task *task, pi_task_t *async_task)
+{
+  rt_fc_cluster_data_t *data = (rt_fc_cluster_data_t *)device->data;
+
+  int lock = __rt_cluster_lock(data);
+
+  __rt_task_init(async_task);
+  
+  task->implem.pending = 1;
+
+  if (task->nb_cores == 0)
+    task->nb_cores = pi_cl_cluster_nb_cores();
+
+  task->completion_callback = async_task;
+#ifdef ARCHI_HAS_CC
+  task->implem.core_mask = (1<<(task->nb_cores-1)) - 1;
+#else
+  task->implem.core_mask = (1<<task->nb_cores) - 1;
+#endif
+
+  // Wake-up the cluster in case it was switched off by the idle policy. This
+  // may start a new mount, in which case the task is queued below.
+  __rt_cluster_idle_activity(data);
+
+  if (data->mount_pending)
+  {
+    // The cluster is still being mounted, its L1 can not be accessed yet.
+    // Keep the task on FC side, it will be pushed once the mount is done.
+    task->next = NULL;
+
+    if (data->last_pending_task)
+      data->last_pending_task->next = task;
+    else
+      data->first_pending_task = task;
+
+    data->last_pending_task = task;
+
+    __rt_cluster_unlock(data, lock);
+
+    return 0;
+  }
+
+  if (__rt_cluster_task_stacks_alloc(data, task))
+    goto error;
+
+  __rt_cluster_task_push(data, task);
 
   __rt_cluster_unlock(data, lock);
 
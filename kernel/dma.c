@@ -0,0 +1,610 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* 
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include "rt/rt_api.h"
+
+#if defined(MCHAN_VERSION) && MCHAN_VERSION >= 6
+
+/*
+ * Per-core lists of transfers with a completion callback. The end of
+ * transfer event only goes to the core which pushed the transfer, so each
+ * list is only filled and executed by its own core and needs no lock.
+ */
+
+RT_L1_TINY_DATA rt_dma_cb_t *__rt_dma_cb_first[ARCHI_CLUSTER_NB_PE];
+RT_L1_TINY_DATA rt_dma_cb_t *__rt_dma_cb_last[ARCHI_CLUSTER_NB_PE];
+
+
+static inline unsigned int __rt_dma_status()
+{
+#if MCHAN_VERSION >= 7
+  return DMA_READ(MCHAN_STATUS_OFFSET);
+#else
+  return DMA_READ(PLP_DMA_STATUS_OFFSET);
+#endif
+}
+
+static void __rt_dma_cb_enqueue(rt_dma_cb_t *copy)
+{
+  int core = rt_core_id();
+
+  copy->next = NULL;
+
+  if (__rt_dma_cb_first[core])
+    __rt_dma_cb_last[core]->next = copy;
+  else
+    __rt_dma_cb_first[core] = copy;
+
+  __rt_dma_cb_last[core] = copy;
+}
+
+rt_dma_cb_t *rt_dma_cb(rt_dma_cb_t *copy, void (*callback)(void *), void *arg)
+{
+  copy->callback = callback;
+  copy->arg = arg;
+  return copy;
+}
+
+void rt_dma_memcpy_cb(unsigned int ext, unsigned int loc, unsigned short size, rt_dma_dir_e dir, rt_dma_cb_t *copy)
+{
+  rt_dma_memcpy(ext, loc, size, dir, 0, &copy->copy);
+  __rt_dma_cb_enqueue(copy);
+}
+
+void rt_dma_memcpy_2d_cb(unsigned int ext, unsigned int loc, unsigned short size, unsigned short stride, unsigned short length, rt_dma_dir_e dir, rt_dma_cb_t *copy)
+{
+  rt_dma_memcpy_2d(ext, loc, size, stride, length, dir, 0, &copy->copy);
+  __rt_dma_cb_enqueue(copy);
+}
+
+int rt_dma_cb_process()
+{
+  int core = rt_core_id();
+  int nb_done = 0;
+
+  rt_dma_cb_t *prev = NULL;
+  rt_dma_cb_t *current = __rt_dma_cb_first[core];
+  unsigned int status = __rt_dma_status();
+
+  while (current)
+  {
+    rt_dma_cb_t *next = current->next;
+
+    if (status & (1<<current->copy.id))
+    {
+      prev = current;
+      current = next;
+      continue;
+    }
+
+    // Transfer is finished, remove it from the list and release its counter
+    if (prev)
+      prev->next = next;
+    else
+      __rt_dma_cb_first[core] = next;
+
+    if (next == NULL)
+      __rt_dma_cb_last[core] = prev;
+
+    plp_dma_counter_free(current->copy.id);
+
+    // The callback can enqueue new transfers, e.g. to prefetch the next
+    // buffer
+    nb_done++;
+    if (current->callback)
+      current->callback(current->arg);
+
+    // The list may have been modified by the callback, start again
+    prev = NULL;
+    current = __rt_dma_cb_first[core];
+    status = __rt_dma_status();
+  }
+
+  return nb_done;
+}
+
+int rt_dma_cb_wait_any()
+{
+  int nb_done;
+
+  // The DMA event is latched by the event unit, so a transfer finishing
+  // between the check and the wait is not missed
+  while ((nb_done = rt_dma_cb_process()) == 0)
+  {
+    if (*(rt_dma_cb_t * volatile *)&__rt_dma_cb_first[rt_core_id()] == NULL)
+      return 0;
+
+    eu_evt_maskWaitAndClr(1<<ARCHI_CL_EVT_DMA0);
+  }
+
+  return nb_done;
+}
+
+void rt_dma_cb_wait_all()
+{
+  while (rt_dma_cb_wait_any())
+  {
+  }
+}
+
+
+
+/*
+ * Descriptors
+ * All the commands are computed when the descriptor is built, so that
+ * replaying it only consists in pushing them to the DMA.
+ */
+
+static inline unsigned int __rt_dma_desc_cmd(rt_dma_dir_e dir, unsigned int size, int is_2d)
+{
+  return plp_dma_getCmd(dir, size, is_2d ? PLP_DMA_2D : PLP_DMA_1D, PLP_DMA_TRIG_EVT, PLP_DMA_NO_TRIG_IRQ, PLP_DMA_SHARED);
+}
+
+static void __rt_dma_desc_chunks(rt_dma_desc_t *desc, uint32_t size, uint32_t chunk_size, uint32_t chunk_ext_inc, int is_2d, rt_dma_dir_e dir)
+{
+  desc->nb_chunks = (size + chunk_size - 1) / chunk_size;
+  desc->chunk_size = chunk_size;
+  desc->chunk_ext_inc = chunk_ext_inc;
+  desc->cmd = __rt_dma_desc_cmd(dir, chunk_size, is_2d);
+  desc->cmd_last = __rt_dma_desc_cmd(dir, size - (desc->nb_chunks - 1) * chunk_size, is_2d);
+  desc->nb_tiles = 1;
+  desc->tile_ext_stride = 0;
+  desc->tile_loc_stride = 0;
+  desc->next = NULL;
+}
+
+void rt_dma_desc_1d(rt_dma_desc_t *desc, unsigned int ext, unsigned int loc, uint32_t size, rt_dma_dir_e dir)
+{
+  desc->ext = ext;
+  desc->loc = loc;
+  desc->stride = 0;
+  desc->length = 0;
+
+  __rt_dma_desc_chunks(desc, size, RT_DMA_DESC_MAX_CHUNK, RT_DMA_DESC_MAX_CHUNK, 0, dir);
+}
+
+int rt_dma_desc_2d(rt_dma_desc_t *desc, unsigned int ext, unsigned int loc, uint32_t size, uint32_t stride, uint32_t length, rt_dma_dir_e dir)
+{
+  if (length == 0 || length > RT_DMA_DESC_MAX_CHUNK)
+    return -1;
+
+  desc->ext = ext;
+  desc->loc = loc;
+
+#if MCHAN_VERSION < 7
+  if (stride >= (1<<15))
+  {
+    // The stride does not fit the command, push one 1D command per line
+    desc->stride = 0;
+    desc->length = 0;
+    __rt_dma_desc_chunks(desc, size, length, stride, 0, dir);
+    return 0;
+  }
+#endif
+
+  // Split on line boundaries so that each command is a 2D transfer whose
+  // size fits the command
+  uint32_t nb_lines = RT_DMA_DESC_MAX_CHUNK / length;
+
+  desc->stride = stride;
+  desc->length = length;
+  __rt_dma_desc_chunks(desc, size, nb_lines * length, nb_lines * stride, 1, dir);
+
+  return 0;
+}
+
+void rt_dma_desc_3d(rt_dma_desc_t *desc, uint32_t nb_tiles, uint32_t tile_ext_stride, uint32_t tile_loc_stride)
+{
+  desc->nb_tiles = nb_tiles;
+  desc->tile_ext_stride = tile_ext_stride;
+  desc->tile_loc_stride = tile_loc_stride;
+}
+
+static void __rt_dma_desc_push(rt_dma_desc_t *desc, rt_dma_copy_t *copy)
+{
+#if MCHAN_VERSION >= 7
+  eu_mutex_lock_from_id(0);
+#endif
+
+  // All commands share the same counter
+  copy->id = plp_dma_counter_alloc();
+
+  // Prevent the compiler from pushing the transfer before all previous
+  // stores are done
+  __asm__ __volatile__ ("" : : : "memory");
+
+  for (; desc; desc = desc->next)
+  {
+    unsigned int tile_ext = desc->ext;
+    unsigned int tile_loc = desc->loc;
+
+    for (uint32_t tile=0; tile<desc->nb_tiles; tile++)
+    {
+      unsigned int ext = tile_ext;
+      unsigned int loc = tile_loc;
+
+      for (uint32_t chunk=0; chunk<desc->nb_chunks; chunk++)
+      {
+        unsigned int cmd = chunk == desc->nb_chunks - 1 ? desc->cmd_last : desc->cmd;
+
+        if (desc->length)
+          plp_dma_cmd_push_2d(cmd, loc, ext, desc->stride, desc->length);
+        else
+          plp_dma_cmd_push(cmd, loc, ext);
+
+        ext += desc->chunk_ext_inc;
+        loc += desc->chunk_size;
+      }
+
+      tile_ext += desc->tile_ext_stride;
+      tile_loc += desc->tile_loc_stride;
+    }
+  }
+
+#if MCHAN_VERSION >= 7
+  eu_mutex_unlock_from_id(0);
+#endif
+}
+
+void rt_dma_desc_push(rt_dma_desc_t *desc, rt_dma_copy_t *copy)
+{
+  __rt_dma_desc_push(desc, copy);
+}
+
+void rt_dma_desc_push_cb(rt_dma_desc_t *desc, rt_dma_cb_t *copy)
+{
+  __rt_dma_desc_push(desc, &copy->copy);
+  __rt_dma_cb_enqueue(copy);
+}
+
+
+
+/*
+ * Tiler
+ *
+ * The tensor is cut into tiles which are processed in row-major order. Each
+ * tile goes through one of the nb_buffers slots, so that while the cores are
+ * computing the tile of one slot, the inputs of the next tiles are being
+ * loaded and the outputs of the previous ones are being written back.
+ */
+
+typedef struct {
+  void *in;
+  void *out;
+  rt_dma_desc_t in_desc;
+  rt_dma_desc_t out_desc;
+  rt_dma_copy_t in_copy;
+  rt_dma_copy_t out_copy;
+  int in_pending;
+  int out_pending;
+} __rt_dma_tiler_slot_t;
+
+typedef struct {
+  rt_dma_tiler_conf_t *conf;
+  rt_dma_tile_t tile;
+  uint32_t stride;
+  uint32_t tile_height;
+  uint32_t tile_width;
+  uint32_t nb_tile_cols;
+  uint32_t nb_tiles;
+  int nb_buffers;
+  __rt_dma_tiler_slot_t *slots;
+} __rt_dma_tiler_t;
+
+static inline unsigned int __rt_dma_tiler_cycles()
+{
+#if defined(TIMER_VERSION) && TIMER_VERSION >= 2
+  return rt_perf_cl_read(RT_PERF_CYCLES);
+#else
+  return 0;
+#endif
+}
+
+static inline uint32_t __rt_dma_tiler_align(uint32_t size)
+{
+  return (size + 3) & ~3;
+}
+
+static int __rt_dma_tiler_shape(__rt_dma_tiler_t *tiler, int nb_streams)
+{
+  rt_dma_tiler_conf_t *conf = tiler->conf;
+  uint32_t elem_size = conf->elem_size;
+  uint32_t line_size = conf->width * elem_size;
+
+  // Keep the requested buffering depth as long as possible by shrinking
+  // the tiles first, and only reduce it when even the smallest tile does
+  // not fit.
+  for (int nb_buffers=conf->nb_buffers; nb_buffers>0; nb_buffers--)
+  {
+    uint32_t buffer_size = conf->l1_budget / (nb_buffers * nb_streams) & ~3;
+    uint32_t tile_height, tile_width;
+
+    if (conf->tile_height && conf->tile_width)
+    {
+      tile_height = conf->tile_height;
+      tile_width = conf->tile_width;
+      if (__rt_dma_tiler_align(tile_height * tile_width * elem_size) > buffer_size)
+        continue;
+    }
+    else if (line_size <= buffer_size && line_size <= RT_DMA_DESC_MAX_CHUNK)
+    {
+      tile_width = conf->width;
+      tile_height = buffer_size / line_size;
+      if (tile_height > conf->height)
+        tile_height = conf->height;
+    }
+    else
+    {
+      tile_height = 1;
+      tile_width = buffer_size;
+      if (tile_width > RT_DMA_DESC_MAX_CHUNK)
+        tile_width = RT_DMA_DESC_MAX_CHUNK;
+      tile_width /= elem_size;
+      if (tile_width == 0)
+        continue;
+    }
+
+    if (tile_width * elem_size > RT_DMA_DESC_MAX_CHUNK)
+      return -1;
+
+    tiler->tile_height = tile_height;
+    tiler->tile_width = tile_width;
+    tiler->nb_buffers = nb_buffers;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+static int __rt_dma_tiler_transfer(__rt_dma_tiler_t *tiler, uint32_t index, unsigned int ext, void *loc, rt_dma_desc_t *desc, rt_dma_copy_t *copy, rt_dma_dir_e dir)
+{
+  rt_dma_tiler_conf_t *conf = tiler->conf;
+  uint32_t elem_size = conf->elem_size;
+  uint32_t row = (index / tiler->nb_tile_cols) * tiler->tile_height;
+  uint32_t col = (index % tiler->nb_tile_cols) * tiler->tile_width;
+  uint32_t height = conf->height - row;
+  uint32_t width = conf->width - col;
+
+  if (height > tiler->tile_height)
+    height = tiler->tile_height;
+  if (width > tiler->tile_width)
+    width = tiler->tile_width;
+
+  ext += (row * tiler->stride + col) * elem_size;
+
+  // Lines are contiguous in external memory when the tile covers them
+  // entirely, in which case a 1D transfer is enough
+  if (width == tiler->stride || height == 1)
+    rt_dma_desc_1d(desc, ext, (unsigned int)loc, height * width * elem_size, dir);
+  else if (rt_dma_desc_2d(desc, ext, (unsigned int)loc, height * width * elem_size, tiler->stride * elem_size, width * elem_size, dir))
+    return -1;
+
+  rt_dma_desc_push(desc, copy);
+
+  return 0;
+}
+
+static int __rt_dma_tiler_load(__rt_dma_tiler_t *tiler, uint32_t index)
+{
+  __rt_dma_tiler_slot_t *slot = &tiler->slots[index % tiler->nb_buffers];
+  if (__rt_dma_tiler_transfer(tiler, index, tiler->conf->in, slot->in, &slot->in_desc, &slot->in_copy, RT_DMA_DIR_EXT2LOC))
+    return -1;
+  slot->in_pending = 1;
+  return 0;
+}
+
+static int __rt_dma_tiler_store(__rt_dma_tiler_t *tiler, uint32_t index)
+{
+  __rt_dma_tiler_slot_t *slot = &tiler->slots[index % tiler->nb_buffers];
+  if (__rt_dma_tiler_transfer(tiler, index, tiler->conf->out, slot->out, &slot->out_desc, &slot->out_copy, RT_DMA_DIR_LOC2EXT))
+    return -1;
+  slot->out_pending = 1;
+  return 0;
+}
+
+static void __rt_dma_tiler_entry(void *arg)
+{
+  __rt_dma_tiler_t *tiler = (__rt_dma_tiler_t *)arg;
+  tiler->conf->compute(&tiler->tile, tiler->conf->arg);
+}
+
+void rt_dma_tiler_conf_init(rt_dma_tiler_conf_t *conf)
+{
+  conf->in = 0;
+  conf->out = 0;
+  conf->height = 0;
+  conf->width = 0;
+  conf->stride = 0;
+  conf->elem_size = 1;
+  conf->tile_height = 0;
+  conf->tile_width = 0;
+  conf->l1_budget = 0;
+  conf->nb_buffers = 2;
+  conf->nb_cores = 0;
+  conf->compute = NULL;
+  conf->arg = NULL;
+}
+
+int rt_dma_tiler_run(rt_dma_tiler_conf_t *conf, rt_dma_tiler_stats_t *stats)
+{
+  __rt_dma_tiler_t tiler;
+  int nb_streams = (conf->in != 0) + (conf->out != 0);
+  unsigned int start = __rt_dma_tiler_cycles();
+  uint32_t compute_cycles = 0, dma_wait_cycles = 0;
+  unsigned int wait_start;
+  int err = 0;
+
+  if (nb_streams == 0 || conf->height == 0 || conf->width == 0 || conf->elem_size == 0 || conf->nb_buffers <= 0)
+    return -1;
+
+  tiler.conf = conf;
+  tiler.stride = conf->stride ? conf->stride : conf->width;
+
+  if (__rt_dma_tiler_shape(&tiler, nb_streams))
+    return -1;
+
+  int nb_buffers = tiler.nb_buffers;
+  uint32_t nb_tile_rows = (conf->height + tiler.tile_height - 1) / tiler.tile_height;
+  tiler.nb_tile_cols = (conf->width + tiler.tile_width - 1) / tiler.tile_width;
+  tiler.nb_tiles = nb_tile_rows * tiler.nb_tile_cols;
+
+  int slots_size = sizeof(__rt_dma_tiler_slot_t) * nb_buffers;
+  uint32_t buffer_size = __rt_dma_tiler_align(tiler.tile_height * tiler.tile_width * conf->elem_size);
+  int buffers_size = buffer_size * nb_buffers * nb_streams;
+
+  tiler.slots = rt_alloc(RT_ALLOC_CL_DATA + rt_cluster_id(), slots_size);
+  if (tiler.slots == NULL)
+    return -1;
+
+  char *buffers = rt_alloc(RT_ALLOC_CL_DATA + rt_cluster_id(), buffers_size);
+  if (buffers == NULL)
+  {
+    rt_free(RT_ALLOC_CL_DATA + rt_cluster_id(), tiler.slots, slots_size);
+    return -1;
+  }
+
+  char *buffer = buffers;
+  for (int i=0; i<nb_buffers; i++)
+  {
+    __rt_dma_tiler_slot_t *slot = &tiler.slots[i];
+    slot->in = NULL;
+    slot->out = NULL;
+    if (conf->in)
+    {
+      slot->in = buffer;
+      buffer += buffer_size;
+    }
+    if (conf->out)
+    {
+      slot->out = buffer;
+      buffer += buffer_size;
+    }
+    slot->in_pending = 0;
+    slot->out_pending = 0;
+  }
+
+  // Prefetch as many tiles as there are slots
+  if (conf->in)
+  {
+    for (uint32_t i=0; i<tiler.nb_tiles && i<(uint32_t)nb_buffers; i++)
+    {
+      if (__rt_dma_tiler_load(&tiler, i))
+      {
+        err = -1;
+        goto flush;
+      }
+    }
+  }
+
+  for (uint32_t i=0; i<tiler.nb_tiles; i++)
+  {
+    __rt_dma_tiler_slot_t *slot = &tiler.slots[i % nb_buffers];
+    rt_dma_tile_t *tile = &tiler.tile;
+    wait_start = __rt_dma_tiler_cycles();
+
+    // The input of this tile must be there and the output buffer must have
+    // been written back for the tile which used this slot before.
+    // The input is missing if its transfer could not be encoded, in which
+    // case the kernel must not run on stale data.
+    if (conf->in && !slot->in_pending)
+    {
+      err = -1;
+      break;
+    }
+    if (slot->in_pending)
+    {
+      rt_dma_wait(&slot->in_copy);
+      slot->in_pending = 0;
+    }
+    if (slot->out_pending)
+    {
+      rt_dma_wait(&slot->out_copy);
+      slot->out_pending = 0;
+    }
+
+    unsigned int compute_start = __rt_dma_tiler_cycles();
+    dma_wait_cycles += compute_start - wait_start;
+
+    tile->in = slot->in;
+    tile->out = slot->out;
+    tile->row = (i / tiler.nb_tile_cols) * tiler.tile_height;
+    tile->col = (i % tiler.nb_tile_cols) * tiler.tile_width;
+    tile->height = conf->height - tile->row;
+    tile->width = conf->width - tile->col;
+    if (tile->height > tiler.tile_height)
+      tile->height = tiler.tile_height;
+    if (tile->width > tiler.tile_width)
+      tile->width = tiler.tile_width;
+    tile->index = i;
+
+    rt_team_fork(conf->nb_cores, __rt_dma_tiler_entry, &tiler);
+
+    compute_cycles += __rt_dma_tiler_cycles() - compute_start;
+
+    if (conf->out && __rt_dma_tiler_store(&tiler, i))
+    {
+      err = -1;
+      break;
+    }
+
+    // The input buffer of this slot is free again, reuse it for the next
+    // tile going through this slot
+    if (conf->in && i + nb_buffers < tiler.nb_tiles && __rt_dma_tiler_load(&tiler, i + nb_buffers))
+    {
+      err = -1;
+      break;
+    }
+  }
+
+flush:
+  wait_start = __rt_dma_tiler_cycles();
+
+  // Also wait for the prefetched inputs which are not used in case of error,
+  // before the buffers are freed
+  for (int i=0; i<nb_buffers; i++)
+  {
+    if (tiler.slots[i].in_pending)
+      rt_dma_wait(&tiler.slots[i].in_copy);
+    if (tiler.slots[i].out_pending)
+      rt_dma_wait(&tiler.slots[i].out_copy);
+  }
+
+  unsigned int end = __rt_dma_tiler_cycles();
+  dma_wait_cycles += end - wait_start;
+
+  rt_free(RT_ALLOC_CL_DATA + rt_cluster_id(), buffers, buffers_size);
+  rt_free(RT_ALLOC_CL_DATA + rt_cluster_id(), tiler.slots, slots_size);
+
+  if (stats)
+  {
+    stats->nb_tiles = tiler.nb_tiles;
+    stats->tile_height = tiler.tile_height;
+    stats->tile_width = tiler.tile_width;
+    stats->nb_buffers = nb_buffers;
+    stats->total_cycles = end - start;
+    stats->compute_cycles = compute_cycles;
+    stats->dma_wait_cycles = dma_wait_cycles;
+  }
+
+  return err;
+}
+
+#endif
@@ -167,10 +167,15 @@ endif
 
 ifneq '$(cluster/version)' ''
 ifneq '$(event_unit/version)' '1'
-PULP_LIB_CL_SRCS_rt += kernel/sync_mc.c
+PULP_LIB_CL_SRCS_rt += kernel/sync_mc.c kernel/dma.c kernel/team.c
 endif
 endif
 
+# Use the software team barrier even if the cluster has a HW barrier
+ifeq '$(CONFIG_SW_TEAM_BARRIER)' '1'
+PULP_CFLAGS += -D__RT_SW_TEAM_BARRIER=1
+endif
+
 ifeq '$(pulp_chip_family)' 'pulpissimo'
 PULP_LIB_FC_SRCS_rt += kernel/pulpissimo/pulpissimo.c	
 endif
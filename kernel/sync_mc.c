@@ -52,11 +52,37 @@ static inline void __rt_cl_lock_set(rt_iclock_t *lock, int id, rt_iclock_cl_t *c
   ((rt_iclock_cl_t **)(lock + 1))[id] = cl_lock;
 }
 
+static inline int __rt_iclock_glob_size(int nb_cluster)
+{
+  return sizeof(rt_iclock_glob_t) + nb_cluster * sizeof(rt_iclock_cl_t *);
+}
+
+static void __rt_iclock_release(rt_iclock_t *lock, int nb_alloc)
+{
+  unsigned int mask = lock->cluster_mask;
+  int nb_cluster = __builtin_popcount(mask);
+
+  for (int i=0; i<nb_alloc; i++)
+  {
+    int cid = __FL1(mask);
+    mask &= ~(1<<cid);
+    rt_iclock_cl_t *cl_lock = __rt_cl_lock_get(lock, i);
+
+    // The first cluster is also holding the global state
+    if (i == 0)
+      rt_free(RT_ALLOC_CL_DATA+cid, cl_lock->glob, __rt_iclock_glob_size(nb_cluster));
+
+    rt_free(RT_ALLOC_CL_DATA+cid, cl_lock, sizeof(rt_iclock_cl_t));
+  }
+
+  rt_free(RT_ALLOC_FC_DATA, (void *)lock, sizeof(rt_iclock_t) + nb_cluster * sizeof(void *));
+}
+
 rt_iclock_t *rt_iclock_alloc(rt_iclock_conf_t *conf)
 {
   int id = 0;
   unsigned int mask = conf->cluster_mask;
-  unsigned int nb_cluster = __builtin_clb(mask);
+  unsigned int nb_cluster = __builtin_popcount(mask);
 
   // Allocate the global FC structure pointing to all per-cluster structures
   // The cluster structures pointers are put at the end of the global structure
@@ -71,7 +97,7 @@ rt_iclock_t *rt_iclock_alloc(rt_iclock_conf_t *conf)
 
   // Now allocate one cluster structure per active cluster in the cluster memory as each cluster will
   // use it for locking and unlocking
-  unsigned int lock_addr = 0;
+  rt_iclock_glob_t *glob = NULL;
   while (mask)
   {
     int cid = __FL1(mask);
@@ -80,14 +106,25 @@ rt_iclock_t *rt_iclock_alloc(rt_iclock_conf_t *conf)
     rt_iclock_cl_t *cl_lock = (rt_iclock_cl_t *)rt_alloc(RT_ALLOC_CL_DATA+cid, sizeof(rt_iclock_cl_t));
     if (cl_lock == NULL) goto error;
 
-    // The first cluster is providing the global lock and each cluster
-    // including first cluster is pointing to it
-    if (lock_addr == 0) {
-      cl_lock->tas = 0;
-      lock_addr = (unsigned int)&cl_lock->tas;
+    // The first cluster is providing the global state, including the queue of
+    // waiting clusters, and each cluster including first cluster is pointing to it.
+    // The queue never contains the owner, so one slot per cluster is enough
+    if (glob == NULL) {
+      glob = (rt_iclock_glob_t *)rt_alloc(RT_ALLOC_CL_DATA+cid, __rt_iclock_glob_size(nb_cluster));
+      if (glob == NULL)
+      {
+        rt_free(RT_ALLOC_CL_DATA+cid, cl_lock, sizeof(rt_iclock_cl_t));
+        goto error;
+      }
+      glob->tas = 0;
+      glob->locked = 0;
+      glob->head = 0;
+      glob->tail = 0;
+      glob->nb_slots = nb_cluster;
     }
-    cl_lock->addr = lock_addr;
-    cl_lock->cluster_mask = conf->cluster_mask;
+    cl_lock->glob = glob;
+    cl_lock->granted = 0;
+    cl_lock->cid = cid;
 
     __rt_cl_lock_set(lock, id, cl_lock);
 
@@ -98,51 +135,533 @@ rt_iclock_t *rt_iclock_alloc(rt_iclock_conf_t *conf)
 
 error:
   // In case of error, just roll back everything, in particular free all per-cluster descriptors
-  mask = conf->cluster_mask;
-  for (int i=0; i<id; i++)
+  __rt_iclock_release(lock, id);
+  return NULL;
+}
+
+static inline void __rt_icsync_tas_lock(unsigned int *tas)
+{
+  while (rt_tas_lock_32((unsigned int)tas) == -1)
   {
-    int cid = __FL1(mask);
-    mask &= ~(1<<cid);
-    rt_free(RT_ALLOC_CL_DATA+cid, __rt_cl_lock_get(lock, i), sizeof(rt_iclock_cl_t));
   }
-  rt_free(RT_ALLOC_FC_DATA, (void *)lock, lock_size);
-  return NULL;
+}
+
+static inline void __rt_icsync_tas_unlock(unsigned int *tas)
+{
+  rt_tas_unlock_32((unsigned int)tas, 0);
 }
 
 void rt_iclock_lock(rt_iclock_cl_t *lock)
 {
+  rt_iclock_glob_t *glob = lock->glob;
+
   // First lock the cluster so that only one core tries to acquire the soc lock
-  // to avoid too many accesses outside
+  // to avoid too many accesses outside. This also guarantees that a cluster
+  // appears at most once in the queue.
   eu_mutex_lock(eu_mutex_addr(0));
 
-  // The multi-clock resides inside one of the cluster. Just wait until we can get it
-  // The owner of the lock will broadcast the event to all clusters when unlocking
-  while (rt_tas_lock_32(lock->addr) == -1)
+  // The global state is only protected by the TAS lock for the few accesses
+  // needed to either take the lock or enqueue ourself
+  __rt_icsync_tas_lock(&glob->tas);
+
+  if (!glob->locked)
+  {
+    glob->locked = 1;
+    __rt_icsync_tas_unlock(&glob->tas);
+    return;
+  }
+
+  glob->queue[glob->tail] = lock;
+  glob->tail = glob->tail + 1 == glob->nb_slots ? 0 : glob->tail + 1;
+
+  __rt_icsync_tas_unlock(&glob->tas);
+
+  // Now sleep until the owner hands the lock over to us. The flag is in our
+  // own cluster memory so that checking it is cheap.
+  while (!lock->granted)
   {
     eu_evt_maskWaitAndClr(1<<RT_CL_SYNC_EVENT);
   }
 
+  lock->granted = 0;
 }
 
 void rt_iclock_unlock(rt_iclock_cl_t *lock)
 {
-  // First unlock the global lock
-  rt_tas_unlock_32(lock->addr, 0);
+  rt_iclock_glob_t *glob = lock->glob;
 
-  // Broadcast the event to wake-up waiting clusters
-  unsigned int mask = lock->cluster_mask;
+  __rt_icsync_tas_lock(&glob->tas);
+
+  if (glob->head == glob->tail)
+  {
+    // Nobody waiting, just release the lock
+    glob->locked = 0;
+  }
+  else
+  {
+    // Otherwise directly give the lock to the first waiting cluster, which
+    // is the only one woken-up
+    rt_iclock_cl_t *next = glob->queue[glob->head];
+    glob->head = glob->head + 1 == glob->nb_slots ? 0 : glob->head + 1;
+
+    next->granted = 1;
+    eu_evt_trig(eu_evt_trig_cluster_addr(next->cid, RT_CL_SYNC_EVENT), 0);
+  }
+
+  __rt_icsync_tas_unlock(&glob->tas);
+
+  // And unlock the local cores
+  eu_mutex_unlock(eu_mutex_addr(0));
+}
+
+void rt_iclock_free(rt_iclock_t *lock)
+{
+  __rt_iclock_release(lock, __builtin_popcount(lock->cluster_mask));
+}
+
+
+
+void rt_icbarrier_conf_init(rt_icbarrier_conf_t *conf)
+{
+  conf->cluster_mask = (1<<rt_nb_cluster()) - 1;
+}
+
+static inline rt_icbarrier_cl_t *__rt_cl_barrier_get(rt_icbarrier_t *barrier, int id)
+{
+  return ((rt_icbarrier_cl_t **)(barrier + 1))[id];
+}
+
+static inline void __rt_cl_barrier_set(rt_icbarrier_t *barrier, int id, rt_icbarrier_cl_t *cl_barrier)
+{
+  ((rt_icbarrier_cl_t **)(barrier + 1))[id] = cl_barrier;
+}
+
+rt_icbarrier_cl_t *rt_icbarrier_cl(rt_icbarrier_t *barrier)
+{
+  unsigned int mask = barrier->cluster_mask;
+  int my_cid = rt_cluster_id();
+  int id;
+
+  for (id=0; ; id++)
+  {
+    int cid = __FL1(mask);
+    if (cid == my_cid) break;
+    mask &= ~(1<<cid);
+  }
+
+  return __rt_cl_barrier_get(barrier, id);
+}
+
+static inline int __rt_icbarrier_glob_size(int nb_cluster)
+{
+  return sizeof(rt_icbarrier_glob_t) + nb_cluster * sizeof(rt_icbarrier_cl_t *);
+}
+
+static void __rt_icbarrier_release(rt_icbarrier_t *barrier, int nb_alloc)
+{
+  unsigned int mask = barrier->cluster_mask;
+  int nb_cluster = __builtin_popcount(mask);
+
+  for (int i=0; i<nb_alloc; i++)
+  {
+    int cid = __FL1(mask);
+    mask &= ~(1<<cid);
+    rt_icbarrier_cl_t *cl_barrier = __rt_cl_barrier_get(barrier, i);
+
+    if (i == 0)
+      rt_free(RT_ALLOC_CL_DATA+cid, cl_barrier->glob, __rt_icbarrier_glob_size(nb_cluster));
+
+    rt_free(RT_ALLOC_CL_DATA+cid, cl_barrier, sizeof(rt_icbarrier_cl_t));
+  }
+
+  rt_free(RT_ALLOC_FC_DATA, (void *)barrier, sizeof(rt_icbarrier_t) + nb_cluster * sizeof(void *));
+}
+
+rt_icbarrier_t *rt_icbarrier_alloc(rt_icbarrier_conf_t *conf)
+{
+  int id = 0;
+  unsigned int mask = conf->cluster_mask;
+  unsigned int nb_cluster = __builtin_popcount(mask);
+
+  int barrier_size = sizeof(rt_icbarrier_t) + nb_cluster * sizeof(void *);
+  rt_icbarrier_t *barrier = (rt_icbarrier_t *)rt_alloc(RT_ALLOC_FC_DATA, barrier_size);
+  if (barrier == NULL) return NULL;
+
+  memset((void *)barrier, 0, barrier_size);
+
+  barrier->cluster_mask = mask;
+
+  // Same as for locks, the global state is in the first cluster and each
+  // cluster has its own structure in its memory, on which it is notified
+  rt_icbarrier_glob_t *glob = NULL;
   while (mask)
   {
     int cid = __FL1(mask);
     mask &= ~(1<<cid);
+
+    rt_icbarrier_cl_t *cl_barrier = (rt_icbarrier_cl_t *)rt_alloc(RT_ALLOC_CL_DATA+cid, sizeof(rt_icbarrier_cl_t));
+    if (cl_barrier == NULL) goto error;
+
+    if (glob == NULL) {
+      glob = (rt_icbarrier_glob_t *)rt_alloc(RT_ALLOC_CL_DATA+cid, __rt_icbarrier_glob_size(nb_cluster));
+      if (glob == NULL)
+      {
+        rt_free(RT_ALLOC_CL_DATA+cid, cl_barrier, sizeof(rt_icbarrier_cl_t));
+        goto error;
+      }
+      glob->tas = 0;
+      glob->nb_clusters = nb_cluster;
+      glob->count = 0;
+    }
+
+    glob->clusters[id] = cl_barrier;
+
+    cl_barrier->glob = glob;
+    cl_barrier->sense = 0;
+    cl_barrier->release = 0;
+    cl_barrier->cid = cid;
+
+    __rt_cl_barrier_set(barrier, id, cl_barrier);
+
+    id++;
+  }
+
+  return barrier;
+
+error:
+  __rt_icbarrier_release(barrier, id);
+  return NULL;
+}
+
+void rt_icbarrier_free(rt_icbarrier_t *barrier)
+{
+  __rt_icbarrier_release(barrier, __builtin_popcount(barrier->cluster_mask));
+}
+
+static inline int __rt_icbarrier_reduce_int(int a, int b, pi_cl_team_reduce_op_e op)
+{
+  switch (op)
+  {
+    case PI_CL_TEAM_REDUCE_MIN: return a < b ? a : b;
+    case PI_CL_TEAM_REDUCE_MAX: return a > b ? a : b;
+    default: return a + b;
+  }
+}
+
+static inline float __rt_icbarrier_reduce_float(float a, float b, pi_cl_team_reduce_op_e op)
+{
+  switch (op)
+  {
+    case PI_CL_TEAM_REDUCE_MIN: return a < b ? a : b;
+    case PI_CL_TEAM_REDUCE_MAX: return a > b ? a : b;
+    default: return a + b;
+  }
+}
+
+// Global step of the barrier, executed by only one core per cluster.
+// is_float is -1 for a simple barrier, otherwise the value of the cluster
+// is combined with the other ones and the result is stored in every cluster.
+static void __rt_icbarrier_global(rt_icbarrier_cl_t *barrier, int is_float, pi_cl_team_reduce_op_e op)
+{
+  rt_icbarrier_glob_t *glob = barrier->glob;
+
+  // Sense reversal, the release flag of the cluster will be set to this value
+  // when all clusters have arrived
+  unsigned int sense = barrier->sense ^ 1;
+  barrier->sense = sense;
+
+  __rt_icsync_tas_lock(&glob->tas);
+
+  if (is_float != -1)
+  {
+    if (glob->count == 0)
+      glob->value = barrier->value;
+    else if (is_float)
+      glob->value.f = __rt_icbarrier_reduce_float(glob->value.f, barrier->value.f, op);
+    else
+      glob->value.i = __rt_icbarrier_reduce_int(glob->value.i, barrier->value.i, op);
+  }
+
+  int last = ++glob->count == glob->nb_clusters;
+
+  // The result is kept locally as released clusters may already enter the
+  // next barrier and update the global state while we notify the others
+  rt_icbarrier_value_t result;
+  if (last)
+  {
+    glob->count = 0;
+    result = glob->value;
+  }
+
+  __rt_icsync_tas_unlock(&glob->tas);
+
+  if (last)
+  {
+    // Notify each cluster only once, by writing directly into its memory so that
+    // the woken-up cluster does not need to access the global state
+    for (int i=0; i<glob->nb_clusters; i++)
+    {
+      rt_icbarrier_cl_t *cl_barrier = glob->clusters[i];
+      if (is_float != -1)
+        cl_barrier->value = result;
+      cl_barrier->release = sense;
+      if (cl_barrier != barrier)
+        eu_evt_trig(eu_evt_trig_cluster_addr(cl_barrier->cid, RT_CL_SYNC_EVENT), 0);
+    }
+  }
+  else
+  {
+    while (barrier->release != sense)
+    {
+      eu_evt_maskWaitAndClr(1<<RT_CL_SYNC_EVENT);
+    }
+  }
+}
+
+void rt_icbarrier_wait(rt_icbarrier_cl_t *barrier)
+{
+  // Local step with the HW barrier, then one core per cluster does the global
+  // step while the other ones are sleeping on the second local barrier
+  rt_team_barrier();
+
+  if (rt_core_id() == 0)
+    __rt_icbarrier_global(barrier, -1, PI_CL_TEAM_REDUCE_ADD);
+
+  rt_team_barrier();
+}
+
+#if defined(EU_VERSION) && EU_VERSION >= 3
+
+int rt_icbarrier_reduce_int(rt_icbarrier_cl_t *barrier, int value, pi_cl_team_reduce_op_e op)
+{
+  // The local reduction also synchronizes the cluster cores
+  value = pi_cl_team_reduce_int(value, op);
+
+  if (rt_core_id() == 0)
+  {
+    barrier->value.i = value;
+    __rt_icbarrier_global(barrier, 0, op);
+  }
+
+  rt_team_barrier();
+
+  return barrier->value.i;
+}
+
+float rt_icbarrier_reduce_float(rt_icbarrier_cl_t *barrier, float value, pi_cl_team_reduce_op_e op)
+{
+  value = pi_cl_team_reduce_float(value, op);
+
+  if (rt_core_id() == 0)
+  {
+    barrier->value.f = value;
+    __rt_icbarrier_global(barrier, 1, op);
+  }
+
+  rt_team_barrier();
+
+  return barrier->value.f;
+}
+
+#endif
+
+
+
+void rt_icqueue_conf_init(rt_icqueue_conf_t *conf)
+{
+  conf->producer = RT_ICQUEUE_FC;
+  conf->consumer = 0;
+  conf->nb_slots = 4;
+}
+
+static inline int __rt_icqueue_alloc_flags(int cid)
+{
+  return cid == RT_ICQUEUE_FC ? RT_ALLOC_FC_DATA : RT_ALLOC_CL_DATA+cid;
+}
+
+// One slot is always left empty to distinguish a full queue from an empty one
+static inline unsigned int __rt_icqueue_slots_size(rt_icqueue_t *queue)
+{
+  return (queue->nb_slots + 1) * sizeof(rt_icqueue_msg_t);
+}
+
+void rt_icqueue_free(rt_icqueue_t *queue)
+{
+  if (queue->prod)
+    rt_free(__rt_icqueue_alloc_flags(queue->prod_cid), queue->prod, sizeof(rt_icqueue_prod_t));
+
+  if (queue->cons)
+  {
+    if (queue->cons->slots)
+      rt_free(__rt_icqueue_alloc_flags(queue->cons_cid), queue->cons->slots, __rt_icqueue_slots_size(queue));
+    rt_free(__rt_icqueue_alloc_flags(queue->cons_cid), queue->cons, sizeof(rt_icqueue_cons_t));
+  }
+
+  rt_free(RT_ALLOC_FC_DATA, (void *)queue, sizeof(rt_icqueue_t));
+}
+
+rt_icqueue_t *rt_icqueue_alloc(rt_icqueue_conf_t *conf)
+{
+  rt_icqueue_t *queue = (rt_icqueue_t *)rt_alloc(RT_ALLOC_FC_DATA, sizeof(rt_icqueue_t));
+  if (queue == NULL) return NULL;
+
+  queue->prod_cid = conf->producer;
+  queue->cons_cid = conf->consumer;
+  queue->nb_slots = conf->nb_slots;
+
+  // Each endpoint is allocated in the memory of the one using it so that
+  // waiting for the queue only involves local accesses
+  queue->prod = (rt_icqueue_prod_t *)rt_alloc(__rt_icqueue_alloc_flags(conf->producer), sizeof(rt_icqueue_prod_t));
+  queue->cons = (rt_icqueue_cons_t *)rt_alloc(__rt_icqueue_alloc_flags(conf->consumer), sizeof(rt_icqueue_cons_t));
+  if (queue->cons)
+    queue->cons->slots = (rt_icqueue_msg_t *)rt_alloc(__rt_icqueue_alloc_flags(conf->consumer), __rt_icqueue_slots_size(queue));
+
+  if (queue->prod == NULL || queue->cons == NULL || queue->cons->slots == NULL)
+  {
+    rt_icqueue_free(queue);
+    return NULL;
+  }
+
+  rt_icqueue_prod_t *prod = queue->prod;
+  rt_icqueue_cons_t *cons = queue->cons;
+
+  prod->slots = cons->slots;
+  prod->cons = cons;
+  prod->nb_slots = queue->nb_slots + 1;
+  prod->tail = 0;
+  prod->head = 0;
+  prod->cons_cid = conf->consumer;
+
+  cons->prod = prod;
+  cons->nb_slots = queue->nb_slots + 1;
+  cons->tail = 0;
+  cons->head = 0;
+  cons->prod_cid = conf->producer;
+
+  return queue;
+}
+
+static inline void __rt_icqueue_notify(int cid)
+{
+  if (cid != RT_ICQUEUE_FC)
+  {
     eu_evt_trig(eu_evt_trig_cluster_addr(cid, RT_CL_SYNC_EVENT), 0);
   }
+  else
+  {
+#if defined(ARCHI_HAS_FC)
+    // The fabric controller is woken up through the remote enqueue interrupt,
+    // whose handler ignores the notification as no event is posted
+#ifdef ITC_VERSION
+    hal_itc_status_set(1<<RT_FC_ENQUEUE_EVENT);
+#else
+    eu_evt_trig(eu_evt_trig_fc_addr(RT_FC_ENQUEUE_EVENT), 0);
+#endif
+#endif
+  }
+}
 
-  // And unlock the local cores
-  eu_mutex_unlock(eu_mutex_addr(0));
+// On the fabric controller, interrupts are kept disabled between the queue
+// check and the wait, so that the notification cannot be handled before the
+// core goes to sleep
+static inline int __rt_icqueue_wait_start()
+{
+  if (rt_is_fc())
+    return rt_irq_disable();
+  return 0;
 }
 
-void rt_iclock_free(rt_iclock_t *lock)
+static inline void __rt_icqueue_wait_end(int irq)
 {
+  if (rt_is_fc())
+    rt_irq_restore(irq);
+}
+
+static inline void __rt_icqueue_wait()
+{
+  if (rt_is_fc())
+  {
+    // Keep executing the fabric controller events while waiting for the
+    // cluster
+    __rt_event_execute(NULL, 1);
+  }
+  else
+  {
+    eu_evt_maskWaitAndClr(1<<RT_CL_SYNC_EVENT);
+  }
+}
+
+int rt_icqueue_try_push(rt_icqueue_prod_t *prod, void *buffer, unsigned int size)
+{
+  unsigned int tail = prod->tail;
+  unsigned int next = tail + 1 == prod->nb_slots ? 0 : tail + 1;
+
+  if (next == prod->head)
+    return -1;
+
+  // The message must be written before the tail as the consumer may read it
+  // as soon as it sees the new tail
+  prod->slots[tail].buffer = buffer;
+  prod->slots[tail].size = size;
+  rt_compiler_barrier();
+  prod->tail = next;
+  prod->cons->tail = next;
+
+  __rt_icqueue_notify(prod->cons_cid);
+
+  return 0;
+}
+
+void rt_icqueue_push(rt_icqueue_prod_t *prod, void *buffer, unsigned int size)
+{
+  int irq = __rt_icqueue_wait_start();
+
+  while (rt_icqueue_try_push(prod, buffer, size))
+  {
+    __rt_icqueue_wait();
+  }
+
+  __rt_icqueue_wait_end(irq);
+}
+
+void *rt_icqueue_try_pop(rt_icqueue_cons_t *cons, unsigned int *size)
+{
+  unsigned int head = cons->head;
+
+  if (head == cons->tail)
+    return NULL;
+
+  // The message must only be read after the tail and released before the
+  // head is updated, as the producer may then overwrite it
+  rt_compiler_barrier();
+
+  void *buffer = cons->slots[head].buffer;
+  if (size)
+    *size = cons->slots[head].size;
+
+  rt_compiler_barrier();
+
+  head = head + 1 == cons->nb_slots ? 0 : head + 1;
+  cons->head = head;
+  cons->prod->head = head;
+
+  // Wake-up the producer in case it was waiting for a free slot
+  __rt_icqueue_notify(cons->prod_cid);
+
+  return buffer;
+}
+
+void *rt_icqueue_pop(rt_icqueue_cons_t *cons, unsigned int *size)
+{
+  void *buffer;
+  int irq = __rt_icqueue_wait_start();
+
+  while ((buffer = rt_icqueue_try_pop(cons, size)) == NULL)
+  {
+    __rt_icqueue_wait();
+  }
+
+  __rt_icqueue_wait_end(irq);
 
+  return buffer;
 }
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* 
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#include "rt/rt_api.h"
+
+#if defined(EU_VERSION) && EU_VERSION >= 3
+
+// Partial data published by each core of the team for the reduction
+RT_L1_DATA void *__rt_team_reduce_data[ARCHI_CLUSTER_NB_PE];
+
+// Result broadcasted by core 0 for scalar reductions
+RT_L1_DATA static union {
+  int i;
+  float f;
+} __rt_team_reduce_result;
+
+
+// Combine the partial data in a binary tree. At each level, the cores whose
+// identifier is a multiple of twice the level distance combine the data of
+// their partner. Levels are separated by barriers so that partners are done
+// with the previous level. The result is in the data of core 0, and the other
+// cores must not release their data before a final barrier is executed.
+static void __rt_team_reduce_tree(void *data, void (*combine)(void *dst, void *src, void *arg), void *arg)
+{
+  int core_id = rt_core_id();
+  int nb_cores = rt_team_nb_cores();
+
+  __rt_team_reduce_data[core_id] = data;
+
+  for (int dist=1; dist<nb_cores; dist<<=1)
+  {
+    rt_team_barrier();
+
+    if ((core_id & ((dist<<1) - 1)) == 0 && core_id + dist < nb_cores)
+      combine(data, __rt_team_reduce_data[core_id + dist], arg);
+  }
+}
+
+void pi_cl_team_reduce(void *data, void (*combine)(void *dst, void *src, void *arg), void *arg)
+{
+  __rt_team_reduce_tree(data, combine, arg);
+  rt_team_barrier();
+}
+
+static void __rt_team_reduce_int(void *dst, void *src, void *arg)
+{
+  int *d = (int *)dst;
+  int s = *(int *)src;
+
+  switch ((int)arg)
+  {
+    case PI_CL_TEAM_REDUCE_ADD: *d += s; break;
+    case PI_CL_TEAM_REDUCE_MIN: if (s < *d) *d = s; break;
+    case PI_CL_TEAM_REDUCE_MAX: if (s > *d) *d = s; break;
+  }
+}
+
+static void __rt_team_reduce_float(void *dst, void *src, void *arg)
+{
+  float *d = (float *)dst;
+  float s = *(float *)src;
+
+  switch ((int)arg)
+  {
+    case PI_CL_TEAM_REDUCE_ADD: *d += s; break;
+    case PI_CL_TEAM_REDUCE_MIN: if (s < *d) *d = s; break;
+    case PI_CL_TEAM_REDUCE_MAX: if (s > *d) *d = s; break;
+  }
+}
+
+int pi_cl_team_reduce_int(int value, pi_cl_team_reduce_op_e op)
+{
+  __rt_team_reduce_tree(&value, __rt_team_reduce_int, (void *)op);
+
+  // The final barrier also broadcasts the result. Core 0 only overwrites it
+  // after the first barrier of the next reduction, when all cores have read it.
+  if (rt_core_id() == 0)
+    __rt_team_reduce_result.i = value;
+
+  rt_team_barrier();
+
+  return __rt_team_reduce_result.i;
+}
+
+float pi_cl_team_reduce_float(float value, pi_cl_team_reduce_op_e op)
+{
+  __rt_team_reduce_tree(&value, __rt_team_reduce_float, (void *)op);
+
+  if (rt_core_id() == 0)
+    __rt_team_reduce_result.f = value;
+
+  rt_team_barrier();
+
+  return __rt_team_reduce_result.f;
+}
+
+/*
+ * Parallel loops
+ */
+
+typedef struct {
+  pi_cl_team_loop_t *loops;
+  int nb_loops;
+  int nb_cores;
+} __rt_team_loop_chain_t;
+
+static void __rt_team_loop_static(pi_cl_team_loop_t *loop, int core_id, int nb_cores)
+{
+  int start = loop->start;
+  int end = loop->end;
+  int chunk = loop->chunk;
+
+  if (end <= start)
+    return;
+
+  if (chunk <= 0)
+  {
+    // One block per core, the first cores get one more iteration when
+    // iterations cannot be evenly divided
+    int nb_iter = end - start;
+    int size = nb_iter / nb_cores;
+    int remain = nb_iter - size * nb_cores;
+
+    if (core_id < remain)
+    {
+      size++;
+      start += size * core_id;
+    }
+    else
+    {
+      start += size * core_id + remain;
+    }
+
+    if (size)
+      loop->fn(start, start + size, loop->arg);
+  }
+  else
+  {
+    for (int first=start + chunk*core_id; first<end; first+=chunk*nb_cores)
+    {
+      int last = first + chunk;
+      if (last > end)
+        last = end;
+      loop->fn(first, last, loop->arg);
+    }
+  }
+}
+
+static void __rt_team_loop_dynamic(pi_cl_team_loop_t *loop)
+{
+  int chunk = loop->chunk > 0 ? loop->chunk : 1;
+
+#ifdef ARCHI_EU_HAS_DYNLOOP
+  // The first core entering the loop configures the unit, the other ones
+  // directly get chunks or see that the loop is already over
+  unsigned int state = eu_loop_getState(eu_loop_addr(0));
+  if (state == EU_LOOP_SKIP)
+    return;
+
+  if (state != EU_LOOP_DONE)
+  {
+    eu_loop_setStart(eu_loop_addr(0), loop->start);
+    eu_loop_setEnd(eu_loop_addr(0), loop->end);
+    eu_loop_setIncr(eu_loop_addr(0), 1);
+    eu_loop_setChunk(eu_loop_addr(0), chunk);
+  }
+
+  while(1)
+  {
+    int size = eu_loop_getChunk(eu_loop_addr(0));
+    int start = eu_loop_getStart(eu_loop_addr(0));
+    if (size == 0)
+      break;
+    loop->fn(start, start + size, loop->arg);
+  }
+#else
+  int end = loop->end;
+
+  while(1)
+  {
+    rt_team_critical_enter();
+    int first = loop->next;
+    loop->next = first + chunk;
+    rt_team_critical_exit();
+
+    if (first >= end)
+      break;
+
+    int last = first + chunk;
+    if (last > end)
+      last = end;
+
+    loop->fn(first, last, loop->arg);
+  }
+#endif
+}
+
+static void __rt_team_loop_entry(void *arg)
+{
+  __rt_team_loop_chain_t *chain = (__rt_team_loop_chain_t *)arg;
+  int core_id = rt_core_id();
+
+  for (int i=0; i<chain->nb_loops; i++)
+  {
+    pi_cl_team_loop_t *loop = &chain->loops[i];
+
+    if (loop->flags & PI_CL_TEAM_LOOP_DYNAMIC)
+      __rt_team_loop_dynamic(loop);
+    else
+      __rt_team_loop_static(loop, core_id, chain->nb_cores);
+
+    // The last loop is joined by the fork
+    if (i == chain->nb_loops - 1)
+      break;
+
+#ifdef ARCHI_EU_HAS_DYNLOOP
+    // There is only one HW loop unit, it must be released by all cores
+    // before the next dynamic loop can be configured
+    if (loop->flags & PI_CL_TEAM_LOOP_DYNAMIC)
+    {
+      rt_team_barrier();
+      continue;
+    }
+#endif
+
+    if (!(loop->flags & PI_CL_TEAM_LOOP_NOWAIT))
+      rt_team_barrier();
+  }
+}
+
+void pi_cl_team_parallel_for_chain(int nb_cores, pi_cl_team_loop_t *loops, int nb_loops)
+{
+  __rt_team_loop_chain_t chain;
+
+  // Each loop has its own counter so that cores can already get chunks of
+  // the next loop when the previous one is nowait
+  for (int i=0; i<nb_loops; i++)
+  {
+    loops[i].next = loops[i].start;
+  }
+
+  chain.loops = loops;
+  chain.nb_loops = nb_loops;
+  chain.nb_cores = nb_cores ? nb_cores : rt_team_nb_cores();
+
+  rt_team_fork(nb_cores, __rt_team_loop_entry, &chain);
+}
+
+void pi_cl_team_parallel_for(int nb_cores, int start, int end, int chunk, void (*fn)(int start, int end, void *arg), void *arg)
+{
+  pi_cl_team_loop_t loop;
+  pi_cl_team_loop_init(&loop, start, end, chunk, fn, arg, 0);
+  pi_cl_team_parallel_for_chain(nb_cores, &loop, 1);
+}
+
+void pi_cl_team_parallel_for_dynamic(int nb_cores, int start, int end, int chunk, void (*fn)(int start, int end, void *arg), void *arg)
+{
+  pi_cl_team_loop_t loop;
+  pi_cl_team_loop_init(&loop, start, end, chunk, fn, arg, PI_CL_TEAM_LOOP_DYNAMIC);
+  pi_cl_team_parallel_for_chain(nb_cores, &loop, 1);
+}
+
+
+/*
+ * Software team barrier
+ */
+
+#ifdef __RT_SW_TEAM_BARRIER
+
+// Set of cores of the current team, set when the team is configured
+RT_L1_TINY_DATA unsigned int __rt_barrier_wait_mask;
+
+// Number of times the team has been released
+RT_L1_DATA static volatile unsigned int __rt_barrier_release;
+
+// Arrival flag of each core, written by the core itself with the release
+// number it is waiting for, and polled by the core which wins against it
+RT_L1_DATA static volatile unsigned int __rt_barrier_arrival[ARCHI_CLUSTER_NB_PE];
+
+// Tournament barrier. At each round, the cores whose index is a multiple of
+// twice the round distance wait for the arrival of their partner, which then
+// waits for the release. Core 0 wins the tournament and releases everybody
+// with a single event. This needs log2(N) rounds instead of N arrivals on a
+// shared counter, and each core only polls its own flags after being woken-up.
+//
+// Release numbers are used instead of a sense flag so that cores which were
+// not part of the last teams still see consistent values. All the cores of a
+// team enter the barrier after the previous release, and the flags of the
+// previous barriers contain smaller numbers.
+void __rt_team_barrier()
+{
+  int core_id = rt_core_id();
+  unsigned int core_mask = __rt_barrier_wait_mask;
+  int nb_cores = __FL1(core_mask + 1);
+  unsigned int release = __rt_barrier_release + 1;
+
+  for (int dist=1; dist<nb_cores; dist<<=1)
+  {
+    if (core_id & dist)
+    {
+      // We lost, notify the winner and wait for the release
+      int winner = core_id - dist;
+
+      __rt_barrier_arrival[core_id] = release;
+      eu_evt_trig(eu_evt_trig_addr(RT_BARRIER_EVENT), 1<<winner);
+
+      while (__rt_barrier_release != release)
+      {
+        eu_evt_maskWaitAndClr(1<<RT_BARRIER_EVENT);
+      }
+      return;
+    }
+
+    if (core_id + dist < nb_cores)
+    {
+      while (__rt_barrier_arrival[core_id + dist] != release)
+      {
+        eu_evt_maskWaitAndClr(1<<RT_BARRIER_EVENT);
+      }
+    }
+  }
+
+  // Only core 0 gets here, everybody has arrived
+  __rt_barrier_release = release;
+  eu_evt_trig(eu_evt_trig_addr(RT_BARRIER_EVENT), core_mask & ~1);
+}
+
+#endif
+
+
+#endif
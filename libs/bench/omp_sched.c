@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench/bench.h"
+
+#define BENCH_OMP_NB_ITER 256
+#define BENCH_OMP_CHUNK   4
+
+// Number of times each iteration was executed, to check the schedules
+static int bench_omp_count[BENCH_OMP_NB_ITER];
+
+static inline void bench_omp_work(int i, int unbalanced)
+{
+  // Both loops have roughly the same total amount of work. Balanced
+  // iterations all take the same time while unbalanced ones get longer as
+  // the index grows, which penalizes the static schedule.
+  int nb_iter = unbalanced ? i * 8 : BENCH_OMP_NB_ITER * 4;
+  for (volatile int j=0; j<nb_iter; j++);
+  bench_omp_count[i]++;
+}
+
+static void bench_omp_static(int unbalanced)
+{
+#pragma omp parallel for schedule(static)
+  for (int i=0; i<BENCH_OMP_NB_ITER; i++)
+    bench_omp_work(i, unbalanced);
+}
+
+static void bench_omp_dynamic(int unbalanced)
+{
+#pragma omp parallel for schedule(dynamic, BENCH_OMP_CHUNK)
+  for (int i=0; i<BENCH_OMP_NB_ITER; i++)
+    bench_omp_work(i, unbalanced);
+}
+
+static void bench_omp_guided(int unbalanced)
+{
+#pragma omp parallel for schedule(guided, BENCH_OMP_CHUNK)
+  for (int i=0; i<BENCH_OMP_NB_ITER; i++)
+    bench_omp_work(i, unbalanced);
+}
+
+static void bench_omp_run(testresult_t *result, void (*start)(), void (*stop)(), void (*loop)(int), int unbalanced)
+{
+  start();
+  loop(unbalanced);
+  stop();
+
+  for (int i=0; i<BENCH_OMP_NB_ITER; i++)
+  {
+    check_uint32(result, "Iteration not executed exactly once", bench_omp_count[i], 1);
+    bench_omp_count[i] = 0;
+  }
+}
+
+#define BENCH_OMP_TEST(name, loop, unbalanced)                                  \
+static void name(testresult_t *result, void (*start)(), void (*stop)())         \
+{                                                                               \
+  bench_omp_run(result, start, stop, loop, unbalanced);                         \
+}
+
+BENCH_OMP_TEST(bench_omp_static_balanced, bench_omp_static, 0)
+BENCH_OMP_TEST(bench_omp_static_unbalanced, bench_omp_static, 1)
+BENCH_OMP_TEST(bench_omp_dynamic_balanced, bench_omp_dynamic, 0)
+BENCH_OMP_TEST(bench_omp_dynamic_unbalanced, bench_omp_dynamic, 1)
+BENCH_OMP_TEST(bench_omp_guided_balanced, bench_omp_guided, 0)
+BENCH_OMP_TEST(bench_omp_guided_unbalanced, bench_omp_guided, 1)
+
+static testcase_t bench_omp_tests[] = {
+  { "omp_static_balanced",    bench_omp_static_balanced    },
+  { "omp_static_unbalanced",  bench_omp_static_unbalanced  },
+  { "omp_dynamic_balanced",   bench_omp_dynamic_balanced   },
+  { "omp_dynamic_unbalanced", bench_omp_dynamic_unbalanced },
+  { "omp_guided_balanced",    bench_omp_guided_balanced    },
+  { "omp_guided_unbalanced",  bench_omp_guided_unbalanced  },
+  { 0, 0 }
+};
+
+int bench_omp_schedules(void)
+{
+  return run_suite(bench_omp_tests);
+}
@@ -4,6 +4,9 @@ PULP_LIB_CL_ASM_SRCS_omp   += libs/omp/omp_asm.S
 PULP_LIB_CL_SRCS_omp   += libs/omp/omp_wrapper_gcc.c
 PULP_LIBS += omp
 endif
+ifeq '$(CONFIG_OMP_STATS)' '1'
+PULP_CFLAGS += -D__OMP_STATS__=1
+endif
 endif
 
 ifeq '$(CONFIG_LIB_IO_ENABLED)' '1'
@@ -13,6 +16,9 @@ endif
 
 ifeq '$(CONFIG_LIB_BENCH_ENABLED)' '1'
 PULP_LIB_FC_SRCS_bench   += libs/bench/bench.c
+ifeq '$(CONFIG_OMP_ENABLED)' '1'
+PULP_LIB_CL_OMP_SRCS_bench   += libs/bench/omp_sched.c
+endif
 PULP_LIBS += bench
 endif
 
@@ -20,38 +20,637 @@
 
 #include "ompRt.h"
 #include "hal/pulp.h"
+#include <string.h>
+#include <stdio.h>
 
 omp_t RT_L1_TINY_DATA ompData;
 RT_L1_TINY_DATA int core_epoch[16];
+RT_L1_TINY_DATA int core_guided_epoch[16];
+RT_L1_DATA omp_static_loop_t omp_static_loop[ARCHI_CLUSTER_NB_PE];
 
-static void handleReadyTasks(omp_team_t *team);
+#ifdef OMP_HAS_TEAMS
+RT_L1_DATA omp_team_t *ompCoreTeams[ARCHI_CLUSTER_NB_PE];
+RT_L1_TINY_DATA int ompTopLevel;
+// Cores on which the thread running on each core can create a nested team
+RT_L1_DATA unsigned short ompCorePlaces[ARCHI_CLUSTER_NB_PE];
+RT_L1_DATA omp_team_t ompTeams[OMP_NB_TEAMS];
+RT_L1_DATA static unsigned int ompTeamsFree;
+RT_L1_DATA static int ompTeamsLock;
+#endif
+
+RT_L1_DATA ompTaskQueue_t ompTaskQueues[ARCHI_CLUSTER_NB_PE];
+RT_L1_DATA ompTask_t *ompCurrentTasks[ARCHI_CLUSTER_NB_PE];
+RT_L1_DATA ompTask_t ompImplicitTasks[ARCHI_CLUSTER_NB_PE];
+
+#ifdef __OMP_STATS__
+RT_L1_DATA ompCoreStats_t ompCoreStats[ARCHI_CLUSTER_NB_PE];
+RT_L1_DATA static ompRegionStats_t ompRegionStats[OMP_STATS_NB_REGIONS];
+RT_L1_DATA static ompStatsRegionDesc_t ompStatsPlainRegion;
+RT_L1_DATA static int ompStatsLock;
+RT_L1_DATA static unsigned int ompStatsResetTime;
+#endif
 
 /*
  * OMP runtime library
  */
 
-#if 0
-static void handleReadyTasks(omp_team_t *team)
+/*
+ * Tasks
+ *
+ * Deferred tasks are allocated from a pool of descriptors allocated at init
+ * and pushed to the ready queue of the creating core, from where they can be
+ * stolen by the other cores of the team when they wait in a taskwait or a
+ * barrier. Pending tasks are counted per team, so that a team barrier only
+ * waits for the tasks of its own team.
+ * Tasks with dependencies are also kept in a list in creation order and
+ * counts how many previous sibling tasks they depend on, they become ready
+ * when this counter reaches 0.
+ * The queues and the task accounting are protected by L1 test-and-set locks,
+ * so that tasks can be created inside a critical section.
+ */
+
+static inline void ompTaskLock(int *lock)
+{
+  while (rt_tas_lock_32((unsigned int)lock) == -1)
+  {
+  }
+}
+
+static inline void ompTaskUnlock(int *lock)
+{
+  rt_tas_unlock_32((unsigned int)lock, 0);
+}
+
+static void ompTaskQueuePush(ompTaskQueue_t *queue, ompTask_t *task)
+{
+  ompTaskLock(&queue->lock);
+  task->prev = NULL;
+  task->next = queue->first;
+  if (queue->first)
+    queue->first->prev = task;
+  else
+    queue->last = task;
+  queue->first = task;
+  ompTaskUnlock(&queue->lock);
+}
+
+// Queues are shared by the teams a core successively belongs to, e.g. the
+// master of a nested team may still have tasks of the parent team, so only
+// the tasks of the given team are taken.
+static void ompTaskQueueRemove(ompTaskQueue_t *queue, ompTask_t *task)
+{
+  if (task->prev)
+    task->prev->next = task->next;
+  else
+    queue->first = task->next;
+
+  if (task->next)
+    task->next->prev = task->prev;
+  else
+    queue->last = task->prev;
+}
+
+static ompTask_t *ompTaskQueuePop(ompTaskQueue_t *queue, omp_team_t *team)
+{
+  if (*(ompTask_t * volatile *)&queue->first == NULL)
+    return NULL;
+
+  ompTaskLock(&queue->lock);
+  ompTask_t *task = queue->first;
+  while (task && task->team != team)
+  {
+    task = task->next;
+  }
+  if (task)
+    ompTaskQueueRemove(queue, task);
+  ompTaskUnlock(&queue->lock);
+  return task;
+}
+
+static ompTask_t *ompTaskQueueSteal(ompTaskQueue_t *queue, omp_team_t *team)
+{
+  if (*(ompTask_t * volatile *)&queue->last == NULL)
+    return NULL;
+
+  ompTaskLock(&queue->lock);
+  ompTask_t *task = queue->last;
+  while (task && task->team != team)
+  {
+    task = task->prev;
+  }
+  if (task)
+    ompTaskQueueRemove(queue, task);
+  ompTaskUnlock(&queue->lock);
+  return task;
+}
+
+// Cores whose queues can contain tasks of the team
+static inline unsigned int ompTeamCoreMask(omp_team_t *team)
+{
+#ifdef OMP_HAS_TEAMS
+  return team->coreMask;
+#else
+  return (1 << team->nbThreads) - 1;
+#endif
+}
+
+static int ompTaskConflict(ompTask_t *task, int nbDeps, unsigned int outMask, void **deps)
+{
+  for (int i=0; i<task->nbDeps; i++)
+  {
+    for (int j=0; j<nbDeps; j++)
+    {
+      if (task->deps[i] == deps[j] && (((task->depOutMask >> i) & 1) || ((outMask >> j) & 1)))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+static int ompTaskRunOne();
+
+static void ompTaskWaitChildren(ompTask_t *task)
+{
+  while (*(volatile int *)&task->nbChildren)
+  {
+    ompTaskRunOne();
+  }
+}
+
+static void ompTaskComplete(ompTask_t *task)
+{
+  omp_t *_this = omp_getData();
+  ompTask_t *ready = NULL;
+
+  ompTaskLock(&_this->taskLock);
+
+  task->parent->nbChildren--;
+
+  if (task->nbDeps)
+  {
+    ompTask_t *prev = NULL;
+    for (ompTask_t *current = _this->firstDepTask; current != task; current = current->depNext)
+    {
+      prev = current;
+    }
+
+    if (prev)
+      prev->depNext = task->depNext;
+    else
+      _this->firstDepTask = task->depNext;
+    if (_this->lastDepTask == task)
+      _this->lastDepTask = prev;
+
+    // Only the next siblings may depend on this task
+    for (ompTask_t *next = task->depNext; next; next = next->depNext)
+    {
+      if (next->parent == task->parent && ompTaskConflict(next, task->nbDeps, task->depOutMask, task->deps))
+      {
+        if (--next->nbPreds == 0)
+        {
+          next->next = ready;
+          ready = next;
+        }
+      }
+    }
+  }
+
+  task->next = _this->taskPool;
+  _this->taskPool = task;
+
+  task->team->nbPendingTasks--;
+
+  ompTaskUnlock(&_this->taskLock);
+
+  while (ready)
+  {
+    ompTask_t *next = ready->next;
+    ompTaskQueuePush(&ompTaskQueues[rt_core_id()], ready);
+    ready = next;
+  }
+}
+
+static void ompTaskRun(ompTask_t *task)
+{
+  int coreId = rt_core_id();
+  ompTask_t *parent = ompCurrentTasks[coreId];
+
+  ompCurrentTasks[coreId] = task;
+  task->func(task->data);
+
+  // Children still refer to their parent, so wait for them before the
+  // descriptor is released
+  ompTaskWaitChildren(task);
+  ompCurrentTasks[coreId] = parent;
+
+  ompTaskComplete(task);
+}
+
+static int ompTaskRunOne()
+{
+  int coreId = rt_core_id();
+  omp_team_t *team = getCurrentTeam();
+  unsigned int mask = ompTeamCoreMask(team);
+  ompTask_t *task = ompTaskQueuePop(&ompTaskQueues[coreId], team);
+
+  // Only steal from the cores of the team, the other ones may be running
+  // other teams
+  for (int i=1; task == NULL && i<ARCHI_CLUSTER_NB_PE; i++)
+  {
+    int victim = coreId + i;
+    if (victim >= ARCHI_CLUSTER_NB_PE)
+      victim -= ARCHI_CLUSTER_NB_PE;
+    if ((mask >> victim) & 1)
+      task = ompTaskQueueSteal(&ompTaskQueues[victim], team);
+  }
+
+  if (task == NULL)
+    return 0;
+
+  ompTaskRun(task);
+
+  return 1;
+}
+
+// Must be called with the task lock held
+static void ompTaskPoolInit(omp_t *_this)
+{
+  // The pool is only allocated by the first task so that programs without
+  // tasks do not pay for it. If it cannot be allocated, all tasks are just
+  // executed immediately.
+  _this->taskPoolInit = 1;
+
+  int taskSize = sizeof(ompTask_t) + OMP_TASK_ARG_SIZE;
+  char *pool = rt_alloc_align(RT_ALLOC_CL_DATA + rt_cluster_id(), taskSize * OMP_NB_TASKS, 8);
+  if (pool == NULL)
+    return;
+
+  for (int i=0; i<OMP_NB_TASKS; i++)
+  {
+    ompTask_t *task = (ompTask_t *)(pool + taskSize * i);
+    task->allocSize = 0;
+    task->next = _this->taskPool;
+    _this->taskPool = task;
+  }
+}
+
+ompTask_t *ompTaskAlloc(int argSize, int argAlign)
+{
+  omp_t *_this = omp_getData();
+
+  if (argSize > OMP_TASK_ARG_SIZE || argAlign > 8)
+    return NULL;
+
+  ompTaskLock(&_this->taskLock);
+  if (!_this->taskPoolInit)
+    ompTaskPoolInit(_this);
+  ompTask_t *task = _this->taskPool;
+  if (task)
+    _this->taskPool = task->next;
+  ompTaskUnlock(&_this->taskLock);
+
+  if (task)
+    task->data = (void *)(task + 1);
+
+  return task;
+}
+
+void ompTaskSubmit(ompTask_t *task, int nbDeps, unsigned int outMask, void **deps)
+{
+  omp_t *_this = omp_getData();
+  int coreId = rt_core_id();
+  ompTask_t *parent = ompCurrentTasks[coreId];
+  omp_team_t *team = getCurrentTeam();
+
+  task->parent = parent;
+  task->team = team;
+  task->nbChildren = 0;
+  task->nbPreds = 0;
+  task->nbDeps = nbDeps;
+  task->depOutMask = outMask;
+  for (int i=0; i<nbDeps; i++)
+  {
+    task->deps[i] = deps[i];
+  }
+
+  ompTaskLock(&_this->taskLock);
+
+  team->nbPendingTasks++;
+  parent->nbChildren++;
+
+  if (nbDeps)
+  {
+    for (ompTask_t *current = _this->firstDepTask; current; current = current->depNext)
+    {
+      if (current->parent == parent && ompTaskConflict(current, nbDeps, outMask, deps))
+        task->nbPreds++;
+    }
+
+    task->depNext = NULL;
+    if (_this->lastDepTask)
+      _this->lastDepTask->depNext = task;
+    else
+      _this->firstDepTask = task;
+    _this->lastDepTask = task;
+  }
+
+  int isReady = task->nbPreds == 0;
+
+  ompTaskUnlock(&_this->taskLock);
+
+  if (isReady)
+    ompTaskQueuePush(&ompTaskQueues[coreId], task);
+}
+
+void ompTaskExecUndeferred(void (*func)(void *), void *data, int nbDeps, unsigned int outMask, void **deps)
 {
-  criticalStart(team);
-  ompTask_t *task = team->firstReadyTask;
   omp_t *_this = omp_getData();
-  if (task) {
-    team->firstReadyTask = task->next;
-    if (team->firstReadyTask == NULL) {
-      team->lastReadyTask = NULL;
-      team->hasTasks = 0;
+  int coreId = rt_core_id();
+  ompTask_t *parent = ompCurrentTasks[coreId];
+  ompTask_t task;
+
+  // Wait until the previous siblings this task depends on are finished
+  while (nbDeps)
+  {
+    int conflict = 0;
+
+    ompTaskLock(&_this->taskLock);
+    for (ompTask_t *current = _this->firstDepTask; current; current = current->depNext)
+    {
+      if (current->parent == parent && ompTaskConflict(current, nbDeps, outMask, deps))
+      {
+        conflict = 1;
+        break;
+      }
+    }
+    ompTaskUnlock(&_this->taskLock);
+
+    if (!conflict)
+      break;
+
+    ompTaskRunOne();
+  }
+
+  task.parent = parent;
+  task.nbChildren = 0;
+
+  ompCurrentTasks[coreId] = &task;
+  func(data);
+  ompTaskWaitChildren(&task);
+  ompCurrentTasks[coreId] = parent;
+}
+
+void ompTaskWait()
+{
+  ompTaskWaitChildren(ompCurrentTasks[rt_core_id()]);
+}
+
+void ompTaskDrain()
+{
+  omp_team_t *team = getCurrentTeam();
+
+  while (*(volatile int *)&team->nbPendingTasks)
+  {
+    ompTaskRunOne();
+  }
+}
+
+// Function of the current plain team region. The slaves are woken up on
+// ompPlainTeamEntry instead of the region function, so that they also execute
+// the pending tasks before joining the fork barrier.
+RT_L1_TINY_DATA void (*ompPlainFn)(void *);
+
+void ompPlainTeamEntry(void *data)
+{
+#if defined(__GNUC__) || defined(__OMP_STATS__)
+  ompPlainFn(data);
+#else
+  kmpc_micro entry = (kmpc_micro)ompPlainFn;
+  int id;
+  entry(&id, &id, data);
+#endif
+  taskDrain();
+}
+
+static void ompTaskInit(omp_t *_this)
+{
+  _this->taskPool = NULL;
+  _this->taskPoolInit = 0;
+  _this->firstDepTask = NULL;
+  _this->lastDepTask = NULL;
+  _this->plainTeam.nbPendingTasks = 0;
+  _this->taskLock = 0;
+
+  for (int i=0; i<ARCHI_CLUSTER_NB_PE; i++)
+  {
+    ompTaskQueues[i].first = NULL;
+    ompTaskQueues[i].last = NULL;
+    ompTaskQueues[i].lock = 0;
+    ompImplicitTasks[i].parent = NULL;
+    ompImplicitTasks[i].nbChildren = 0;
+    ompCurrentTasks[i] = &ompImplicitTasks[i];
+  }
+}
+
+/*
+ * Reductions
+ *
+ * The private data of the threads are combined 2 by 2 in a tree whose levels
+ * are separated by team barriers, like pi_cl_team_reduce, except that the
+ * tree is built on the thread numbers of the OpenMP team, so that it also
+ * works for partial, nested and concurrent teams. The result ends up in the
+ * data of thread 0.
+ */
+
+RT_L1_DATA static void *ompReduceData[ARCHI_CLUSTER_NB_PE];
+
+static inline int ompTeamThreadCore(omp_team_t *team, int thread)
+{
+#ifdef OMP_HAS_TEAMS
+  unsigned int mask = team->coreMask;
+  for (int i=0; i<thread; i++)
+  {
+    mask &= mask - 1;
+  }
+  return __builtin_ctz(mask);
+#else
+  return thread;
+#endif
+}
+
+void ompTeamReduce(omp_team_t *team, void *data, void (*combine)(void *dst, void *src, void *arg), void *arg)
+{
+  int nbThreads = team->nbThreads;
+  int thread = getThreadNum(omp_getData());
+
+  if (nbThreads == 1)
+    return;
+
+  // Data are indexed by core as concurrent teams may reduce at the same time
+  ompReduceData[rt_core_id()] = data;
+
+  for (int dist=1; dist<nbThreads; dist<<=1)
+  {
+    doBarrier(team);
+
+    if ((thread & ((dist<<1) - 1)) == 0 && thread + dist < nbThreads)
+      combine(data, ompReduceData[ompTeamThreadCore(team, thread + dist)], arg);
+  }
+
+  // The other threads must not release their data before it is combined
+  doBarrier(team);
+}
+
+/*
+ * Profiling
+ *
+ * When the runtime is compiled with __OMP_STATS__, each core accounts the
+ * cycles spent in the main runtime operations, and the time spent by each
+ * core in the body of each parallel region, to see how balanced regions are.
+ * Cycles are read from the cluster timer, which is started at init.
+ */
+
+#ifdef __OMP_STATS__
+
+static inline void ompRegionCall(void (*fn)(void *), void *data)
+{
+#ifdef __GNUC__
+  fn(data);
+#else
+  kmpc_micro entry = (kmpc_micro)fn;
+  int id;
+  entry(&id, &id, data);
+#endif
+}
+
+// Called by the master of a region to get the entry where the time of the
+// region threads is accounted
+int ompStatsRegionStart(void (*fn)(void *))
+{
+  int region;
+
+  ompTaskLock(&ompStatsLock);
+
+  for (region=0; region<OMP_STATS_NB_REGIONS-1; region++)
+  {
+    if (ompRegionStats[region].fn == fn)
+      break;
+
+    if (ompRegionStats[region].fn == NULL)
+    {
+      ompRegionStats[region].fn = fn;
+      break;
     }
-    void (*func)(void *) = task->func;
-    void *data = task->data;
-    freeTask(rtCc, _this, task);
-    criticalEnd(team);
-    func(data);
-  } else {
-    criticalEnd(team);
   }
+
+  ompRegionStats[region].count++;
+
+  ompTaskUnlock(&ompStatsLock);
+
+  return region;
+}
+
+void ompStatsRegionStop(int region, unsigned int start)
+{
+  int coreId = rt_core_id();
+  unsigned int cycles = rt_perf_cl_read(RT_PERF_CYCLES) - start;
+
+  ompCoreStats[coreId].cycles[OMP_STATS_PARALLEL] += cycles;
+  ompCoreStats[coreId].count[OMP_STATS_PARALLEL]++;
+  ompRegionStats[region].work[coreId] += cycles;
+}
+
+void *ompStatsRegionPrepare(void (*fn)(void *), void *data)
+{
+  ompStatsRegionDesc_t *desc = &ompStatsPlainRegion;
+  desc->fn = fn;
+  desc->data = data;
+  desc->region = ompStatsRegionStart(fn);
+  return (void *)desc;
 }
+
+void ompStatsRegionEntry(void *arg)
+{
+  ompStatsRegionDesc_t *desc = (ompStatsRegionDesc_t *)arg;
+  unsigned int start = ompStatsStart();
+  ompRegionCall(desc->fn, desc->data);
+  ompStatsRegionStop(desc->region, start);
+}
+
+#endif
+
+void omp_reset_stats(void)
+{
+#ifdef __OMP_STATS__
+  memset((void *)ompCoreStats, 0, sizeof(ompCoreStats));
+  memset((void *)ompRegionStats, 0, sizeof(ompRegionStats));
+  ompStatsResetTime = rt_perf_cl_read(RT_PERF_CYCLES);
+#endif
+}
+
+void omp_dump_stats(void)
+{
+#ifdef __OMP_STATS__
+  static const char *names[OMP_STATS_NB] = { "parallel", "barrier", "critical", "loop" };
+  unsigned int elapsed = rt_perf_cl_read(RT_PERF_CYCLES) - ompStatsResetTime;
+  int nbCores = rt_nb_pe();
+
+  printf("OMP stats, %u cycles since reset\n", elapsed);
+
+  for (int i=0; i<nbCores; i++)
+  {
+    ompCoreStats_t *stats = &ompCoreStats[i];
+    printf("  core %2d:", i);
+    for (int j=0; j<OMP_STATS_NB; j++)
+    {
+      printf(" %s %u (%u)", names[j], stats->cycles[j], stats->count[j]);
+    }
+    printf(" outside %u\n", elapsed - stats->cycles[OMP_STATS_PARALLEL]);
+  }
+
+  // For each region, the imbalance is how much the average thread waits for
+  // the slowest one, compared to the duration of the slowest one
+  for (int i=0; i<OMP_STATS_NB_REGIONS; i++)
+  {
+    ompRegionStats_t *region = &ompRegionStats[i];
+    unsigned int min = 0xffffffff, max = 0, total = 0;
+    int nbThreads = 0, slowest = 0;
+
+    if (region->count == 0)
+      continue;
+
+    for (int j=0; j<nbCores; j++)
+    {
+      unsigned int work = region->work[j];
+      if (work == 0)
+        continue;
+
+      nbThreads++;
+      total += work;
+      if (work < min)
+        min = work;
+      if (work > max)
+      {
+        max = work;
+        slowest = j;
+      }
+    }
+
+    if (nbThreads == 0)
+      continue;
+
+    unsigned int avg = total / nbThreads;
+
+    if (i == OMP_STATS_NB_REGIONS - 1)
+      printf("  other regions:");
+    else
+      printf("  region %p:", region->fn);
+
+    printf(" calls %u threads %d work min %u avg %u max %u (core %d) imbalance %u%%\n",
+      region->count, nbThreads, min, avg, max, slowest, (max - avg) * 100 / max);
+  }
 #endif
+}
 
 static inline void initTeam(omp_t *_this, omp_team_t *team)
 {
@@ -89,18 +688,36 @@ static void __rt_omp_init(int exec_main)
   _this->plainTeam.loop_epoch = 0;
   _this->plainTeam.loop_is_setup = 0;
 #endif
-  //_this->plainTeam.firstReadyTask = NULL;
-  //_this->taskPool = NULL;
-  //_this->plainTeam.hasTasks = 0;
-  #if 0
-  ompTask_t *taskPool = (ompTask_t *)rt_l1_alloc(rtCc, sizeof(ompTask_t)*rtCc->nbCores*2);
-  unsigned int i;
-  for (i=0; i<rtCc->nbCores*2; i++) {
-    ompTask_t *task = &taskPool[i];
-    task->next = _this->taskPool;
-    _this->taskPool = task;
+#if EU_VERSION == 3
+  _this->plainTeam.guided_epoch = 0;
+  _this->plainTeam.guided_is_setup = 0;
+#endif
+  ompTaskInit(_this);
+
+#ifdef __OMP_STATS__
+  // The cluster timer is shared by all cores, it is enough to start it once
+  rt_perf_t perf;
+  rt_perf_init(&perf);
+  rt_perf_conf(&perf, 1<<RT_PERF_CYCLES);
+  rt_perf_reset(&perf);
+  rt_perf_start(&perf);
+  ompStatsLock = 0;
+  omp_reset_stats();
+#endif
+
+#ifdef OMP_HAS_TEAMS
+  // Barrier 0 is for the plain team, the other ones for nested teams
+  _this->plainTeam.coreMask = coreMask;
+  _this->plainTeam.barId = 0;
+  ompTopLevel = 1;
+  ompTeamsFree = ((1 << OMP_NB_TEAMS) - 1) & ~1;
+  ompTeamsLock = 0;
+  for (int i=0; i<ARCHI_CLUSTER_NB_PE; i++)
+  {
+    ompCoreTeams[i] = &_this->plainTeam;
+    ompCorePlaces[i] = 1 << i;
   }
-  #endif
+#endif
 
   initTeam(_this, &_this->plainTeam);
 
@@ -178,11 +795,17 @@ void partialParallelRegion(void (*fn) (void*), void *data, int num_threads)
   eu_bar_setup(eu_bar_addr(0), coreSet);
   eu_dispatch_team_config(coreSet);
   team->nbThreads = num_threads;
+#ifdef OMP_HAS_TEAMS
+  team->coreMask = coreSet;
+#endif
 
   parallelRegionExec(data, fn);
 
   eu_bar_setup(eu_bar_addr(0), coreMask);
   eu_dispatch_team_config(coreMask);
+#ifdef OMP_HAS_TEAMS
+  team->coreMask = coreMask;
+#endif
   // After a partial team has been executed, the loop core epochs are desynchronized,
   // Realign them in order to not disturb plain teams
 #ifdef ARCHI_EU_HAS_DYNLOOP
@@ -194,6 +817,13 @@ void partialParallelRegion(void (*fn) (void*), void *data, int num_threads)
     core_epoch[i] = 0;
   }
 #endif
+#if EU_VERSION == 3
+  team->guided_epoch = 0;
+  for (int i=0; i<nbCores; i++)
+  {
+    core_guided_epoch[i] = 0;
+  }
+#endif
 #else
   team->nbThreads = num_threads;
   pulp_barrier_setup(0, num_threads, (1<<num_threads)-1);
@@ -203,4 +833,239 @@ void partialParallelRegion(void (*fn) (void*), void *data, int num_threads)
   team->nbThreads = nbCores;
 }
 
+#ifdef OMP_HAS_TEAMS
+
+/*
+ * Concurrent teams
+ *
+ * Teams other than the plain team get their own hardware barrier, and their
+ * threads are woken up through the dispatcher with an entry which does not
+ * go through the fork barrier, so that several teams can run at the same
+ * time on disjoint sets of cores.
+ * Each thread can only create a team on the cores of its place, which is
+ * the calling core itself except for teams created with proc_bind(spread),
+ * where the cores of the parent place are split between the threads.
+ */
+
+static omp_team_t *ompTeamAlloc()
+{
+  omp_team_t *team = NULL;
+
+  ompTaskLock(&ompTeamsLock);
+  if (ompTeamsFree)
+  {
+    int barId = __builtin_ctz(ompTeamsFree);
+    ompTeamsFree &= ~(1 << barId);
+    team = &ompTeams[barId];
+    team->barId = barId;
+  }
+  ompTaskUnlock(&ompTeamsLock);
+
+  return team;
+}
+
+static void ompTeamFree(omp_team_t *team)
+{
+  ompTaskLock(&ompTeamsLock);
+  ompTeamsFree |= 1 << team->barId;
+  ompTaskUnlock(&ompTeamsLock);
+}
+
+static inline void ompTeamExec(omp_team_t *team)
+{
+#ifdef __OMP_STATS__
+  unsigned int start = ompStatsStart();
+#endif
+#ifdef __GNUC__
+  team->fn(team->data);
+#else
+  kmpc_micro entry = (kmpc_micro)team->fn;
+  int id;
+  entry(&id, &id, team->data);
+#endif
+#ifdef __OMP_STATS__
+  ompStatsRegionStop(team->statsRegion, start);
+#endif
+}
+
+// Entry of the threads of a concurrent team, except the master
+static void ompTeamEntry(void *arg)
+{
+  omp_team_t *team = (omp_team_t *)arg;
+  int coreId = rt_core_id();
+  int epoch = core_epoch[coreId];
+  int guidedEpoch = core_guided_epoch[coreId];
+
+  core_epoch[coreId] = 0;
+  core_guided_epoch[coreId] = 0;
+
+  ompTeamExec(team);
+
+  taskDrain();
+
+  // Go back to the plain team before the final barrier, as the master may
+  // reuse this core for another team as soon as it is released
+  core_epoch[coreId] = epoch;
+  core_guided_epoch[coreId] = guidedEpoch;
+  ompCoreTeams[coreId] = &omp_getData()->plainTeam;
+  ompCorePlaces[coreId] = 1 << coreId;
+
+  eu_bar_trig_wait_clr(eu_bar_addr(team->barId));
+}
+
+static void ompParallelSerial(void (*fn) (void*), void *data)
+{
+  int coreId = rt_core_id();
+  omp_team_t *parent = ompCoreTeams[coreId];
+  omp_team_t team;
+
+  // Team of one thread, which does not need any barrier
+  team.nbThreads = 1;
+  team.nbPendingTasks = 0;
+  team.coreMask = 1 << coreId;
+  team.barId = 0;
+  team.fn = fn;
+  team.data = data;
+#ifdef __OMP_STATS__
+  team.statsRegion = ompStatsRegionStart(fn);
+#endif
+  team.loop_epoch = core_epoch[coreId];
+  team.loop_is_setup = 0;
+  team.guided_epoch = core_guided_epoch[coreId];
+  team.guided_is_setup = 0;
+
+  ompCoreTeams[coreId] = &team;
+  ompTeamExec(&team);
+  taskDrain();
+  ompCoreTeams[coreId] = parent;
+}
+
+void ompParallelTeam(void (*fn) (void*), void *data, int num_threads, unsigned int flags)
+{
+  omp_t *_this = omp_getData();
+  int coreId = rt_core_id();
+  int topLevel = ompTopLevel;
+  int spread = (flags & 7) == OMP_PROC_BIND_SPREAD;
+
+  if (topLevel && !spread)
+  {
+    // Top-level region on the first cores, this can use the plain team
+    ompTopLevel = 0;
+    partialParallelRegion(fn, data, num_threads);
+    ompTopLevel = 1;
+    return;
+  }
+
+  unsigned int place = topLevel ? _this->coreMask : ompCorePlaces[coreId];
+  int nbPlaceCores = __builtin_popcount(place);
+  int nbThreads = num_threads && num_threads < nbPlaceCores ? num_threads : nbPlaceCores;
+  omp_team_t *team = NULL;
+
+  if (nbThreads > 1)
+    team = ompTeamAlloc();
+
+  if (team == NULL)
+  {
+    ompTopLevel = 0;
+    ompParallelSerial(fn, data);
+    if (topLevel)
+      ompTopLevel = 1;
+    return;
+  }
+
+  // Select the team cores from the place, the calling core is always the
+  // first one. With spread binding, the place is split into one group per
+  // thread and each group becomes the place of its thread.
+  unsigned short places[ARCHI_CLUSTER_NB_PE];
+  unsigned int teamMask = 0;
+  int groupSize = nbPlaceCores / nbThreads;
+  int groupRemain = nbPlaceCores - groupSize * nbThreads;
+
+  for (int i=0; i<nbThreads; i++)
+  {
+    int size = spread ? groupSize + (i < groupRemain) : 1;
+    unsigned int group = 0;
+
+    for (int j=0; j<size; j++)
+    {
+      int core = __builtin_ctz(place);
+      place &= ~(1 << core);
+      group |= 1 << core;
+    }
+
+    int core = __builtin_ctz(group);
+    teamMask |= 1 << core;
+    places[core] = group;
+  }
+
+  team->nbThreads = nbThreads;
+  team->nbPendingTasks = 0;
+  team->coreMask = teamMask;
+  team->fn = fn;
+  team->data = data;
+#ifdef __OMP_STATS__
+  team->statsRegion = ompStatsRegionStart(fn);
+#endif
+  team->loop_epoch = 0;
+  team->loop_is_setup = 0;
+  team->guided_epoch = 0;
+  team->guided_is_setup = 0;
+
+  eu_bar_setup(eu_bar_addr(team->barId), teamMask);
+
+  omp_team_t *parent = ompCoreTeams[coreId];
+  unsigned short parentPlace = ompCorePlaces[coreId];
+  int epoch = core_epoch[coreId];
+  int guidedEpoch = core_guided_epoch[coreId];
+
+  for (int i=0; i<ARCHI_CLUSTER_NB_PE; i++)
+  {
+    if ((teamMask >> i) & 1)
+    {
+      ompCoreTeams[i] = team;
+      ompCorePlaces[i] = places[i];
+    }
+  }
+
+  ompTopLevel = 0;
+
+  // The dispatcher configuration is shared by all teams, so it must be kept
+  // until the team entry is pushed. It is restored for the plain team, which
+  // pushes without configuring it.
+  ompTaskLock(&ompTeamsLock);
+  eu_dispatch_team_config(teamMask);
+  eu_dispatch_push((unsigned int)ompTeamEntry | 1);
+  eu_dispatch_push((unsigned int)team);
+  eu_dispatch_team_config(_this->coreMask);
+  ompTaskUnlock(&ompTeamsLock);
+
+  core_epoch[coreId] = 0;
+  core_guided_epoch[coreId] = 0;
+
+  perfParallelEnter();
+  ompTeamExec(team);
+  perfParallelExit();
+
+  doBarrier(team);
+
+  core_epoch[coreId] = epoch;
+  core_guided_epoch[coreId] = guidedEpoch;
+  ompCoreTeams[coreId] = parent;
+  ompCorePlaces[coreId] = parentPlace;
+
+  ompTeamFree(team);
+
+  if (topLevel)
+    ompTopLevel = 1;
+}
+
+#else
+
+void ompParallelTeam(void (*fn) (void*), void *data, int num_threads, unsigned int flags)
+{
+  partialParallelRegion(fn, data, num_threads);
+}
+
+#endif
+
 RT_L1_TINY_DATA unsigned int parallelTemp0;
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Authors: Germain Haugou, ETH (germain.haugou@iis.ee.ethz.ch)
+ */
+
+#ifndef __OMPCONFIG_H__
+#define __OMPCONFIG_H__
+
+// This file is included by both C and assembly files, it must only contain
+// preprocessor definitions
+
+#include <archi/pulp.h>
+
+// Concurrent teams need one hardware barrier per team and the generic
+// dispatcher entry, which is not available when there is a cluster
+// controller. The dynamic loop unit is also shared by all cores, so it
+// cannot be used by several teams at the same time.
+#if EU_VERSION == 3 && !defined(ARCHI_EU_HAS_DYNLOOP) && !defined(ARCHI_HAS_CC) && !defined(ARCHI_HAS_NO_BARRIER) && !defined(__RT_SW_TEAM_BARRIER) && !defined(ARCHI_HAS_NO_DISPATCH)
+#define OMP_HAS_TEAMS 1
+#endif
+
+#endif
@@ -23,26 +23,65 @@
 
 #include <rt/rt_api.h>
 #include "omp.h"
+#include "ompConfig.h"
 #include <stdarg.h>
 
 #define OMP_NB_WORKSHARE_BITS 3
 #define OMP_NB_WORKSHARE (1<<OMP_NB_WORKSHARE_BITS)
 
+#ifndef OMP_NB_TEAMS
+#define OMP_NB_TEAMS 4
+#endif
+
+#define OMP_PROC_BIND_SPREAD 4
+
 struct omp_ws_s;
+struct omp_team_s;
+
+// Size of the pool of deferred task descriptors, which is allocated in L1
+// when the first task is created. Can be overridden at compile time.
+#ifndef OMP_NB_TASKS
+#define OMP_NB_TASKS       32
+#endif
+#define OMP_TASK_ARG_SIZE  64
+#define OMP_TASK_NB_DEPS   4
+
+#define GOMP_TASK_FLAG_DEPEND 8
 
+// Task descriptor. Pool descriptors are directly followed by a buffer of
+// OMP_TASK_ARG_SIZE bytes for the task arguments.
 typedef struct ompTask_s {
   void (*func)(void *);
   void *data;
   struct ompTask_s *next;
-} ompTask_t;
-
+  struct ompTask_s *prev;
+  struct ompTask_s *parent;
+  struct ompTask_s *depNext;
+  struct omp_team_s *team;
+  int nbChildren;
+  int nbPreds;
+  int allocSize;           // Size of the descriptor if allocated out of the pool
+  unsigned char nbDeps;
+  unsigned char depOutMask;
+  void *deps[OMP_TASK_NB_DEPS];
+} __attribute__((aligned(8))) ompTask_t;
+
+// Per-core ready queue. The owner pushes and pops at the head, other cores
+// steal at the tail.
 typedef struct {
+  ompTask_t *first;
+  ompTask_t *last;
+  int lock;
+} ompTaskQueue_t;
+
+typedef struct omp_team_s {
   //int id;
   //int barrier;
   //ompTask_t *firstReadyTask;
   //ompTask_t *lastReadyTask;
   char nbThreads;
   //char hasTasks;
+  int nbPendingTasks;
 #if EU_VERSION == 1
   plp_swMutex_t mutex;
 #endif
@@ -54,10 +93,43 @@ typedef struct {
   int loop_chunk;
   int loop_is_setup;
 #endif
+#if EU_VERSION == 3
+  int guided_epoch;
+  int guided_next;
+  int guided_nb_iter;
+  int guided_start;
+  int guided_incr;
+  int guided_chunk;
+  int guided_is_setup;
+#endif
+#ifdef OMP_HAS_TEAMS
+  unsigned short coreMask;
+  char barId;
+  void (*fn)(void *);
+  void *data;
+#ifdef __OMP_STATS__
+  int statsRegion;
+#endif
+#endif
 } omp_team_t;
 
+// Static loop state. There is one per core, only accessed by this core, so
+// that static loops do not need any synchronization
+typedef struct {
+  int start;
+  int incr;
+  int nb_iter;
+  int chunk;
+  int step;
+  int next;
+} omp_static_loop_t;
+
 typedef struct {
-  //ompTask_t *taskPool;
+  ompTask_t *taskPool;
+  int taskPoolInit;
+  ompTask_t *firstDepTask;
+  ompTask_t *lastDepTask;
+  int taskLock;
   omp_team_t plainTeam;
 #ifdef __LLVM__
   int numThreads;
@@ -67,8 +139,88 @@ typedef struct {
 
 extern omp_t RT_L1_TINY_DATA ompData;
 extern RT_L1_TINY_DATA int core_epoch[16];
+extern RT_L1_TINY_DATA int core_guided_epoch[16];
+extern RT_L1_DATA omp_static_loop_t omp_static_loop[ARCHI_CLUSTER_NB_PE];
+#ifdef OMP_HAS_TEAMS
+extern RT_L1_DATA omp_team_t *ompCoreTeams[ARCHI_CLUSTER_NB_PE];
+extern RT_L1_TINY_DATA int ompTopLevel;
+#endif
 
 void partialParallelRegion(void (*fn) (void*), void *data, int num_threads);
+void ompParallelTeam(void (*fn) (void*), void *data, int num_threads, unsigned int flags);
+
+ompTask_t *ompTaskAlloc(int argSize, int argAlign);
+void ompTaskSubmit(ompTask_t *task, int nbDeps, unsigned int outMask, void **deps);
+void ompTaskExecUndeferred(void (*func)(void *), void *data, int nbDeps, unsigned int outMask, void **deps);
+void ompTaskWait();
+void ompTaskDrain();
+
+extern RT_L1_TINY_DATA void (*ompPlainFn)(void *);
+void ompPlainTeamEntry(void *data);
+
+void ompTeamReduce(omp_team_t *team, void *data, void (*combine)(void *dst, void *src, void *arg), void *arg);
+
+// Runtime operations for which time is accounted on each core. This is
+// also defined without instrumentation as the stats helpers are always called.
+typedef enum {
+  OMP_STATS_PARALLEL,   // Execution of parallel region bodies
+  OMP_STATS_BARRIER,    // Waiting in barriers, including the end of regions on the master
+  OMP_STATS_CRITICAL,   // Waiting to enter critical sections
+  OMP_STATS_LOOP,       // Getting loop iterations
+  OMP_STATS_NB
+} ompStats_e;
+
+#ifdef __OMP_STATS__
+
+typedef struct {
+  unsigned int cycles[OMP_STATS_NB];
+  unsigned int count[OMP_STATS_NB];
+} ompCoreStats_t;
+
+// Regions are identified by their function, the last entry accumulates the
+// regions which do not fit in the table
+#define OMP_STATS_NB_REGIONS 8
+
+typedef struct {
+  void (*fn)(void *);
+  unsigned int count;
+  unsigned int work[ARCHI_CLUSTER_NB_PE];
+} ompRegionStats_t;
+
+typedef struct {
+  void (*fn)(void *);
+  void *data;
+  int region;
+} ompStatsRegionDesc_t;
+
+extern RT_L1_DATA ompCoreStats_t ompCoreStats[ARCHI_CLUSTER_NB_PE];
+
+int ompStatsRegionStart(void (*fn)(void *));
+void ompStatsRegionStop(int region, unsigned int start);
+void *ompStatsRegionPrepare(void (*fn)(void *), void *data);
+void ompStatsRegionEntry(void *arg);
+
+#endif
+
+// Stats helpers, they are empty when the instrumentation is not enabled so
+// that the runtime does not pay anything for them
+static inline unsigned int ompStatsStart()
+{
+#ifdef __OMP_STATS__
+  return rt_perf_cl_read(RT_PERF_CYCLES);
+#else
+  return 0;
+#endif
+}
+
+static inline void ompStatsStop(int op, unsigned int start)
+{
+#ifdef __OMP_STATS__
+  ompCoreStats_t *stats = &ompCoreStats[rt_core_id()];
+  stats->cycles[op] += rt_perf_cl_read(RT_PERF_CYCLES) - start;
+  stats->count[op]++;
+#endif
+}
 
 static inline void perfInitAndStart()
 {
@@ -106,36 +258,6 @@ static inline void perfParallelExit()
 int omp_init(omp_t *_this);
 int omp_start(omp_t *_this, int (*entry)(void *), void *args);
 
-static inline int getThreadNum(omp_t *omp)
-{
-  return rt_core_id();
-}
-
-#ifdef __GNUC__
-static inline ompTask_t *allocTask(omp_t *_this, int arg_size) 
-{
-#if 0
-  ompTask_t *task = _this->taskPool;
-  if (task == NULL) return NULL;
-  _this->taskPool = task->next;
-  return task;
-#else
-  //return (ompTask_t *)rt_l1_alloc(rtCc, sizeof(ompTask_t)+arg_size);
-  return (void *)0;
-#endif
-}
-#endif
-
-static inline void freeTask(omp_t *_this, ompTask_t *task) 
-{
-#if 1
-  //task->next = _this->taskPool;
-  //_this->taskPool = task;
-#else
-  rt_l1_free(rtCc, (unsigned int)task);
-#endif
-}
-
 // This returns OMP data in 3 instructions (address construction + load)
 static inline omp_t *omp_getData() {
   return (omp_t *)&ompData;
@@ -150,13 +272,29 @@ static inline void omp_setData(rt_cc_t *rtCc, omp_t *_this) {
 #endif
 
 static inline omp_team_t *getTeam(omp_t *_this) {
+#ifdef OMP_HAS_TEAMS
+  return ompCoreTeams[rt_core_id()];
+#else
   return &_this->plainTeam;
+#endif
 }
 
 static inline omp_team_t *getCurrentTeam() {
   return getTeam(omp_getData());
 }
 
+static inline int getThreadNum(omp_t *omp)
+{
+#ifdef OMP_HAS_TEAMS
+  // Team cores may not be contiguous, the thread number is the rank of the
+  // core in the team
+  int coreId = rt_core_id();
+  return __builtin_popcount(getTeam(omp)->coreMask & ((1 << coreId) - 1));
+#else
+  return rt_core_id();
+#endif
+}
+
 static inline void criticalStart(omp_team_t *team)
 {
 #if EU_VERSION >= 3
@@ -171,7 +309,9 @@ static inline void userCriticalStart(omp_team_t *team)
 #ifdef __PROFILE0__
   pulp_trace(TRACE_OMP_CRITICAL_ENTER);
 #endif
+  unsigned int start = ompStatsStart();
   criticalStart(team);
+  ompStatsStop(OMP_STATS_CRITICAL, start);
 }
 
 static inline void criticalEnd(omp_team_t *team)
@@ -191,7 +331,32 @@ static inline void userCriticalEnd(omp_team_t *team)
 #endif
 }
 
+// Execute the pending tasks of the team before entering a barrier, so that
+// they are all finished when the barrier is released
+static inline __attribute__((always_inline)) void taskDrain() {
+  if (*(volatile int *)&getCurrentTeam()->nbPendingTasks)
+    ompTaskDrain();
+}
+
 static inline __attribute__((always_inline)) void doBarrier(omp_team_t *team) {
+  taskDrain();
+  unsigned int start = ompStatsStart();
+#ifdef OMP_HAS_TEAMS
+  // Serial teams of nested regions have no barrier, and must not use the
+  // plain team one
+  if (team && team->nbThreads == 1)
+  {
+    ompStatsStop(OMP_STATS_BARRIER, start);
+    return;
+  }
+
+  if (team && team->barId)
+  {
+    eu_bar_trig_wait_clr(eu_bar_addr(team->barId));
+    ompStatsStop(OMP_STATS_BARRIER, start);
+    return;
+  }
+#endif
 #if EU_VERSION >= 3
   rt_team_barrier();
 #else
@@ -199,6 +364,7 @@ static inline __attribute__((always_inline)) void doBarrier(omp_team_t *team) {
   pulp_evt_wait();
   pulp_gpevt_clear(0);
 #endif
+  ompStatsStop(OMP_STATS_BARRIER, start);
 }
 
 static inline void userBarrier(omp_team_t *team) {
@@ -213,17 +379,25 @@ static inline void userBarrier(omp_team_t *team) {
 
 static inline void __attribute__((always_inline)) parallelRegionExec(void *data, void (*fn) (void*))
 {
+#ifdef __OMP_STATS__
+  // All threads go through a wrapper measuring the time spent in the region
+  data = ompStatsRegionPrepare(fn, data);
+  fn = ompStatsRegionEntry;
+#endif
+
+  ompPlainFn = fn;
+
 #if EU_VERSION >= 3
   // Now that the team is ready, wake up slaves
-  eu_dispatch_push((unsigned int)fn);
+  eu_dispatch_push((unsigned int)ompPlainTeamEntry);
   eu_dispatch_push((unsigned int)data);
 #else
-  plp_dispatch_push2((1<<getCurrentTeam()->nbThreads)-1, (unsigned int)fn, (unsigned int)data);
+  plp_dispatch_push2((1<<getCurrentTeam()->nbThreads)-1, (unsigned int)ompPlainTeamEntry, (unsigned int)data);
 #endif
 
   // Team execution
   perfParallelEnter();  
-#ifdef __GNUC__
+#if defined(__GNUC__) || defined(__OMP_STATS__)
   fn(data);
 #else
   kmpc_micro entry = (kmpc_micro)fn;
@@ -236,10 +410,33 @@ static inline void __attribute__((always_inline)) parallelRegionExec(void *data,
   doBarrier((void *)0);
 }
 
+// Number of threads of a region created by parallelRegion, which can be
+// known before the region is created when it is not nested
+static inline int parallelRegionNbThreads(int num_threads)
+{
+  int nbCores = __builtin_popcount(omp_getData()->coreMask);
+
+  if (num_threads && num_threads < nbCores)
+    return num_threads;
+
+  return nbCores;
+}
+
 static inline void __attribute__((always_inline)) parallelRegion(void *data, void (*fn) (void*), int num_threads)
 {
   int coreMask = omp_getData()->coreMask;
 
+#ifdef OMP_HAS_TEAMS
+  // Nested regions are executed by a new team on the cores available to the
+  // calling thread
+  if (!ompTopLevel)
+  {
+    ompParallelTeam(fn, data, num_threads, 0);
+    return;
+  }
+  ompTopLevel = 0;
+#endif
+
   if (((1 << num_threads) & coreMask) <= 1) {
     // We differentiate plain team and partial teams to put more optimizations on plain teams
     // as they are the most used
@@ -247,6 +444,10 @@ static inline void __attribute__((always_inline)) parallelRegion(void *data, voi
   } else {
     partialParallelRegion(fn, data, num_threads);
   }
+
+#ifdef OMP_HAS_TEAMS
+  ompTopLevel = 1;
+#endif
 }
 
 static inline __attribute__((always_inline)) unsigned int sectionGet()
@@ -334,6 +535,84 @@ end:
 }
 
 
+static inline int staticLoopNbIter(int start, int end, int incr)
+{
+  if (incr > 0)
+    return end > start ? (end - start + incr - 1) / incr : 0;
+  else
+    return start > end ? (start - end - incr - 1) / -incr : 0;
+}
+
+// Gives the contiguous block of iterations [*first, *last) of a thread when
+// no chunk size is specified. When the iterations cannot be evenly divided,
+// the first threads get one more iteration.
+static inline void staticLoopBlock(int nb_iter, int nb_threads, int thread, int *first, int *last)
+{
+  int size = nb_iter / nb_threads;
+  int remain = nb_iter - size * nb_threads;
+  int start;
+
+  if (thread < remain)
+  {
+    size++;
+    start = size * thread;
+  }
+  else
+  {
+    start = size * thread + remain;
+  }
+
+  *first = start;
+  *last = start + size;
+}
+
+static inline void staticLoopInit(int core_id, int nb_threads, int thread, int start, int end, int incr, int chunk_size)
+{
+  omp_static_loop_t *loop = &omp_static_loop[core_id];
+  int nb_iter = staticLoopNbIter(start, end, incr);
+
+  loop->start = start;
+  loop->incr = incr;
+  loop->nb_iter = nb_iter;
+
+  if (chunk_size > 0)
+  {
+    // Round-robin distribution of the chunks
+    loop->chunk = chunk_size;
+    loop->step = chunk_size * nb_threads;
+    loop->next = chunk_size * thread;
+  }
+  else
+  {
+    // One block per thread, the next iteration is then out of the loop
+    int first, last;
+    staticLoopBlock(nb_iter, nb_threads, thread, &first, &last);
+    loop->chunk = last - first;
+    loop->step = nb_iter;
+    loop->next = last > first ? first : nb_iter;
+  }
+}
+
+static inline __attribute__((always_inline)) int staticLoopIter(int *istart, int *iend)
+{
+  omp_static_loop_t *loop = &omp_static_loop[rt_core_id()];
+  int first = loop->next;
+
+  if (first >= loop->nb_iter)
+    return 0;
+
+  int last = first + loop->chunk;
+  if (last > loop->nb_iter)
+    last = loop->nb_iter;
+
+  loop->next = first + loop->step;
+
+  *istart = loop->start + first * loop->incr;
+  *iend = loop->start + last * loop->incr;
+
+  return 1;
+}
+
 static inline __attribute__((always_inline)) int dynLoopIter(
   omp_team_t *team, int *istart, int *iend, int *isLast)
 {
@@ -377,7 +656,7 @@ end:
     *istart = start;
     if (start + chunk > end)
       chunk = end - start;
-    *iend = start;
+    *iend = start + chunk;
 
     result = 1;
 
@@ -497,6 +776,105 @@ static inline void dynLoopInitSingle(omp_team_t *team, int start, int end, int i
 #endif
 }
 
+// Guided loops are always handled in software, as the chunk size of the
+// hardware loop unit is fixed when the loop is configured. The size of each
+// chunk is the number of remaining iterations divided by the number of
+// threads, bounded by the requested chunk size, so that only a few big chunks
+// are dispatched at the beginning and smaller ones at the end to balance the
+// load.
+static inline __attribute__((always_inline)) int guidedLoopIter(omp_team_t *team, int *istart, int *iend)
+{
+#if EU_VERSION == 3
+  int core_id = rt_core_id();
+
+  eu_mutex_lock(eu_mutex_addr(0));
+
+  if (team->guided_epoch - core_guided_epoch[core_id] == 0)
+  {
+    int first = team->guided_next;
+    int remain = team->guided_nb_iter - first;
+
+    if (remain <= 0)
+    {
+      team->guided_epoch++;
+      team->guided_is_setup = 0;
+      core_guided_epoch[core_id]++;
+      eu_mutex_unlock(eu_mutex_addr(0));
+      return 0;
+    }
+
+    int size = (remain + team->nbThreads - 1) / team->nbThreads;
+    if (size < team->guided_chunk)
+      size = team->guided_chunk;
+    if (size > remain)
+      size = remain;
+
+    team->guided_next = first + size;
+
+    eu_mutex_unlock(eu_mutex_addr(0));
+
+    *istart = team->guided_start + first * team->guided_incr;
+    *iend = team->guided_start + (first + size) * team->guided_incr;
+
+    return 1;
+  }
+  else
+  {
+    eu_mutex_unlock(eu_mutex_addr(0));
+    core_guided_epoch[core_id]++;
+    return 0;
+  }
+#else
+  return 0;
+#endif
+}
+
+static inline void guidedLoopSetup(omp_team_t *team, int start, int end, int incr, int chunk_size)
+{
+#if EU_VERSION == 3
+  team->guided_is_setup = 1;
+  team->guided_next = 0;
+  team->guided_nb_iter = staticLoopNbIter(start, end, incr);
+  team->guided_start = start;
+  team->guided_incr = incr;
+  team->guided_chunk = chunk_size > 0 ? chunk_size : 1;
+#endif
+}
+
+static inline int guidedLoopInitNoIter(omp_team_t *team, int start, int end, int incr, int chunk_size)
+{
+#if EU_VERSION == 3
+  int core_id = rt_core_id();
+
+  eu_mutex_lock(eu_mutex_addr(0));
+
+  if (team->guided_epoch - core_guided_epoch[core_id] != 0)
+  {
+    // The loop is already over
+    eu_mutex_unlock(eu_mutex_addr(0));
+    core_guided_epoch[core_id]++;
+    return 0;
+  }
+
+  if (!team->guided_is_setup)
+    guidedLoopSetup(team, start, end, incr, chunk_size);
+
+  eu_mutex_unlock(eu_mutex_addr(0));
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static inline int guidedLoopInit(omp_team_t *team, int start, int end, int incr, int chunk_size, int *istart, int *iend)
+{
+  if (!guidedLoopInitNoIter(team, start, end, incr, chunk_size))
+    return 0;
+
+  return guidedLoopIter(team, istart, iend);
+}
+
 static inline int singleStart()
 {
 #ifdef ARCHI_EU_HAS_DYNLOOP
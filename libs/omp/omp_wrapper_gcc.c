@@ -20,6 +20,7 @@
 
 #include "ompRt.h"
 #include "omp.c"
+#include <string.h>
 
 /*
  * GCC wrapper
@@ -82,7 +83,10 @@ int GOMP_loop_dynamic_start(int start, int end, int incr, int chunk_size,
   omp_team_t *team = getCurrentTeam();
   int isLast;
 
-  return dynLoopInit(team, start, end, incr, chunk_size, istart, iend);
+  unsigned int stats = ompStatsStart();
+  int ret = dynLoopInit(team, start, end, incr, chunk_size, istart, iend);
+  ompStatsStop(OMP_STATS_LOOP, stats);
+  return ret;
 }
 
 
@@ -91,7 +95,9 @@ int GOMP_loop_dynamic_next (int *istart, int *iend)
 {
   omp_team_t *team = getCurrentTeam();
   int isLast;
+  unsigned int stats = ompStatsStart();
   int ret = dynLoopIter(team, istart, iend, &isLast);
+  ompStatsStop(OMP_STATS_LOOP, stats);
   return ret;
 }
 
@@ -105,13 +111,23 @@ void GOMP_loop_end()
 int GOMP_loop_guided_start(int start, int end, int incr, int chunk_size,
                         int *istart, int *iend)
 {
+#if EU_VERSION == 3
+  unsigned int stats = ompStatsStart();
+  int ret = guidedLoopInit(getCurrentTeam(), start, end, incr, chunk_size, istart, iend);
+  ompStatsStop(OMP_STATS_LOOP, stats);
+  return ret;
+#else
   return GOMP_loop_dynamic_start(start, end, incr, chunk_size, istart, iend);
+#endif
 }
 
 int GOMP_loop_guided_next (int *istart, int *iend)
 {
 #if EU_VERSION == 3
-  return 0;
+  unsigned int stats = ompStatsStart();
+  int ret = guidedLoopIter(getCurrentTeam(), istart, iend);
+  ompStatsStop(OMP_STATS_LOOP, stats);
+  return ret;
 #else
   return GOMP_loop_dynamic_next(istart, iend);
 #endif
@@ -120,64 +136,167 @@ int GOMP_loop_guided_next (int *istart, int *iend)
 int GOMP_loop_static_start(int start, int end, int incr, int chunk_size,
                         int *istart, int *iend)
 {
-  return GOMP_loop_dynamic_start(start, end, incr, chunk_size, istart, iend);
+  omp_team_t *team = getCurrentTeam();
+  unsigned int stats = ompStatsStart();
+
+  // Each thread computes its own iterations, nothing is shared
+  staticLoopInit(rt_core_id(), team->nbThreads, getThreadNum(omp_getData()), start, end, incr, chunk_size);
+
+  int ret = staticLoopIter(istart, iend);
+  ompStatsStop(OMP_STATS_LOOP, stats);
+  return ret;
 }
 
 int GOMP_loop_static_next (int *istart, int *iend)
 {
-#if EU_VERSION == 3
-  return 0;
-#else
-  omp_team_t *team = getCurrentTeam();
-  int isLast;
-  int ret = dynLoopIter(team, istart, iend, &isLast);
+  unsigned int stats = ompStatsStart();
+  int ret = staticLoopIter(istart, iend);
+  ompStatsStop(OMP_STATS_LOOP, stats);
   return ret;
-#endif
 }
 
-#if 0
 void GOMP_task(void (*func)(void *), void *data, void (*copy_func)(void *, void *),
-	       long arg_size, long arg_align, int if_cond, unsigned gomp_flags, void **depend) 
+	       long arg_size, long arg_align, int if_cond, unsigned gomp_flags, void **depend,
+	       int priority)
 {
-  omp_team_t *team = getCurrentTeam();
-  omp_t *_this = omp_getData();
-  criticalStart(team);
-  ompTask_t *task = allocTask(rtCc, _this, arg_size);
-  if (task == NULL) {
-    criticalEnd(team);
-    //printf("Direct exec\n");
-    func(data);
-  } else {
-    //printf("Enqueue %x %x %x %x %x\n", (int)func, (int)data, (int)copy_func, (int)arg_size, (int)arg_align);
-    task->func = func;
-    void *args = (void *)((unsigned int)task + sizeof(ompTask_t));
-    rt_memcpy(args, data, arg_size);
-    task->data = args;
-    team->hasTasks = 1;
-    if (team->firstReadyTask == NULL) team->firstReadyTask = task;
-    else team->lastReadyTask->next = task;
-    team->lastReadyTask = task;
-    task->next = NULL;
-    criticalEnd(team);
+  int nbDeps = 0;
+  unsigned int outMask = 0;
+  void **deps = NULL;
+
+  if ((gomp_flags & GOMP_TASK_FLAG_DEPEND) && depend)
+  {
+    // Output dependencies are always given first
+    int nbOut;
+    if ((int)depend[0])
+    {
+      nbDeps = (int)depend[0];
+      nbOut = (int)depend[1];
+      deps = &depend[2];
+    }
+    else
+    {
+      // Extended format, mutexinoutset dependencies are handled as outputs
+      nbDeps = (int)depend[1];
+      nbOut = (int)depend[2] + (int)depend[3];
+      deps = &depend[5];
+    }
+    outMask = (1 << nbOut) - 1;
   }
 
+  ompTask_t *task = NULL;
+  if (if_cond && nbDeps <= OMP_TASK_NB_DEPS)
+    task = ompTaskAlloc(arg_size, arg_align);
+
+  if (task == NULL)
+  {
+    // Too many dependencies to be tracked, just wait for all previous
+    // sibling tasks
+    if (nbDeps > OMP_TASK_NB_DEPS)
+    {
+      ompTaskWait();
+      nbDeps = 0;
+    }
+
+    if (copy_func)
+    {
+      char buffer[arg_size + arg_align - 1];
+      void *args = (void *)(((unsigned int)buffer + arg_align - 1) & ~(arg_align - 1));
+      copy_func(args, data);
+      ompTaskExecUndeferred(func, args, nbDeps, outMask, deps);
+    }
+    else
+    {
+      ompTaskExecUndeferred(func, data, nbDeps, outMask, deps);
+    }
+    return;
+  }
 
-#if 0
-  int nbdepend = (uintptr_t) depend[0];
-  int i;
-  printf("%x %x %x %x %x %x %x %d\n", (int)func, (int)data, (int)copy_func, (int)arg_size, (int)arg_align, (int)if_cond, (int)gomp_flags, nbdepend);
-  for (i = 0; i < nbdepend; i++)
-    printf("%x\n", (int)depend[i+2]);
-  func(data);
-#endif
+  if (copy_func)
+    copy_func(task->data, data);
+  else
+    memcpy(task->data, data, arg_size);
+
+  task->func = func;
+
+  ompTaskSubmit(task, nbDeps, outMask, deps);
+}
+
+void GOMP_taskwait(void)
+{
+  ompTaskWait();
 }
-  #endif
 
 int GOMP_single_start(void)
 { 
   return singleStart();
 }
 
+#ifdef OMP_HAS_TEAMS
+
+typedef enum {
+  OMP_LOOP_STATIC,
+  OMP_LOOP_DYNAMIC,
+  OMP_LOOP_GUIDED
+} ompLoopSched_e;
+
+typedef struct {
+  void (*fn) (void *);
+  void *data;
+  ompLoopSched_e sched;
+  int start;
+  int end;
+  int incr;
+  int chunk_size;
+} ompParallelLoop_t;
+
+// In nested regions, the team is only known once it is created, so each
+// thread sets up the loop before entering the region
+static void ompParallelLoopEntry(void *arg)
+{
+  ompParallelLoop_t *loop = (ompParallelLoop_t *)arg;
+  omp_team_t *team = getCurrentTeam();
+
+  switch (loop->sched)
+  {
+    case OMP_LOOP_STATIC:
+      staticLoopInit(rt_core_id(), team->nbThreads, getThreadNum(omp_getData()), loop->start, loop->end, loop->incr, loop->chunk_size);
+      break;
+    case OMP_LOOP_DYNAMIC:
+      dynLoopInitNoIter(team, loop->start, loop->end, loop->incr, loop->chunk_size);
+      break;
+    case OMP_LOOP_GUIDED:
+      guidedLoopInitNoIter(team, loop->start, loop->end, loop->incr, loop->chunk_size);
+      break;
+  }
+
+  loop->fn(loop->data);
+}
+
+static int ompParallelLoopNested(void (*fn) (void *), void *data, unsigned num_threads, unsigned flags,
+  ompLoopSched_e sched, long start, long end, long incr, long chunk_size)
+{
+  if (ompTopLevel)
+    return 0;
+
+  ompParallelLoop_t loop = { fn, data, sched, start, end, incr, chunk_size };
+  ompParallelTeam(ompParallelLoopEntry, &loop, num_threads, flags);
+  return 1;
+}
+
+#else
+
+static inline int ompParallelLoopNested(void (*fn) (void *), void *data, unsigned num_threads, unsigned flags,
+  int sched, long start, long end, long incr, long chunk_size)
+{
+  return 0;
+}
+
+#define OMP_LOOP_STATIC  0
+#define OMP_LOOP_DYNAMIC 1
+#define OMP_LOOP_GUIDED  2
+
+#endif
+
 #if 0
 void
 GOMP_parallel_loop_dynamic_start (void (*fn) (void *), void *data,
@@ -202,10 +321,50 @@ GOMP_parallel_loop_dynamic (void (*fn) (void *), void *data,
   omp_team_t *team = getCurrentTeam();
   int isLast;
 
+  if (ompParallelLoopNested(fn, data, num_threads, flags, OMP_LOOP_DYNAMIC, start, end, incr, chunk_size))
+    return;
+
   dynLoopInitSingle(team, start, end, incr, chunk_size, num_threads);
   parallelRegion(data, fn, num_threads);
 }
 
+void
+GOMP_parallel_loop_static (void (*fn) (void *), void *data,
+                           unsigned num_threads, long start, long end,
+                           long incr, long chunk_size, unsigned flags)
+{
+  if (ompParallelLoopNested(fn, data, num_threads, flags, OMP_LOOP_STATIC, start, end, incr, chunk_size))
+    return;
+
+  // The team threads directly call GOMP_loop_static_next, so their state
+  // must be ready before they are woken up. This must use the size of the
+  // team which is about to be created, not the one of the calling thread.
+  int nb_threads = parallelRegionNbThreads(num_threads);
+
+  for (int i=0; i<nb_threads; i++)
+  {
+    staticLoopInit(i, nb_threads, i, start, end, incr, chunk_size);
+  }
+
+  parallelRegion(data, fn, num_threads);
+}
+
+#if EU_VERSION == 3
+void
+GOMP_parallel_loop_guided (void (*fn) (void *), void *data,
+                           unsigned num_threads, long start, long end,
+                           long incr, long chunk_size, unsigned flags)
+{
+  omp_team_t *team = getCurrentTeam();
+
+  if (ompParallelLoopNested(fn, data, num_threads, flags, OMP_LOOP_GUIDED, start, end, incr, chunk_size))
+    return;
+
+  guidedLoopSetup(team, start, end, incr, chunk_size);
+  parallelRegion(data, fn, num_threads);
+}
+#endif
+
 void GOMP_loop_end_nowait()
 {
 }
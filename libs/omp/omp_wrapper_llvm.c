@@ -71,6 +71,23 @@ __kmpc_for_static_init_4( ident_t *loc, kmp_int32 gtid, kmp_int32 schedtype, kmp
   omp_t *omp = omp_getData();
   omp_team_t *team = getTeam(omp);
   int threadNum = getThreadNum(omp);
+
+  // Unchunked static schedule (kmp_sch_static), each thread gets one
+  // contiguous block
+  if (schedtype == 34 || chunk < 1)
+  {
+    int nb_iter = staticLoopNbIter(*plower, *pupper + (incr > 0 ? 1 : -1), incr);
+    int first, last;
+    staticLoopBlock(nb_iter, team->nbThreads, threadNum, &first, &last);
+
+    *pstride = nb_iter * incr;
+    if (plastiter)
+      *plastiter = last == nb_iter && last > first;
+    *pupper = *plower + (last - 1) * incr;
+    *plower = *plower + first * incr;
+    return;
+  }
+
   int loopSize = chunk*incr;
   int loopSizeAll = loopSize * team->nbThreads;
 
@@ -146,6 +163,53 @@ __kmpc_end_single(ident_t *loc, kmp_int32 global_tid)
 {
 }
 
+static void __omp_reduce_combine(void *dst, void *src, void *arg)
+{
+  void (*reduce_func)(void *, void *) = (void (*)(void *, void *))arg;
+  reduce_func(dst, src);
+}
+
+// The private data of the threads are combined in a tree, and only the master
+// thread is then asked to update the shared variables with its private data,
+// which removes the critical section per thread.
+kmp_int32
+__kmpc_reduce_nowait(ident_t *loc, kmp_int32 global_tid, kmp_int32 num_vars, int reduce_size,
+                     void *reduce_data, void (*reduce_func)(void *lhs_data, void *rhs_data),
+                     kmp_critical_name *lck)
+{
+  ompTeamReduce(getCurrentTeam(), reduce_data, __omp_reduce_combine, (void *)reduce_func);
+  return getThreadNum(omp_getData()) == 0;
+}
+
+void
+__kmpc_end_reduce_nowait(ident_t *loc, kmp_int32 global_tid, kmp_critical_name *lck)
+{
+}
+
+kmp_int32
+__kmpc_reduce(ident_t *loc, kmp_int32 global_tid, kmp_int32 num_vars, int reduce_size,
+              void *reduce_data, void (*reduce_func)(void *lhs_data, void *rhs_data),
+              kmp_critical_name *lck)
+{
+  omp_team_t *team = getCurrentTeam();
+
+  ompTeamReduce(team, reduce_data, __omp_reduce_combine, (void *)reduce_func);
+
+  if (getThreadNum(omp_getData()) == 0)
+    return 1;
+
+  // Other threads wait until the master has updated the shared variables,
+  // the master joins this barrier in __kmpc_end_reduce
+  doBarrier(team);
+  return 0;
+}
+
+void
+__kmpc_end_reduce(ident_t *loc, kmp_int32 global_tid, kmp_critical_name *lck)
+{
+  doBarrier(getCurrentTeam());
+}
+
 typedef kmp_int32 (* kmp_routine_entry_t)( kmp_int32, void * );
 
 typedef struct kmp_task {
@@ -160,26 +224,111 @@ typedef int kmp_tasking_flags_t;
 typedef int size_t;
 typedef int bool;
 
+typedef struct kmp_depend_info {
+  int base_addr;
+  size_t len;
+  struct {
+    bool in:1;
+    bool out:1;
+  } flags;
+} kmp_depend_info_t;
+
+static void __omp_kmp_task_entry(void *arg)
+{
+  kmp_task_t *task = (kmp_task_t *)arg;
+  task->routine(0, task);
+}
+
 kmp_task_t *
 __kmpc_omp_task_alloc( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 flags,
                        size_t sizeof_kmp_task_t, size_t sizeof_shareds,
                        kmp_routine_entry_t task_entry )
 {
-  rt_cc_t *rtCc = rt_getCcData(rt_clusterId());
-  // TODO this is crashing if NULL is returned and libomp seems to ignore
-  // memory exhaustion ...
-  kmp_task_t *task = (kmp_task_t *)rt_l1_alloc(rtCc, sizeof(kmp_task_t) + sizeof_kmp_task_t + sizeof_shareds);
+  ompTask_t *desc = ompTaskAlloc(sizeof_kmp_task_t + sizeof_shareds, 8);
+
+  if (desc == NULL)
+  {
+    // The pool is empty, the task will be executed immediately. The
+    // allocator is not multi-core safe, protect it with the task lock.
+    int size = sizeof(ompTask_t) + sizeof_kmp_task_t + sizeof_shareds;
+    ompTaskLock(&omp_getData()->taskLock);
+    desc = rt_alloc_align(RT_ALLOC_CL_DATA + rt_cluster_id(), size, 8);
+    ompTaskUnlock(&omp_getData()->taskLock);
+    // The compiler-generated code does not check the returned task, there is
+    // no way to recover
+    if (desc == NULL)
+      rt_fatal("Unable to allocate OpenMP task (size: %d)\n", size);
+    desc->data = (void *)(desc + 1);
+    desc->func = NULL;
+    desc->allocSize = size;
+  }
+  else
+  {
+    desc->func = __omp_kmp_task_entry;
+  }
+
+  kmp_task_t *task = (kmp_task_t *)desc->data;
+  task->shareds = (void *)((char *)task + sizeof_kmp_task_t);
   task->routine = task_entry;
   task->part_id = 0;
   return task;
 }
 
+static kmp_int32 __omp_kmp_task(kmp_task_t *new_task, int nbDeps, unsigned int outMask, void **deps)
+{
+  ompTask_t *desc = (ompTask_t *)new_task - 1;
+
+  if (desc->func == NULL)
+  {
+    ompTaskExecUndeferred(__omp_kmp_task_entry, new_task, nbDeps, outMask, deps);
+    ompTaskLock(&omp_getData()->taskLock);
+    rt_free(RT_ALLOC_CL_DATA + rt_cluster_id(), desc, desc->allocSize);
+    ompTaskUnlock(&omp_getData()->taskLock);
+  }
+  else
+  {
+    ompTaskSubmit(desc, nbDeps, outMask, deps);
+  }
+
+  return 0;
+}
+
 kmp_int32
 __kmpc_omp_task( ident_t *loc_ref, kmp_int32 gtid, kmp_task_t * new_task)
 {
-  rt_cc_t *rtCc = rt_getCcData(rt_clusterId());
-  new_task->routine(gtid, new_task);
-  rt_l1_free(rtCc, (unsigned int)new_task);
+  return __omp_kmp_task(new_task, 0, 0, NULL);
+}
+
+kmp_int32
+__kmpc_omp_task_with_deps(ident_t *loc_ref, kmp_int32 gtid, kmp_task_t *new_task,
+                          kmp_int32 ndeps, kmp_depend_info_t *dep_list,
+                          kmp_int32 ndeps_noalias, kmp_depend_info_t *noalias_dep_list)
+{
+  void *deps[OMP_TASK_NB_DEPS];
+  unsigned int outMask = 0;
+
+  if (ndeps > OMP_TASK_NB_DEPS)
+  {
+    // Too many dependencies to be tracked, just wait for all previous
+    // sibling tasks
+    ompTaskWait();
+    ndeps = 0;
+  }
+
+  for (int i=0; i<ndeps; i++)
+  {
+    deps[i] = (void *)dep_list[i].base_addr;
+    if (dep_list[i].flags.out)
+      outMask |= 1 << i;
+  }
+
+  return __omp_kmp_task(new_task, ndeps, outMask, deps);
+}
+
+kmp_int32
+__kmpc_omp_taskwait(ident_t *loc_ref, kmp_int32 gtid)
+{
+  ompTaskWait();
   return 0;
 }
 